@@ -0,0 +1,120 @@
+#pragma once
+
+#include "stdint.h"
+#include "nonoderbtree.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // Interval tree: value is the closed interval [m_key, m_high],
+    // m_max - max m_high of the subtree, maintained by the tree.
+    // NoNodeRBTree<K, V, IntervalAugment>, one interval per start key.
+    struct IntervalAugment
+    {
+        template<class V>
+        inline void operator()(V node) const noexcept
+        {
+            auto max = node->m_high;
+            if (nullptr != node->m_left && max < node->m_left->m_max)
+                max = node->m_left->m_max;
+
+            if (nullptr != node->m_right && max < node->m_right->m_max)
+                max = node->m_right->m_max;
+
+            node->m_max = max;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // Range sums: m_sum - sum of m_weight over the subtree, maintained by the tree.
+    struct SumAugment
+    {
+        template<class V>
+        inline void operator()(V node) const noexcept
+        {
+            auto sum = node->m_weight;
+            if (nullptr != node->m_left)
+                sum += node->m_left->m_sum;
+
+            if (nullptr != node->m_right)
+                sum += node->m_right->m_sum;
+
+            node->m_sum = sum;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    namespace Detail
+    {
+        template<class K, class V, class Fn>
+        void find_overlapping(V node, const K& low, const K& high, Fn& fn)
+        {
+            // nothing in the subtree ends at low or later
+            while (nullptr != node && !(node->m_max < low))
+            {
+                find_overlapping(node->m_left, low, high, fn);
+
+                // right subtree starts even later
+                if (high < node->m_key)
+                    return;
+
+                if (!(node->m_high < low))
+                    fn(node);
+
+                node = node->m_right;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------//
+
+    // fn(V) for every interval intersecting [low, high], in key order
+    // O(min(n, k log n)) for k found intervals: every one may cost a descent of its own
+    template<class K, class V, class Fn>
+    void find_overlapping(const NoNodeRBTree<K, V, IntervalAugment>& tree, const K& low, const K& high, Fn fn)
+    {
+        Detail::find_overlapping(tree.root(), low, high, fn);
+    }
+
+    //--------------------------------------------------------------//
+
+    // sum of m_weight for keys less than key, O(log n)
+    template<class K, class V>
+    auto prefix_sum(const NoNodeRBTree<K, V, SumAugment>& tree, const K& key) noexcept
+    {
+        decltype(tree.root()->m_sum) sum{};
+        V node = tree.root();
+        while (nullptr != node)
+        {
+            if (node->m_key < key)
+            {
+                if (nullptr != node->m_left)
+                    sum += node->m_left->m_sum;
+
+                sum += node->m_weight;
+                node = node->m_right;
+            }
+            else
+            {
+                node = node->m_left;
+            }
+        }
+
+        return sum;
+    }
+
+    //--------------------------------------------------------------//
+
+    // sum of m_weight for keys in [first, last), O(log n)
+    template<class K, class V>
+    auto sum_range(const NoNodeRBTree<K, V, SumAugment>& tree, const K& first, const K& last) noexcept
+    {
+        if (!(first < last))
+            return decltype(prefix_sum(tree, first)){};
+
+        return prefix_sum(tree, last) - prefix_sum(tree, first);
+    }
+}
@@ -1,8 +1,11 @@
 #include <algorithm>
+#include <atomic>
 #include <map>
+#include <shared_mutex>
 #include <thread>
 #include <list>
 #include <fstream>
+#include <string>
 
 #include <stdint.h>
 
@@ -11,6 +14,14 @@
 #include "common.h"
 #include "testgen.h"
 #include "rbtree.h"
+#include "concurrentrbtree.h"
+#include "poolallocator.h"
+#include "shardedrbtree.h"
+#include "augment.h"
+#include "btree.h"
+#include "indexptr.h"
+#include "treeimage.h"
+#include "parallel.h"
 
 #define key_t uint32_t
 #define value_t Test::TestValue*
@@ -34,6 +45,16 @@ namespace Test
             return std::map<K, V>::erase(key);
         }
 
+        size_t count(const K& key) {
+            std::lock_guard<decltype (m_lock)> g(m_lock);
+            return std::map<K, V>::count(key);
+        }
+
+        typename std::map<K, V>::iterator lower_bound(const K& key) {
+            std::lock_guard<decltype (m_lock)> g(m_lock);
+            return std::map<K, V>::lower_bound(key);
+        }
+
     private:
         std::mutex m_lock;
     };
@@ -59,10 +80,112 @@ namespace Test
 
     //////////////////////////////////////////////////////////////////
 
+    struct PtrLinkedValue
+    {
+        PtrLinkedValue* m_left;
+
+        PtrLinkedValue* m_right;
+
+        PtrLinkedValue* m_parent;
+
+        key_t m_key;
+
+        value_t m_value;
+    };
+
+    struct IndexLinkedValue
+    {
+        RBTree::IndexPtr<IndexLinkedValue> m_left;
+
+        RBTree::IndexPtr<IndexLinkedValue> m_right;
+
+        RBTree::IndexPtr<IndexLinkedValue> m_parent;
+
+        key_t m_key;
+
+        value_t m_value;
+    };
+
+    //--------------------------------------------------------------//
+
+    // contiguous as IndexPool, but gives out pointers
     template<class T>
-    Duration BenchMap(const std::vector<TestCommand>& commands, std::vector<value_t>& values, uint32_t nthreads) noexcept
+    class PtrPool
     {
-        T map;
+    public:
+        using pointer = T*;
+
+        explicit PtrPool(uint32_t capacity)
+          : m_values(capacity), m_bump(0)
+        {
+            m_free.reserve(capacity);
+        }
+
+        pointer allocate() noexcept
+        {
+            if (!m_free.empty())
+            {
+                pointer const ptr = m_free.back();
+                m_free.pop_back();
+                return ptr;
+            }
+
+            return (m_values.size() == m_bump) ? nullptr : &m_values[m_bump++];
+        }
+
+        void deallocate(pointer ptr) noexcept { m_free.push_back(ptr); }
+
+    private:
+        std::vector<T> m_values;
+
+        uint32_t m_bump;
+
+        std::vector<pointer> m_free;
+    };
+
+    //--------------------------------------------------------------//
+
+    // NoNodeRBTree with values from Pool, single thread only
+    template<class Pool>
+    class PooledNoNodeMap {
+        using pointer = typename Pool::pointer;
+
+    public:
+        explicit PooledNoNodeMap(uint32_t capacity)
+          : m_pool(capacity)
+        { }
+
+        void emplace(key_t key, value_t value) noexcept {
+            const pointer node = m_pool.allocate();
+            node->m_key = key;
+            node->m_value = value;
+            if (!m_tree.insert(node).second)
+                m_pool.deallocate(node);
+        }
+
+        void erase(key_t key) noexcept {
+            const auto it = m_tree.find(key);
+            if (m_tree.end() == it)
+                return;
+
+            const pointer node = it.operator->();
+            m_tree.erase(it);
+            m_pool.deallocate(node);
+        }
+
+    private:
+        Pool m_pool;
+
+        RBTree::NoNodeRBTree<key_t, pointer> m_tree;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    template<class T, typename... Args>
+    Duration BenchMap(const std::vector<TestCommand>& commands, std::vector<value_t>& values, uint32_t nthreads,
+                      Args&&... args) noexcept
+    {
+        T map(std::forward<Args>(args)...);
         const uint32_t cmd_per_thread = commands.size() / nthreads;
 
         Timestamp start = Timestamp::Now();
@@ -95,6 +218,199 @@ namespace Test
         return Timestamp::Now() - start;
     }
 
+    //--------------------------------------------------------------//
+
+    template<class Fn>
+    Duration BenchThreads(uint32_t nthreads, Fn fn) noexcept
+    {
+        Timestamp start = Timestamp::Now();
+
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nthreads; ++i)
+            treads.emplace_back(fn, i);
+
+        for (auto& tread : treads)
+            tread.join();
+
+        return Timestamp::Now() - start;
+    }
+
+    //--------------------------------------------------------------//
+
+    static std::atomic<size_t> s_lookup_sink(0);
+
+    template<class T>
+    Duration BenchLookupMap(const std::vector<TestCommand>& commands, std::vector<value_t>& values,
+                            uint32_t nthreads, uint32_t nlookups) noexcept
+    {
+        T map;
+        const uint32_t size = commands.size();
+        const uint32_t cmd_per_thread = size / nthreads;
+
+        // half of the keys are present, so lookups both hit and miss
+        for (uint32_t i = 0; i < size; i += 2)
+        {
+            map.emplace(commands[i].m_key, values[commands[i].m_key]);
+        }
+
+        Timestamp start = Timestamp::Now();
+
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nthreads; ++i)
+        {
+            treads.emplace_back(
+                [&map, &values, &commands, nlookups](uint32_t first, uint32_t size) -> void
+                {
+                    const uint32_t total = commands.size();
+                    uint32_t lookup = first;
+                    size_t found = 0;
+
+                    for (uint32_t i = first; i < first + size; ++i)
+                    {
+                        const TestCommand& cmd = commands[i];
+                        if (cmd.m_is_add)
+                            map.emplace(cmd.m_key, values[cmd.m_key]);
+                        else
+                            map.erase(cmd.m_key);
+
+                        for (uint32_t j = 0; j < nlookups; ++j)
+                        {
+                            lookup = (total == lookup + 1) ? 0 : lookup + 1;
+                            const key_t key = commands[lookup].m_key;
+
+                            if (j & 1)
+                                found += (map.end() != map.lower_bound(key));
+                            else
+                                found += map.count(key);
+                        }
+                    }
+
+                    s_lookup_sink.fetch_add(found, std::memory_order_relaxed);
+                },
+                i * cmd_per_thread, cmd_per_thread);
+        }
+
+        for (uint32_t i = 0; i < nthreads; ++i)
+        {
+            treads.front().join();
+            treads.pop_front();
+        }
+
+        return Timestamp::Now() - start;
+    }
+
+    //--------------------------------------------------------------//
+
+    // nreaders do nlookups each, one writer churns odd keys meanwhile
+    template<class T>
+    Duration BenchReadScaling(std::vector<value_t>& values, uint32_t nreaders, uint32_t nlookups) noexcept
+    {
+        T map;
+        const uint32_t size = values.size();
+        for (uint32_t key = 0; key < size; key += 2)
+            map.emplace(key, values[key]);
+
+        std::atomic<bool> is_done(false);
+        std::thread writer([&map, &values, &is_done, size]() -> void
+        {
+            for (uint32_t key = 1; !is_done.load(std::memory_order_relaxed); key = (key + 2) % size)
+            {
+                map.emplace(key, values[key]);
+                map.erase(key);
+
+                // read-mostly
+                std::this_thread::yield();
+            }
+        });
+
+        Timestamp start = Timestamp::Now();
+
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nreaders; ++i)
+        {
+            treads.emplace_back(
+                [&map, size, nlookups](uint32_t seed) -> void
+                {
+                    size_t found = 0;
+                    uint32_t key = seed;
+                    for (uint32_t i = 0; i < nlookups; ++i)
+                    {
+                        key = (key * 1103515245 + 12345) % size;
+                        found += map.count(key);
+                    }
+
+                    s_lookup_sink.fetch_add(found, std::memory_order_relaxed);
+                },
+                i);
+        }
+
+        for (uint32_t i = 0; i < nreaders; ++i)
+        {
+            treads.front().join();
+            treads.pop_front();
+        }
+
+        const Duration result = Timestamp::Now() - start;
+
+        is_done = true;
+        writer.join();
+
+        return result;
+    }
+
+    //--------------------------------------------------------------//
+
+    // one writer erases (and inserts back) odd keys nerases times while nreaders look up random keys
+    // returns sorted latencies of the erases in nanoseconds
+    template<class T>
+    std::vector<uint64_t> BenchEraseLatency(std::vector<value_t>& values, uint32_t nreaders, uint32_t nerases) noexcept
+    {
+        T map;
+        const uint32_t size = values.size();
+        for (uint32_t key = 0; key < size; ++key)
+            map.emplace(key, values[key]);
+
+        std::atomic<bool> is_done(false);
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nreaders; ++i)
+        {
+            treads.emplace_back(
+                [&map, &is_done, size](uint32_t seed) -> void
+                {
+                    size_t found = 0;
+                    uint32_t key = seed;
+                    while (!is_done.load(std::memory_order_relaxed))
+                    {
+                        key = (key * 1103515245 + 12345) % size;
+                        found += map.count(key);
+                    }
+
+                    s_lookup_sink.fetch_add(found, std::memory_order_relaxed);
+                },
+                i);
+        }
+
+        std::vector<uint64_t> latencies(nerases);
+        for (uint32_t i = 0; i < nerases; ++i)
+        {
+            const uint32_t key = (2 * i + 1) % size;
+
+            const auto start = std::chrono::steady_clock::now();
+            map.erase(key);
+            const auto finish = std::chrono::steady_clock::now();
+            latencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(finish - start).count();
+
+            map.emplace(key, values[key]);
+        }
+
+        is_done = true;
+        for (auto& tread : treads)
+            tread.join();
+
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    }
+
     //////////////////////////////////////////////////////////////////
 
     class BenchBox
@@ -111,6 +427,78 @@ namespace Test
 
         bool run(TestGeneratorBucketed generator, uint32_t sample_size, uint32_t nthreads, uint32_t niterations);
 
+        // nlookups - lookups (find/lower_bound) per one write
+        bool run_lookup(TestGeneratorBucketed generator, uint32_t sample_size,
+                        uint32_t nthreads, uint32_t niterations, uint32_t nlookups);
+
+        // 1..max_threads threads: sharded trees vs one locked tree
+        bool run_sharded(TestGeneratorBucketed generator, uint32_t sample_size,
+                         uint32_t max_threads, uint32_t niterations);
+
+        // 1..max_readers readers against one writer: SeqLock vs shared locks
+        bool run_read_scaling(uint32_t sample_size, uint32_t max_readers, uint32_t nlookups);
+
+        // tree from sorted keys: build_from_sorted vs insert one by one
+        bool run_build(uint32_t sample_size, uint32_t niterations);
+
+        // emplace_hint with previous result as the hint vs emplace vs std::map::emplace_hint
+        bool run_hint(TestGeneratorBucketed generator, uint32_t sample_size, uint32_t nbuckets, uint32_t niterations);
+
+        // timer queue: pop the earliest timer, schedule it again later
+        // pop_front vs erase by begin() key vs std::map
+        bool run_timer_queue(uint32_t ntimers, uint32_t npops);
+
+        // every thread inserts then erases its keys by sorted batches: insert_batch/erase_batch
+        // vs emplace/erase one by one vs std::map locked once per batch
+        bool run_batch(uint32_t sample_size, uint32_t batch_size, uint32_t nthreads, uint32_t niterations);
+
+        // intervals of [1, max_length] with random starts, nqueries stabbing queries:
+        // find_overlapping vs std::map by start scanned from (low - max_length)
+        bool run_intervals(uint32_t sample_size, uint32_t max_length, uint32_t nqueries);
+
+        // sum of weights over random key ranges: sum_range vs std::map scan
+        bool run_range_sum(uint32_t sample_size, uint32_t max_range, uint32_t nqueries);
+
+        // full forward and backward scans over string keys with a common prefix vs std::map
+        bool run_scan(uint32_t sample_size, uint32_t niterations);
+
+        // whole tree scans, nodes scattered in memory: for_each vs iterator
+        bool run_for_each(uint32_t sample_size, uint32_t niterations);
+
+        // random lookups by batches, nodes scattered in memory: find_batch vs find one by one
+        bool run_find_batch(uint32_t sample_size, uint32_t batch_size, uint32_t nlookups);
+
+        // random lookups in the tree built by inserts in random order, before and after compact()
+        bool run_compact(uint32_t sample_size, uint32_t nlookups);
+
+        // sliding window of sample_size increasing keys, every round expires the oldest
+        // sample_size / nrounds of them: erase_range vs erase(begin()) one by one
+        bool run_expire(uint32_t sample_size, uint32_t nrounds);
+
+        // union of trees of random keys (other_size of them, about half also in the first tree):
+        // unite() vs walk of both into a third tree, as snapshots are reconciled now
+        bool run_unite(uint32_t sample_size, uint32_t other_size);
+
+        // parallel build_from_sorted/for_each/reduce/clear for 1-16 threads, speedup against 1
+        bool run_parallel(uint32_t sample_size);
+
+        // erase latency percentiles with nreaders looking up meanwhile: SeqLock with epoch reclamation
+        // of erased nodes vs shared locks, which destroy them right after the unlock
+        bool run_erase_latency(uint32_t sample_size, uint32_t nreaders, uint32_t nerases);
+
+        // nthreads readers of random keys: frozen snapshot without locks vs live tree under std::mutex
+        bool run_freeze(uint32_t sample_size, uint32_t nthreads, uint32_t nlookups);
+
+        // startup: tree ready for nlookups random lookups,
+        // rebuild by inserts / build_from_sorted vs mapped image with cold page cache
+        bool run_image(uint32_t sample_size, uint32_t nlookups);
+
+    private:
+
+        static void report(Duration gen_time, Duration map_time, Duration origin_time, uint32_t sample_size);
+
+        static void report_line(const char* name, Duration time, Duration origin_time, uint32_t sample_size);
+
     };
 
     //--------------------------------------------------------------//
@@ -124,6 +512,13 @@ namespace Test
         Duration gen_time;
         Duration map_time;
         Duration origin_time;
+        Duration pool_time;
+        Duration ptr_links_time;
+        Duration index_links_time;
+        Duration btree_time;
+        Duration concurrent_time;
+        Duration combining_time;
+        Duration unsorted_combining_time;
         Duration unordered_time;
         for (uint32_t i = 0; i < niterations; ++i) {
 
@@ -147,6 +542,32 @@ namespace Test
                 BenchMap<std::map<key_t, value_t>>(sample, values, nthreads) :
                 BenchMap<TMTSTDMap<key_t, value_t>>(sample, values, nthreads);
 
+            using pool_t = RBTree::PoolAllocator<std::pair<const key_t, value_t>>;
+            pool_time += (1 == nthreads) ?
+                BenchMap<testedmap_t<key_t, value_t, RBTree::FakeLock, pool_t>>(sample, values, nthreads) :
+                BenchMap<testedmap_t<key_t, value_t, std::mutex, pool_t>>(sample, values, nthreads);
+
+            btree_time += (1 == nthreads) ?
+                BenchMap<RBTree::BTree<key_t, value_t>>(sample, values, nthreads) :
+                BenchMap<RBTree::BTree<key_t, value_t, std::mutex>>(sample, values, nthreads);
+
+            concurrent_time += BenchMap<RBTree::ConcurrentRBTree<key_t, value_t>>(sample, values, nthreads);
+
+            if (1 == nthreads)
+            {
+                ptr_links_time += BenchMap<PooledNoNodeMap<PtrPool<PtrLinkedValue>>>(
+                    sample, values, nthreads, sample_size);
+                index_links_time += BenchMap<PooledNoNodeMap<RBTree::IndexPool<IndexLinkedValue>>>(
+                    sample, values, nthreads, sample_size);
+            }
+            else
+            {
+                combining_time += BenchMap<testedmap_t<key_t, value_t, RBTree::FlatCombiningLock<>>>(
+                    sample, values, nthreads);
+                unsorted_combining_time += BenchMap<testedmap_t<key_t, value_t, RBTree::FlatCombiningLock<false>>>(
+                    sample, values, nthreads);
+            }
+
 #if CHECK_UNO
             unordered_time += (1 == nthreads) ?
                 BenchMap<std::unordered_map<key_t, value_t>>(sample, values, nthreads) :
@@ -156,25 +577,24 @@ namespace Test
 
         KillValues(values);
 
-        std::cout << std::fixed << std::setprecision(2) << std::setw(6);
-        const auto width = std::setw(9);
-
-        std::cout << "Gen time:      " << width
-                  << static_cast<double>(gen_time.Milliseconds())
-                  << std::endl;
-
-        const double map_speed = (double)sample_size / map_time.Milliseconds();
-        const double origin_speed = (double)sample_size / origin_time.Milliseconds();
-        const double origin_diff = ((map_speed / origin_speed) - 1) * 100;
-
-        std::cout << "NoNode time:   " << width
-                  << static_cast<double>(map_time.Milliseconds()) << std::endl;
-        std::cout << "std::map time: " << width
-                  << static_cast<double>(origin_time.Milliseconds())
-                  << " rel imp: " << (origin_diff > 0 ? '+' : ' ')
-                  << std::setprecision(2) << origin_diff << "%" << std::endl;
+        report(gen_time, map_time, origin_time, sample_size);
+        report_line("NoNode pool:   ", pool_time, origin_time, sample_size);
+        report_line("BTree:         ", btree_time, origin_time, sample_size);
+        report_line("Concurrent:    ", concurrent_time, origin_time, sample_size);
+        if (1 == nthreads)
+        {
+            report_line("ptr links:     ", ptr_links_time, origin_time, sample_size);
+            report_line("index links:   ", index_links_time, origin_time, sample_size);
+        }
+        else
+        {
+            report_line("Combining:     ", combining_time, origin_time, sample_size);
+            report_line("Comb. unsorted:", unsorted_combining_time, origin_time, sample_size);
+        }
 
 #if CHECK_UNO
+        const auto width = std::setw(9);
+        const double map_speed = (double)sample_size / map_time.Milliseconds();
         const double unordered_speed = (double)sample_size / unordered_time.Milliseconds();
         const double unordered_diff = ((map_speed / unordered_speed) - 1) * 100;
 
@@ -189,32 +609,1176 @@ namespace Test
 
     //--------------------------------------------------------------//
 
-    //////////////////////////////////////////////////////////////////
-
-    TEST(TreeTest, bench_add_small)
+    bool BenchBox::run_lookup(TestGeneratorBucketed generator, uint32_t sample_size,
+        uint32_t nthreads, uint32_t niterations, uint32_t nlookups)
     {
-        constexpr uint32_t sample_size = 64;
-        constexpr uint32_t nthreads = 1;
-        constexpr uint32_t niterations = 25000;
+        std::vector<value_t> values = GenValues<std::remove_pointer<value_t>::type>(sample_size);
+        std::vector<TestCommand> sample(sample_size, {0, false});
 
-        BenchBox tb;
-        tb.run(AddTestGeneratorBucketed, sample_size, nthreads, niterations);
-    }
+        Duration gen_time;
+        Duration map_time;
+        Duration origin_time;
+        Duration shared_mutex_time;
+        Duration spin_rw_time;
+        Duration btree_time;
+        for (uint32_t i = 0; i < niterations; ++i) {
 
-    TEST(TreeTest, bench_add_medium)
-    {
-        constexpr uint32_t sample_size = 1024;
-        constexpr uint32_t nthreads = 1;
-        constexpr uint32_t niterations = 10000;
+            {
+                Timestamp start = Timestamp::Now();
+                generator(sample, sample_size, 1);
+                gen_time += (Timestamp::Now() - start);
+            }
 
-        BenchBox tb;
-        tb.run(AddTestGeneratorBucketed, sample_size, nthreads, niterations);
-    }
+            if (1 != nthreads)
+            {
+                shared_mutex_time += BenchLookupMap<testedmap_t<key_t, value_t, std::shared_mutex>>(
+                    sample, values, nthreads, nlookups);
+                spin_rw_time += BenchLookupMap<testedmap_t<key_t, value_t, RBTree::SpinRWLock>>(
+                    sample, values, nthreads, nlookups);
+            }
 
-    TEST(TreeTest, bench_add_big)
-    {
-        constexpr uint32_t sample_size = 100000;
-        constexpr uint32_t nthreads = 1;
+            // warm up
+            if (1 == nthreads)
+                BenchLookupMap<std::map<key_t, value_t>>(sample, values, nthreads, nlookups);
+            else
+                BenchLookupMap<TMTSTDMap<key_t, value_t>>(sample, values, nthreads, nlookups);
+
+            map_time += (1 == nthreads) ?
+                BenchLookupMap<testedmap_t<key_t, value_t>>(sample, values, nthreads, nlookups) :
+                BenchLookupMap<testedmap_t<key_t, value_t, std::mutex>>(sample, values, nthreads, nlookups);
+
+            origin_time += (1 == nthreads) ?
+                BenchLookupMap<std::map<key_t, value_t>>(sample, values, nthreads, nlookups) :
+                BenchLookupMap<TMTSTDMap<key_t, value_t>>(sample, values, nthreads, nlookups);
+
+            btree_time += (1 == nthreads) ?
+                BenchLookupMap<RBTree::BTree<key_t, value_t>>(sample, values, nthreads, nlookups) :
+                BenchLookupMap<RBTree::BTree<key_t, value_t, std::mutex>>(sample, values, nthreads, nlookups);
+        }
+
+        KillValues(values);
+
+        std::cout << "Lookups per write: " << nlookups << std::endl;
+        report(gen_time, map_time, origin_time, sample_size);
+        report_line("BTree:         ", btree_time, origin_time, sample_size);
+
+        if (1 != nthreads)
+        {
+            report_line("NoNode shmtx:  ", shared_mutex_time, origin_time, sample_size);
+            report_line("NoNode spinrw: ", spin_rw_time, origin_time, sample_size);
+        }
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_sharded(TestGeneratorBucketed generator, uint32_t sample_size,
+        uint32_t max_threads, uint32_t niterations)
+    {
+        constexpr size_t nshards = 16;
+        using hashed_t = RBTree::ShardedRBTree<key_t, value_t, std::mutex, nshards>;
+        using ranged_t = RBTree::ShardedRBTree<key_t, value_t, std::mutex, nshards, RBTree::RangePartition<key_t>>;
+
+        const auto partition = RBTree::RangePartition<key_t>::uniform(0, sample_size, nshards);
+
+        std::vector<value_t> values = GenValues<std::remove_pointer<value_t>::type>(sample_size);
+        std::vector<TestCommand> sample(sample_size, {0, false});
+
+        const auto width = std::setw(10);
+
+        std::cout << "threads    hashed    ranged   coupled    single  std::map" << std::endl;
+        for (uint32_t nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+        {
+            Duration hashed_time;
+            Duration ranged_time;
+            Duration coupled_time;
+            Duration single_time;
+            Duration origin_time;
+            for (uint32_t i = 0; i < niterations; ++i)
+            {
+                generator(sample, sample_size, 1);
+
+                hashed_time += BenchMap<hashed_t>(sample, values, nthreads);
+                ranged_time += BenchMap<ranged_t>(sample, values, nthreads, partition);
+                coupled_time += BenchMap<RBTree::ConcurrentRBTree<key_t, value_t>>(sample, values, nthreads);
+                single_time += BenchMap<testedmap_t<key_t, value_t, std::mutex>>(sample, values, nthreads);
+                origin_time += BenchMap<TMTSTDMap<key_t, value_t>>(sample, values, nthreads);
+            }
+
+            std::cout << std::setw(7) << nthreads
+                      << width << hashed_time.Milliseconds()
+                      << width << ranged_time.Milliseconds()
+                      << width << coupled_time.Milliseconds()
+                      << width << single_time.Milliseconds()
+                      << width << origin_time.Milliseconds() << std::endl;
+        }
+
+        KillValues(values);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_read_scaling(uint32_t sample_size, uint32_t max_readers, uint32_t nlookups)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer<value_t>::type>(sample_size);
+
+        const auto width = std::setw(10);
+
+        std::cout << "readers   seqlock   coupled    spinrw     shmtx" << std::endl;
+        for (uint32_t nreaders = 1; nreaders <= max_readers; nreaders *= 2)
+        {
+            Duration seq_time =
+                BenchReadScaling<testedmap_t<key_t, value_t, RBTree::SeqLock>>(values, nreaders, nlookups);
+            Duration coupled_time =
+                BenchReadScaling<RBTree::ConcurrentRBTree<key_t, value_t>>(values, nreaders, nlookups);
+            Duration spin_rw_time =
+                BenchReadScaling<testedmap_t<key_t, value_t, RBTree::SpinRWLock>>(values, nreaders, nlookups);
+            Duration shared_mutex_time =
+                BenchReadScaling<testedmap_t<key_t, value_t, std::shared_mutex>>(values, nreaders, nlookups);
+
+            std::cout << std::setw(7) << nreaders
+                      << width << seq_time.Milliseconds()
+                      << width << coupled_time.Milliseconds()
+                      << width << spin_rw_time.Milliseconds()
+                      << width << shared_mutex_time.Milliseconds() << std::endl;
+        }
+
+        KillValues(values);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_build(uint32_t sample_size, uint32_t niterations)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer<value_t>::type>(sample_size);
+
+        std::vector<std::pair<key_t, value_t>> sorted;
+        sorted.reserve(sample_size);
+        for (key_t key = 0; key < sample_size; ++key)
+            sorted.emplace_back(key, values[key]);
+
+        Duration build_time;
+        Duration insert_time;
+        Duration origin_time;
+        for (uint32_t i = 0; i < niterations; ++i)
+        {
+            {
+                testedmap_t<key_t, value_t> map;
+                Timestamp start = Timestamp::Now();
+                map.build_from_sorted(sorted.begin(), sorted.end());
+                build_time += (Timestamp::Now() - start);
+            }
+
+            {
+                testedmap_t<key_t, value_t> map;
+                Timestamp start = Timestamp::Now();
+                for (const auto& pair : sorted)
+                    map.insert(pair.first, pair.second);
+                insert_time += (Timestamp::Now() - start);
+            }
+
+            {
+                Timestamp start = Timestamp::Now();
+                std::map<key_t, value_t> map(sorted.begin(), sorted.end());
+                origin_time += (Timestamp::Now() - start);
+            }
+        }
+
+        KillValues(values);
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("NoNode build:  ", build_time, origin_time, sample_size);
+        report_line("NoNode insert: ", insert_time, origin_time, sample_size);
+        report_line("std::map range:", origin_time, origin_time, sample_size);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_hint(TestGeneratorBucketed generator, uint32_t sample_size, uint32_t nbuckets, uint32_t niterations)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer<value_t>::type>(sample_size);
+        std::vector<TestCommand> sample(sample_size, {0, false});
+
+        Duration hint_time;
+        Duration map_time;
+        Duration origin_time;
+        for (uint32_t i = 0; i < niterations; ++i)
+        {
+            generator(sample, sample_size, nbuckets);
+
+            {
+                testedmap_t<key_t, value_t> map;
+                Timestamp start = Timestamp::Now();
+                auto hint = map.end();
+                for (const TestCommand& cmd : sample)
+                    hint = map.emplace_hint(hint, cmd.m_key, values[cmd.m_key]);
+                hint_time += (Timestamp::Now() - start);
+            }
+
+            {
+                testedmap_t<key_t, value_t> map;
+                Timestamp start = Timestamp::Now();
+                for (const TestCommand& cmd : sample)
+                    map.emplace(cmd.m_key, values[cmd.m_key]);
+                map_time += (Timestamp::Now() - start);
+            }
+
+            {
+                std::map<key_t, value_t> map;
+                Timestamp start = Timestamp::Now();
+                auto hint = map.end();
+                for (const TestCommand& cmd : sample)
+                    hint = map.emplace_hint(hint, cmd.m_key, values[cmd.m_key]);
+                origin_time += (Timestamp::Now() - start);
+            }
+        }
+
+        KillValues(values);
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("NoNode hint:   ", hint_time, origin_time, sample_size);
+        report_line("NoNode time:   ", map_time, origin_time, sample_size);
+        report_line("std::map hint: ", origin_time, origin_time, sample_size);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_timer_queue(uint32_t ntimers, uint32_t npops)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer<value_t>::type>(ntimers);
+
+        // sparse deadlines, few collisions
+        Rand rand;
+        std::vector<key_t> delays(npops);
+        for (key_t& delay : delays)
+            delay = 1 + rand.get() % (64 * ntimers);
+
+        Duration pop_time;
+        Duration erase_time;
+        Duration origin_time;
+        {
+            testedmap_t<key_t, value_t> map;
+            for (key_t key = 0; key < ntimers; ++key)
+                map.emplace(key, values[key]);
+
+            Timestamp start = Timestamp::Now();
+            for (const key_t delay : delays)
+            {
+                const auto timer = map.pop_front();
+                key_t key = timer->first + delay;
+                while (!map.emplace(key, timer->second).second)
+                    ++key;
+            }
+            pop_time += (Timestamp::Now() - start);
+        }
+
+        {
+            testedmap_t<key_t, value_t> map;
+            for (key_t key = 0; key < ntimers; ++key)
+                map.emplace(key, values[key]);
+
+            Timestamp start = Timestamp::Now();
+            for (const key_t delay : delays)
+            {
+                const std::pair<key_t, value_t> timer = *map.begin();
+                map.erase(timer.first);
+                key_t key = timer.first + delay;
+                while (!map.emplace(key, timer.second).second)
+                    ++key;
+            }
+            erase_time += (Timestamp::Now() - start);
+        }
+
+        {
+            std::map<key_t, value_t> map;
+            for (key_t key = 0; key < ntimers; ++key)
+                map.emplace(key, values[key]);
+
+            Timestamp start = Timestamp::Now();
+            for (const key_t delay : delays)
+            {
+                const std::pair<key_t, value_t> timer = *map.begin();
+                map.erase(map.begin());
+                key_t key = timer.first + delay;
+                while (!map.emplace(key, timer.second).second)
+                    ++key;
+            }
+            origin_time += (Timestamp::Now() - start);
+        }
+
+        KillValues(values);
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("NoNode pop:    ", pop_time, origin_time, npops);
+        report_line("NoNode erase:  ", erase_time, origin_time, npops);
+        report_line("std::map time: ", origin_time, origin_time, npops);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    struct BenchInterval
+    {
+        BenchInterval* m_left;
+
+        BenchInterval* m_right;
+
+        BenchInterval* m_parent;
+
+        key_t m_key;
+
+        key_t m_high;
+
+        key_t m_max;
+    };
+
+    struct BenchPlain
+    {
+        BenchPlain* m_left;
+
+        BenchPlain* m_right;
+
+        BenchPlain* m_parent;
+
+        key_t m_key;
+    };
+
+    struct BenchWeighted
+    {
+        BenchWeighted* m_left;
+
+        BenchWeighted* m_right;
+
+        BenchWeighted* m_parent;
+
+        key_t m_key;
+
+        uint64_t m_weight;
+
+        uint64_t m_sum;
+    };
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_intervals(uint32_t sample_size, uint32_t max_length, uint32_t nqueries)
+    {
+        Rand rand;
+        const key_t range = 16 * sample_size;
+
+        std::vector<BenchInterval> intervals(sample_size);
+        std::map<key_t, key_t> origin;
+        for (BenchInterval& interval : intervals)
+        {
+            do
+                interval.m_key = rand.get() % range;
+            while (!origin.emplace(interval.m_key, 0).second);
+
+            interval.m_high = interval.m_key + rand.get() % max_length;
+            origin[interval.m_key] = interval.m_high;
+        }
+
+        RBTree::NoNodeRBTree<key_t, BenchInterval*, RBTree::IntervalAugment> tree;
+        for (BenchInterval& interval : intervals)
+            tree.insert(&interval);
+
+        std::vector<key_t> queries(nqueries);
+        for (key_t& query : queries)
+            query = rand.get() % range;
+
+        size_t found = 0;
+        size_t origin_found = 0;
+
+        Timestamp start = Timestamp::Now();
+        for (const key_t query : queries)
+            RBTree::find_overlapping(tree, query, query, [&found](BenchInterval*) { ++found; });
+        Duration time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        for (const key_t query : queries)
+        {
+            const key_t low = (query < max_length) ? 0 : query - max_length;
+            for (auto it = origin.lower_bound(low); origin.end() != it && it->first <= query; ++it)
+            {
+                if (query <= it->second)
+                    ++origin_found;
+            }
+        }
+        Duration origin_time = Timestamp::Now() - start;
+
+        if (found != origin_found)
+            return false;
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("NoNode overlap:", time, origin_time, nqueries);
+        report_line("std::map time: ", origin_time, origin_time, nqueries);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_range_sum(uint32_t sample_size, uint32_t max_range, uint32_t nqueries)
+    {
+        Rand rand;
+
+        std::vector<BenchWeighted> values(sample_size);
+        std::map<key_t, uint64_t> origin;
+        for (key_t key = 0; key < sample_size; ++key)
+        {
+            values[key].m_key = key;
+            values[key].m_weight = rand.get() % 1000;
+            origin.emplace(key, values[key].m_weight);
+        }
+
+        RBTree::NoNodeRBTree<key_t, BenchWeighted*, RBTree::SumAugment> tree;
+        for (BenchWeighted& value : values)
+            tree.insert(&value);
+
+        std::vector<std::pair<key_t, key_t>> queries(nqueries);
+        for (auto& query : queries)
+        {
+            query.first = rand.get() % sample_size;
+            query.second = query.first + rand.get() % max_range;
+        }
+
+        uint64_t sum = 0;
+        uint64_t origin_sum = 0;
+
+        Timestamp start = Timestamp::Now();
+        for (const auto& query : queries)
+            sum += RBTree::sum_range(tree, query.first, query.second);
+        Duration time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        for (const auto& query : queries)
+        {
+            const auto last = origin.lower_bound(query.second);
+            for (auto it = origin.lower_bound(query.first); last != it; ++it)
+                origin_sum += it->second;
+        }
+        Duration origin_time = Timestamp::Now() - start;
+
+        if (sum != origin_sum)
+            return false;
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("NoNode sum:    ", time, origin_time, nqueries);
+        report_line("std::map time: ", origin_time, origin_time, nqueries);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_scan(uint32_t sample_size, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<std::pair<std::string, uint32_t>> sample;
+        sample.reserve(sample_size);
+        for (uint32_t i = 0; i < sample_size; ++i)
+            sample.emplace_back("/storage/bucket/object-" + std::to_string(rand.get()), i);
+
+        testedmap_t<std::string, uint32_t> map;
+        std::map<std::string, uint32_t> origin;
+        for (const auto& pair : sample)
+        {
+            map.insert(pair);
+            origin.insert(pair);
+        }
+
+        uint64_t sum = 0;
+        uint64_t origin_sum = 0;
+
+        Timestamp start = Timestamp::Now();
+        for (uint32_t i = 0; i < niterations; ++i)
+        {
+            for (auto it = map.begin(); map.end() != it; ++it)
+                sum += it.value();
+        }
+        Duration time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        for (uint32_t i = 0; i < niterations; ++i)
+        {
+            for (auto it = map.rbegin(); map.rend() != it; ++it)
+                sum += it.value();
+        }
+        Duration reverse_time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        for (uint32_t i = 0; i < niterations; ++i)
+        {
+            for (auto it = origin.begin(); origin.end() != it; ++it)
+                origin_sum += it->second;
+        }
+        Duration origin_time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        for (uint32_t i = 0; i < niterations; ++i)
+        {
+            for (auto it = origin.rbegin(); origin.rend() != it; ++it)
+                origin_sum += it->second;
+        }
+        Duration origin_reverse_time = Timestamp::Now() - start;
+
+        if (sum != origin_sum)
+            return false;
+
+        const uint32_t nsteps = sample_size * niterations;
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("NoNode scan:   ", time, origin_time, nsteps);
+        report_line("std::map time: ", origin_time, origin_time, nsteps);
+        report_line("NoNode rscan:  ", reverse_time, origin_reverse_time, nsteps);
+        report_line("std::map time: ", origin_reverse_time, origin_reverse_time, nsteps);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    // keys [0, sample_size), neighbours by key are far from each other in memory
+    static void BuildScattered(RBTree::NoNodeRBTree<key_t, BenchPlain*>& tree, std::vector<BenchPlain>& values)
+    {
+        Rand rand;
+        const uint32_t sample_size = (uint32_t)values.size();
+        std::vector<key_t> keys(sample_size);
+        for (key_t key = 0; key < sample_size; ++key)
+            keys[key] = key;
+        for (key_t i = sample_size - 1; 0 < i; --i)
+            std::swap(keys[i], keys[rand.get() % (i + 1)]);
+
+        std::vector<BenchPlain*> sorted(sample_size);
+        for (uint32_t i = 0; i < sample_size; ++i)
+        {
+            values[i].m_key = keys[i];
+            sorted[keys[i]] = &values[i];
+        }
+
+        tree.build_from_sorted(sorted.begin(), sorted.end());
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_for_each(uint32_t sample_size, uint32_t niterations)
+    {
+        std::vector<BenchPlain> values(sample_size);
+        RBTree::NoNodeRBTree<key_t, BenchPlain*> tree;
+        BuildScattered(tree, values);
+
+        uint64_t sum = 0;
+        uint64_t origin_sum = 0;
+
+        Timestamp start = Timestamp::Now();
+        for (uint32_t i = 0; i < niterations; ++i)
+            tree.for_each([&sum](const BenchPlain* value) { sum += value->m_key; });
+        Duration time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        for (uint32_t i = 0; i < niterations; ++i)
+        {
+            for (auto it = tree.begin(); tree.end() != it; ++it)
+                origin_sum += it->m_key;
+        }
+        Duration origin_time = Timestamp::Now() - start;
+
+        if (sum != origin_sum)
+            return false;
+
+        const uint32_t nsteps = sample_size * niterations;
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("for_each:      ", time, origin_time, nsteps);
+        report_line("iterator time: ", origin_time, origin_time, nsteps);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_find_batch(uint32_t sample_size, uint32_t batch_size, uint32_t nlookups)
+    {
+        std::vector<BenchPlain> values(sample_size);
+        RBTree::NoNodeRBTree<key_t, BenchPlain*> tree;
+        BuildScattered(tree, values);
+
+        Rand rand;
+        std::vector<key_t> keys(nlookups);
+        for (key_t& key : keys)
+            key = rand.get() % sample_size;
+
+        uint64_t sum = 0;
+        uint64_t origin_sum = 0;
+
+        std::vector<BenchPlain*> found(batch_size);
+        Timestamp start = Timestamp::Now();
+        for (uint32_t i = 0; i < nlookups; i += batch_size)
+        {
+            const uint32_t size = std::min(batch_size, nlookups - i);
+            tree.find_batch(keys.begin() + i, keys.begin() + i + size, found.begin());
+            for (uint32_t j = 0; j < size; ++j)
+                sum += found[j]->m_key;
+        }
+        Duration time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        for (const key_t key : keys)
+            origin_sum += tree.find(key)->m_key;
+        Duration origin_time = Timestamp::Now() - start;
+
+        if (sum != origin_sum)
+            return false;
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("find_batch:    ", time, origin_time, nlookups);
+        report_line("find time:     ", origin_time, origin_time, nlookups);
+        std::cout << "lookups/s: batch " << nlookups * 1000ull / (time.Milliseconds() + 1)
+                  << " serial " << nlookups * 1000ull / (origin_time.Milliseconds() + 1) << std::endl;
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_compact(uint32_t sample_size, uint32_t nlookups)
+    {
+        Rand rand;
+        testedmap_t<key_t, value_t> tested;
+        for (uint32_t i = 0; i < sample_size; ++i)
+            tested.emplace(rand.get() % sample_size, nullptr);
+
+        std::vector<key_t> keys(nlookups);
+        for (key_t& key : keys)
+            key = rand.get() % sample_size;
+
+        uint64_t found = 0;
+        uint64_t origin_found = 0;
+
+        Timestamp start = Timestamp::Now();
+        for (const key_t key : keys)
+            origin_found += tested.count(key);
+        Duration origin_time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        tested.compact();
+        Duration compact_time = Timestamp::Now() - start;
+
+        start = Timestamp::Now();
+        for (const key_t key : keys)
+            found += tested.count(key);
+        Duration time = Timestamp::Now() - start;
+
+        if (found != origin_found)
+            return false;
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("compacted:     ", time, origin_time, nlookups);
+        report_line("scattered:     ", origin_time, origin_time, nlookups);
+        std::cout << "compact time: " << compact_time.Milliseconds() << " ms for " << tested.size() << " nodes" << std::endl;
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_expire(uint32_t sample_size, uint32_t nrounds)
+    {
+        // trees one after another: nodes of both in the same cache lines would favor the second
+        auto measure = [sample_size, nrounds](auto expire)
+        {
+            const key_t step = sample_size / nrounds;
+            testedmap_t<key_t, value_t> tested;
+            for (key_t key = 0; key < sample_size; ++key)
+                tested.emplace(key, nullptr);
+
+            Duration time;
+            size_t erased = 0;
+            for (key_t round = 0; round < nrounds; ++round)
+            {
+                const key_t cutoff = (round + 1) * step;
+
+                Timestamp start = Timestamp::Now();
+                erased += expire(tested, cutoff);
+                time += Timestamp::Now() - start;
+
+                for (key_t key = sample_size + round * step; key < sample_size + cutoff; ++key)
+                    tested.emplace(key, nullptr);
+            }
+
+            return std::make_pair(time, erased);
+        };
+
+        const auto [time, erased] = measure([](auto& tested, key_t cutoff)
+        {
+            return tested.erase_range(0, cutoff);
+        });
+
+        const auto [origin_time, origin_erased] = measure([](auto& tested, key_t cutoff)
+        {
+            size_t count = 0;
+            for (auto it = tested.begin(); tested.end() != it && it.key() < cutoff; ++count)
+                it = tested.erase(it);
+
+            return count;
+        });
+
+        if (erased != origin_erased)
+            return false;
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("erase_range:   ", time, origin_time, (uint32_t)erased);
+        report_line("one by one:    ", origin_time, origin_time, (uint32_t)erased);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_unite(uint32_t sample_size, uint32_t other_size)
+    {
+        using tree_t = testedmap_t<key_t, value_t>;
+
+        Rand rand;
+        std::vector<key_t> keys(sample_size);
+        for (key_t& key : keys)
+            key = rand.get() % (2 * sample_size);
+        std::vector<key_t> other_keys(other_size);
+        for (key_t& key : other_keys)
+            key = rand.get() % (2 * sample_size);
+
+        // the same trees for both ways, built apart from each other as for run_expire
+        auto measure = [&keys, &other_keys](auto unite)
+        {
+            tree_t tested;
+            tree_t other;
+            for (const key_t key : keys)
+                tested.emplace(key, nullptr);
+            for (const key_t key : other_keys)
+                other.emplace(key, nullptr);
+
+            const Timestamp start = Timestamp::Now();
+            const size_t size = unite(tested, other);
+            return std::make_pair(Timestamp::Now() - start, size);
+        };
+
+        const auto [time, size] = measure([](tree_t& tested, tree_t& other)
+        {
+            tested.unite(other);
+            return tested.size();
+        });
+
+        const auto [origin_time, origin_size] = measure([](tree_t& tested, tree_t& other)
+        {
+            tree_t result;
+            auto one = tested.begin();
+            auto two = other.begin();
+            while (tested.end() != one || other.end() != two)
+            {
+                const bool is_one = (other.end() == two) || (tested.end() != one && !(two.key() < one.key()));
+                auto& it = is_one ? one : two;
+                result.emplace_hint(result.end(), it.key(), it.value());
+
+                if (is_one && other.end() != two && !(one.key() < two.key()))
+                    ++two;
+                ++it;
+            }
+
+            return result.size();
+        });
+
+        if (size != origin_size)
+            return false;
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("unite:         ", time, origin_time, (uint32_t)size);
+        report_line("into third:    ", origin_time, origin_time, (uint32_t)size);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_parallel(uint32_t sample_size)
+    {
+        std::vector<std::pair<key_t, value_t>> pairs(sample_size);
+        uint64_t expected = 0;
+        for (uint32_t i = 0; i < sample_size; ++i)
+        {
+            pairs[i] = std::make_pair(2 * i, nullptr);
+            expected += 2 * i;
+        }
+
+        // visits write apart, so only the walk is measured
+        std::vector<key_t> out(sample_size);
+
+        std::cout << std::fixed << "threads     build  for_each    reduce     clear   speedup" << std::endl;
+        double origin_total = 0;
+        for (const uint32_t nthreads : {1u, 2u, 4u, 8u, 16u})
+        {
+            RBTree::ThreadPool pool(nthreads);
+            testedmap_t<key_t, value_t> tested;
+
+            Timestamp start = Timestamp::Now();
+            tested.build_from_sorted(pool, pairs.begin(), pairs.end());
+            Duration build_time = Timestamp::Now() - start;
+
+            start = Timestamp::Now();
+            tested.for_each(pool, [&out](key_t key, value_t) { out[key / 2] = key; });
+            Duration for_each_time = Timestamp::Now() - start;
+
+            start = Timestamp::Now();
+            const uint64_t sum = tested.reduce(pool, (uint64_t)0,
+                [](key_t key, value_t) { return (uint64_t)key; },
+                [](uint64_t one, uint64_t other) { return one + other; });
+            Duration reduce_time = Timestamp::Now() - start;
+
+            start = Timestamp::Now();
+            tested.clear(pool);
+            Duration clear_time = Timestamp::Now() - start;
+
+            if (sum != expected || out.back() != pairs.back().first)
+                return false;
+
+            const double total = static_cast<double>(build_time.Milliseconds() + for_each_time.Milliseconds() +
+                                                     reduce_time.Milliseconds() + clear_time.Milliseconds());
+            if (1 == nthreads)
+                origin_total = total;
+
+            const auto width = std::setw(10);
+            std::cout << std::setw(7) << nthreads
+                      << width << build_time.Milliseconds() << width << for_each_time.Milliseconds()
+                      << width << reduce_time.Milliseconds() << width << clear_time.Milliseconds()
+                      << width << std::setprecision(2) << origin_total / std::max(total, 1.0) << std::endl;
+        }
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_erase_latency(uint32_t sample_size, uint32_t nreaders, uint32_t nerases)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer<value_t>::type>(sample_size);
+
+        const auto report = [nerases](const char* name, const std::vector<uint64_t>& latencies)
+        {
+            const auto width = std::setw(10);
+            std::cout << name
+                      << width << latencies[nerases / 2] << width << latencies[nerases * 99 / 100]
+                      << width << latencies[nerases * 999 / 1000] << width << latencies.back() << std::endl;
+        };
+
+        std::cout << "ns               p50       p99     p99.9       max" << std::endl;
+        report("seqlock+epoch:",
+               BenchEraseLatency<testedmap_t<key_t, value_t, RBTree::SeqLock>>(values, nreaders, nerases));
+        report("spinrw:       ",
+               BenchEraseLatency<testedmap_t<key_t, value_t, RBTree::SpinRWLock>>(values, nreaders, nerases));
+        report("shmtx:        ",
+               BenchEraseLatency<testedmap_t<key_t, value_t, std::shared_mutex>>(values, nreaders, nerases));
+
+        KillValues(values);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_freeze(uint32_t sample_size, uint32_t nthreads, uint32_t nlookups)
+    {
+        Rand rand;
+        testedmap_t<key_t, value_t, std::mutex> tested;
+        for (uint32_t i = 0; i < sample_size; ++i)
+            tested.emplace(rand.get() % sample_size, nullptr);
+
+        std::vector<key_t> keys(nlookups);
+        for (key_t& key : keys)
+            key = rand.get() % sample_size;
+
+        Timestamp start = Timestamp::Now();
+        const RBTree::FrozenRBTree<key_t, value_t> frozen = tested.freeze();
+        Duration freeze_time = Timestamp::Now() - start;
+
+        // every thread looks up all keys from its own offset
+        auto measure = [&keys, nthreads](auto lookup)
+        {
+            std::atomic<uint64_t> found(0);
+            std::list<std::thread> treads;
+            Timestamp start = Timestamp::Now();
+            for (uint32_t i = 0; i < nthreads; ++i)
+            {
+                treads.emplace_back([&keys, &found, &lookup](uint32_t id)
+                {
+                    uint64_t count = 0;
+                    const size_t offset = id * keys.size() / 16;
+                    for (size_t j = 0; j < keys.size(); ++j)
+                        count += lookup(keys[(offset + j) % keys.size()]);
+                    found += count;
+                }, i);
+            }
+
+            for (auto& tread : treads)
+                tread.join();
+
+            return std::make_pair(Timestamp::Now() - start, found.load());
+        };
+
+        const auto [time, found] = measure([&frozen](key_t key) { return frozen.count(key); });
+        const auto [origin_time, origin_found] = measure([&tested](key_t key) { return tested.count(key); });
+        if (found != origin_found)
+            return false;
+
+        const uint32_t nsteps = nlookups * nthreads;
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("frozen:        ", time, origin_time, nsteps);
+        report_line("std::mutex:    ", origin_time, origin_time, nsteps);
+        std::cout << "freeze time: " << freeze_time.Milliseconds() << " ms for " << frozen.size() << " keys" << std::endl;
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_image(uint32_t sample_size, uint32_t nlookups)
+    {
+        using pointer_t = RBTree::IndexPtr<IndexLinkedValue>;
+        using image_t = RBTree::TreeImage<IndexLinkedValue>;
+
+        Rand rand;
+        std::vector<key_t> keys(sample_size);
+        for (key_t key = 0; key < sample_size; ++key)
+            keys[key] = key;
+        for (key_t i = sample_size - 1; 0 < i; --i)
+            std::swap(keys[i], keys[rand.get() % (i + 1)]);
+
+        std::vector<key_t> lookups(nlookups);
+        for (key_t& key : lookups)
+            key = rand.get() % sample_size;
+
+        const std::string path = ::testing::TempDir() + "rbtree_image_bench.bin";
+        uint64_t sum = 0;
+        uint64_t origin_sum = 0;
+
+        Duration origin_time;
+        Duration build_time;
+        Duration save_time;
+        {
+            Timestamp start = Timestamp::Now();
+            RBTree::IndexPool<IndexLinkedValue> pool(sample_size);
+            RBTree::NoNodeRBTree<key_t, pointer_t> tree;
+            for (const key_t key : keys)
+            {
+                const pointer_t value = pool.allocate();
+                value->m_key = key;
+                tree.insert(value);
+            }
+            for (const key_t key : lookups)
+                origin_sum += tree.find(key)->m_key;
+            origin_time = Timestamp::Now() - start;
+
+            start = Timestamp::Now();
+            image_t::save(path.c_str(), tree);
+            save_time = Timestamp::Now() - start;
+        }
+
+        {
+            Timestamp start = Timestamp::Now();
+            RBTree::IndexPool<IndexLinkedValue> pool(sample_size);
+            std::vector<pointer_t> sorted(sample_size);
+            for (key_t key = 0; key < sample_size; ++key)
+            {
+                sorted[key] = pool.allocate();
+                sorted[key]->m_key = key;
+            }
+
+            RBTree::NoNodeRBTree<key_t, pointer_t> tree;
+            tree.build_from_sorted(sorted.begin(), sorted.end());
+            for (const key_t key : lookups)
+                sum += tree.find(key)->m_key;
+            build_time = Timestamp::Now() - start;
+        }
+
+        // as after restart: the image isn't in the page cache
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (0 <= fd)
+        {
+            ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            ::close(fd);
+        }
+
+        Duration time;
+        {
+            Timestamp start = Timestamp::Now();
+            image_t image(path.c_str());
+            RBTree::NoNodeRBTree<key_t, pointer_t> tree;
+            image.adopt(tree);
+            for (const key_t key : lookups)
+                sum += tree.find(key)->m_key;
+            time = Timestamp::Now() - start;
+        }
+
+        std::remove(path.c_str());
+
+        if (sum != 2 * origin_sum)
+            return false;
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("image load:    ", time, origin_time, sample_size);
+        report_line("build sorted:  ", build_time, origin_time, sample_size);
+        report_line("insert time:   ", origin_time, origin_time, sample_size);
+        report_line("image save:    ", save_time, origin_time, sample_size);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    bool BenchBox::run_batch(uint32_t sample_size, uint32_t batch_size, uint32_t nthreads, uint32_t niterations)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer<value_t>::type>(sample_size);
+
+        // thread i owns keys i, i + nthreads, ...
+        std::vector<std::vector<key_t>> keys(nthreads);
+        std::vector<std::vector<std::pair<key_t, value_t>>> pairs(nthreads);
+        for (key_t key = 0; key < sample_size; ++key)
+        {
+            keys[key % nthreads].push_back(key);
+            pairs[key % nthreads].emplace_back(key, values[key]);
+        }
+
+        const auto for_batches = [batch_size](const auto& sample, auto fn)
+        {
+            for (size_t i = 0; i < sample.size(); i += batch_size)
+                fn(sample.begin() + i, sample.begin() + std::min<size_t>(i + batch_size, sample.size()));
+        };
+
+        Duration batch_time;
+        Duration single_time;
+        Duration origin_time;
+        for (uint32_t i = 0; i < niterations; ++i)
+        {
+            {
+                testedmap_t<key_t, value_t, std::mutex> map;
+                batch_time += BenchThreads(nthreads, [&](uint32_t id)
+                {
+                    for_batches(pairs[id], [&map](auto first, auto last) { map.insert_batch(first, last); });
+                    for_batches(keys[id], [&map](auto first, auto last) { map.erase_batch(first, last); });
+                });
+            }
+
+            {
+                testedmap_t<key_t, value_t, std::mutex> map;
+                single_time += BenchThreads(nthreads, [&](uint32_t id)
+                {
+                    for (const auto& pair : pairs[id])
+                        map.emplace(pair.first, pair.second);
+                    for (const key_t key : keys[id])
+                        map.erase(key);
+                });
+            }
+
+            {
+                std::map<key_t, value_t> map;
+                std::mutex mutex;
+                origin_time += BenchThreads(nthreads, [&](uint32_t id)
+                {
+                    for_batches(pairs[id], [&map, &mutex](auto first, auto last)
+                    {
+                        std::lock_guard<std::mutex> guard(mutex);
+                        map.insert(first, last);
+                    });
+                    for_batches(keys[id], [&map, &mutex](auto first, auto last)
+                    {
+                        std::lock_guard<std::mutex> guard(mutex);
+                        for (; last != first; ++first)
+                            map.erase(*first);
+                    });
+                });
+            }
+        }
+
+        KillValues(values);
+
+        std::cout << std::fixed << std::setprecision(2);
+        report_line("NoNode batch:  ", batch_time, origin_time, sample_size);
+        report_line("NoNode single: ", single_time, origin_time, sample_size);
+        report_line("std::map time: ", origin_time, origin_time, sample_size);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    void BenchBox::report(Duration gen_time, Duration map_time, Duration origin_time, uint32_t sample_size)
+    {
+        std::cout << std::fixed << std::setprecision(2) << std::setw(6);
+        const auto width = std::setw(9);
+
+        std::cout << "Gen time:      " << width
+                  << static_cast<double>(gen_time.Milliseconds())
+                  << std::endl;
+
+        const double map_speed = (double)sample_size / map_time.Milliseconds();
+        const double origin_speed = (double)sample_size / origin_time.Milliseconds();
+        const double origin_diff = ((map_speed / origin_speed) - 1) * 100;
+
+        std::cout << "NoNode time:   " << width
+                  << static_cast<double>(map_time.Milliseconds()) << std::endl;
+        std::cout << "std::map time: " << width
+                  << static_cast<double>(origin_time.Milliseconds())
+                  << " rel imp: " << (origin_diff > 0 ? '+' : ' ')
+                  << std::setprecision(2) << origin_diff << "%" << std::endl;
+    }
+
+    //--------------------------------------------------------------//
+
+    void BenchBox::report_line(const char* name, Duration time, Duration origin_time, uint32_t sample_size)
+    {
+        const auto width = std::setw(9);
+
+        const double speed = (double)sample_size / time.Milliseconds();
+        const double origin_speed = (double)sample_size / origin_time.Milliseconds();
+        const double origin_diff = ((speed / origin_speed) - 1) * 100;
+
+        std::cout << name << width
+                  << static_cast<double>(time.Milliseconds())
+                  << " rel imp: " << (origin_diff > 0 ? '+' : ' ')
+                  << std::setprecision(2) << origin_diff << "%" << std::endl;
+    }
+
+    //////////////////////////////////////////////////////////////////
+
+    TEST(TreeTest, bench_add_small)
+    {
+        constexpr uint32_t sample_size = 64;
+        constexpr uint32_t nthreads = 1;
+        constexpr uint32_t niterations = 25000;
+
+        BenchBox tb;
+        tb.run(AddTestGeneratorBucketed, sample_size, nthreads, niterations);
+    }
+
+    TEST(TreeTest, bench_add_medium)
+    {
+        constexpr uint32_t sample_size = 1024;
+        constexpr uint32_t nthreads = 1;
+        constexpr uint32_t niterations = 10000;
+
+        BenchBox tb;
+        tb.run(AddTestGeneratorBucketed, sample_size, nthreads, niterations);
+    }
+
+    TEST(TreeTest, bench_add_big)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t nthreads = 1;
         constexpr uint32_t niterations = 60;
 
         BenchBox tb;
@@ -285,6 +1849,397 @@ namespace Test
         tb.run(AddTestGeneratorBucketed, sample_size, nthreads, niterations);
     }
 
+    TEST(TreeTest, bench_mt_add_big_32)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t nthreads = 32;
+        constexpr uint32_t niterations = 16;
+
+        BenchBox tb;
+        tb.run(AddTestGeneratorBucketed, sample_size, nthreads, niterations);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_lookup_small)
+    {
+        constexpr uint32_t sample_size = 64;
+        constexpr uint32_t nthreads = 1;
+        constexpr uint32_t niterations = 2500;
+        constexpr uint32_t nlookups = 16;
+
+        BenchBox tb;
+        tb.run_lookup(AddTestGeneratorBucketed, sample_size, nthreads, niterations, nlookups);
+    }
+
+    TEST(TreeTest, bench_lookup_medium)
+    {
+        constexpr uint32_t sample_size = 1024;
+        constexpr uint32_t nthreads = 1;
+        constexpr uint32_t niterations = 1000;
+        constexpr uint32_t nlookups = 16;
+
+        BenchBox tb;
+        tb.run_lookup(AddTestGeneratorBucketed, sample_size, nthreads, niterations, nlookups);
+    }
+
+    TEST(TreeTest, bench_lookup_big)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t nthreads = 1;
+        constexpr uint32_t niterations = 6;
+        constexpr uint32_t nlookups = 16;
+
+        BenchBox tb;
+        tb.run_lookup(AddTestGeneratorBucketed, sample_size, nthreads, niterations, nlookups);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_mt_read90_medium)
+    {
+        constexpr uint32_t sample_size = 1024;
+        constexpr uint32_t nthreads = 8;
+        constexpr uint32_t niterations = 1000;
+        constexpr uint32_t nlookups = 9;
+
+        BenchBox tb;
+        tb.run_lookup(AddTestGeneratorBucketed, sample_size, nthreads, niterations, nlookups);
+    }
+
+    TEST(TreeTest, bench_mt_read90_big)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t nthreads = 8;
+        constexpr uint32_t niterations = 8;
+        constexpr uint32_t nlookups = 9;
+
+        BenchBox tb;
+        tb.run_lookup(AddTestGeneratorBucketed, sample_size, nthreads, niterations, nlookups);
+    }
+
+    TEST(TreeTest, bench_mt_read99_medium)
+    {
+        constexpr uint32_t sample_size = 1024;
+        constexpr uint32_t nthreads = 8;
+        constexpr uint32_t niterations = 100;
+        constexpr uint32_t nlookups = 99;
+
+        BenchBox tb;
+        tb.run_lookup(AddTestGeneratorBucketed, sample_size, nthreads, niterations, nlookups);
+    }
+
+    TEST(TreeTest, bench_mt_read99_big)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t nthreads = 8;
+        constexpr uint32_t niterations = 2;
+        constexpr uint32_t nlookups = 99;
+
+        BenchBox tb;
+        tb.run_lookup(AddTestGeneratorBucketed, sample_size, nthreads, niterations, nlookups);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_mt_sharded)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t max_threads = 32;
+        constexpr uint32_t niterations = 16;
+
+        BenchBox tb;
+        tb.run_sharded(AddTestGeneratorBucketed, sample_size, max_threads, niterations);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_mt_read_scaling)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t max_readers = 32;
+        constexpr uint32_t nlookups = 1000000;
+
+        BenchBox tb;
+        tb.run_read_scaling(sample_size, max_readers, nlookups);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_build_sorted)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t niterations = 10;
+
+        BenchBox tb;
+        tb.run_build(sample_size, niterations);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_hint_monotonic)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t nbuckets = 1;
+        constexpr uint32_t niterations = 5;
+
+        BenchBox tb;
+        tb.run_hint(MonotonicTestGeneratorBucketed, sample_size, nbuckets, niterations);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_hint_near_sorted)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t nbuckets = 8;
+        constexpr uint32_t niterations = 5;
+
+        BenchBox tb;
+        tb.run_hint(NearSortedTestGeneratorBucketed, sample_size, nbuckets, niterations);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_timer_queue)
+    {
+        constexpr uint32_t ntimers = 100000;
+        constexpr uint32_t npops = 2000000;
+
+        BenchBox tb;
+        tb.run_timer_queue(ntimers, npops);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_batch_ingest)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t batch_size = 1000;
+        constexpr uint32_t nthreads = 1;
+        constexpr uint32_t niterations = 5;
+
+        BenchBox tb;
+        tb.run_batch(sample_size, batch_size, nthreads, niterations);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_mt_batch_ingest)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t batch_size = 1000;
+        constexpr uint32_t nthreads = 4;
+        constexpr uint32_t niterations = 5;
+
+        BenchBox tb;
+        tb.run_batch(sample_size, batch_size, nthreads, niterations);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_interval_stabbing)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t max_length = 1000;
+        constexpr uint32_t nqueries = 300000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_intervals(sample_size, max_length, nqueries));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_range_sum)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t max_range = 1000;
+        constexpr uint32_t nqueries = 1000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_range_sum(sample_size, max_range, nqueries));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_scan_strings)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t niterations = 10;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_scan(sample_size, niterations));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_for_each_small)
+    {
+        constexpr uint32_t sample_size = 1000;
+        constexpr uint32_t niterations = 20000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_for_each(sample_size, niterations));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_for_each_medium)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t niterations = 200;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_for_each(sample_size, niterations));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_for_each_big)
+    {
+        constexpr uint32_t sample_size = 10000000;
+        constexpr uint32_t niterations = 2;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_for_each(sample_size, niterations));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_find_batch_medium)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t batch_size = 10000;
+        constexpr uint32_t nlookups = 5000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_find_batch(sample_size, batch_size, nlookups));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_find_batch_big)
+    {
+        constexpr uint32_t sample_size = 10000000;
+        constexpr uint32_t batch_size = 10000;
+        constexpr uint32_t nlookups = 5000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_find_batch(sample_size, batch_size, nlookups));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_compact_medium)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t nlookups = 5000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_compact(sample_size, nlookups));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_compact_big)
+    {
+        constexpr uint32_t sample_size = 10000000;
+        constexpr uint32_t nlookups = 5000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_compact(sample_size, nlookups));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_expire_range)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t nrounds = 100;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_expire(sample_size, nrounds));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_unite_similar)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t other_size = 1000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_unite(sample_size, other_size));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_unite_small)
+    {
+        constexpr uint32_t sample_size = 1000000;
+        constexpr uint32_t other_size = 1000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_unite(sample_size, other_size));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_parallel_bulk)
+    {
+        constexpr uint32_t sample_size = 10000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_parallel(sample_size));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_erase_tail)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t nreaders = 2;
+        constexpr uint32_t nerases = 1000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_erase_latency(sample_size, nreaders, nerases));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_freeze_medium)
+    {
+        constexpr uint32_t sample_size = 100000;
+        constexpr uint32_t nthreads = 4;
+        constexpr uint32_t nlookups = 2000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_freeze(sample_size, nthreads, nlookups));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_freeze_big)
+    {
+        constexpr uint32_t sample_size = 10000000;
+        constexpr uint32_t nthreads = 4;
+        constexpr uint32_t nlookups = 2000000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_freeze(sample_size, nthreads, nlookups));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bench_image_startup)
+    {
+        constexpr uint32_t sample_size = 10000000;
+        constexpr uint32_t nlookups = 1000;
+
+        BenchBox tb;
+        ASSERT_TRUE(tb.run_image(sample_size, nlookups));
+    }
+
     //////////////////////////////////////////////////////////////////
 
 }
@@ -0,0 +1,1211 @@
+#pragma once
+
+#include "stdint.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "locks.h"
+#include "nonoderbtree.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    namespace Detail
+    {
+        // number of keys[0, size) less than key (Upper - not greater than key),
+        // all 16 keys are compared at once, size - mask
+        template<bool Upper>
+        inline uint32_t count_keys(const uint32_t* keys, uint32_t size, uint32_t key) noexcept
+        {
+            assert(size <= 16);
+
+#if defined(__AVX2__)
+            // no unsigned compare: both sides are shifted into the signed range
+            const __m256i bias = _mm256_set1_epi32(INT32_MIN);
+            const __m256i needle = _mm256_xor_si256(_mm256_set1_epi32((int32_t)key), bias);
+            const __m256i low = _mm256_xor_si256(_mm256_load_si256((const __m256i*)keys), bias);
+            const __m256i high = _mm256_xor_si256(_mm256_load_si256((const __m256i*)(keys + 8)), bias);
+
+            // less: needle > keys[i], not greater: !(keys[i] > needle)
+            const __m256i low_mask = Upper ? _mm256_cmpgt_epi32(low, needle) : _mm256_cmpgt_epi32(needle, low);
+            const __m256i high_mask = Upper ? _mm256_cmpgt_epi32(high, needle) : _mm256_cmpgt_epi32(needle, high);
+            uint32_t mask = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(low_mask)) |
+                            ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(high_mask)) << 8);
+#elif defined(__SSE2__)
+            const __m128i bias = _mm_set1_epi32(INT32_MIN);
+            const __m128i needle = _mm_xor_si128(_mm_set1_epi32((int32_t)key), bias);
+            uint32_t mask = 0;
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                const __m128i part = _mm_xor_si128(_mm_load_si128((const __m128i*)(keys + 4 * i)), bias);
+                const __m128i part_mask = Upper ? _mm_cmpgt_epi32(part, needle) : _mm_cmpgt_epi32(needle, part);
+                mask |= (uint32_t)_mm_movemask_ps(_mm_castsi128_ps(part_mask)) << (4 * i);
+            }
+#else
+            uint32_t mask = 0;
+            for (uint32_t i = 0; i < 16; ++i)
+                mask |= (uint32_t)(Upper ? (key < keys[i]) : (keys[i] < key)) << i;
+#endif
+
+            if (Upper)
+                mask = ~mask;
+
+            return __builtin_popcount(mask & ((1u << size) - 1));
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////
+
+    // Ordered map on a B+ tree with cache line sized nodes: 16 keys per node,
+    // values and the leaf list are in leaves only. uint32_t keys of a node are compared
+    // by SSE2/AVX2 at once, other arithmetic keys by a branchless loop, others by binary search.
+    // The same interface as RBTree<K, V, Lock, Allocator>, but any insert/erase invalidates iterators.
+    // Nodes are allocated outside the lock: the tree keeps spare nodes for the worst case split,
+    // nodes freed by merges are kept as spares or given back after unlock.
+    // K and V are default constructible, free slots of nodes hold K()/V().
+    // Separators of leaves are copies of their first keys made under the lock, so K copies can't throw.
+    template<class K, class V, class Lock = FakeLock, class Allocator = std::allocator<std::pair<const K, V>>>
+    class BTree
+    {
+        static_assert(!IsOptimisticLock<Lock>::value, "nodes are changed in place, no optimistic readers");
+        static_assert(std::is_nothrow_copy_constructible<K>::value && std::is_nothrow_copy_assignable<K>::value,
+                      "separators are copied under the lock, by noexcept rebalance too");
+
+        static constexpr uint32_t s_keys = 16;
+
+        // but for the root
+        static constexpr uint32_t s_min_keys = s_keys / 2;
+
+        // enough for 2^32 keys
+        static constexpr uint32_t s_max_depth = 16;
+
+        struct Node
+        {
+            explicit Node(bool is_leaf)
+              : m_keys(),
+                m_size(0),
+                m_is_leaf(is_leaf),
+                m_chain(nullptr)
+            { }
+
+            alignas(64) K m_keys[s_keys];
+            uint32_t m_size;
+            bool m_is_leaf;
+
+            // next one of spare or freed nodes
+            Node* m_chain;
+        };
+
+        struct Leaf : Node
+        {
+            Leaf()
+              : Node(true),
+                m_values(),
+                m_prev(nullptr),
+                m_next(nullptr)
+            { }
+
+            V m_values[s_keys];
+            Leaf* m_prev;
+            Leaf* m_next;
+        };
+
+        // m_children[i] keys are in [m_keys[i - 1], m_keys[i])
+        struct Inner : Node
+        {
+            Inner()
+              : Node(false),
+                m_children()
+            { }
+
+            Node* m_children[s_keys + 1];
+        };
+
+        using leaf_allocator_t = typename std::allocator_traits<Allocator>::template rebind_alloc<Leaf>;
+        using leaf_traits_t = std::allocator_traits<leaf_allocator_t>;
+
+        using inner_allocator_t = typename std::allocator_traits<Allocator>::template rebind_alloc<Inner>;
+        using inner_traits_t = std::allocator_traits<inner_allocator_t>;
+
+    public:
+
+        class iterator;
+
+        explicit BTree(const Allocator& alloc = Allocator())
+          : m_root(nullptr),
+            m_first(nullptr),
+            m_last(nullptr),
+            m_size(0),
+            m_depth(0),
+            m_leaf_alloc(alloc),
+            m_inner_alloc(alloc),
+            m_spare_leaves(nullptr),
+            m_spare_inners(nullptr),
+            m_nspare_leaves(0),
+            m_nspare_inners(0)
+        { }
+
+        ~BTree()
+        { clear(); }
+
+        BTree(const BTree& other) = delete;
+        BTree(BTree&& other) noexcept = delete;
+        BTree& operator=(const BTree& other) = delete;
+        BTree& operator=(BTree&& other) noexcept = delete;
+
+        // the value is constructed before the lock is taken
+        template<typename... Args>
+        std::pair<iterator, bool> emplace(const K& key, Args&&... args);
+
+        std::pair<iterator, bool> insert(K const key, V const value);
+
+        std::pair<iterator, bool> insert(const std::pair<K, V>& value);
+
+        size_t erase(K key);
+
+        iterator find(const K& key) const;
+
+        bool contains(const K& key) const;
+
+        size_t count(const K& key) const;
+
+        iterator lower_bound(const K& key) const;
+
+        iterator upper_bound(const K& key) const;
+
+        std::pair<iterator, iterator> equal_range(const K& key) const;
+
+        // visitor(const K&, const V&) in key order under shared lock
+        template<class Visitor>
+        void for_each(Visitor visitor) const;
+
+        // visitor(const K&, const V&) for keys in [first, last), under shared lock
+        template<class Visitor>
+        void for_each_range(const K& first, const K& last, Visitor visitor) const;
+
+        void clear() noexcept;
+
+        size_t size() const noexcept;
+
+    public:
+
+        // bidirectional, --end() is the last value
+        class iterator : public std::iterator<std::bidirectional_iterator_tag, V> {
+            friend class BTree<K, V, Lock, Allocator>;
+
+            iterator(const BTree* tree, Leaf* leaf, uint32_t pos) : m_tree(tree), m_leaf(leaf), m_pos(pos) { }
+
+        public:
+
+            iterator(const iterator& it) = default;
+            ~iterator() = default;
+
+            iterator& operator=(const iterator& it) = default;
+
+            const V& operator*() const noexcept { return m_leaf->m_values[m_pos]; }
+            std::pair<K, V> operator*() { return std::pair<K, V>(m_leaf->m_keys[m_pos], m_leaf->m_values[m_pos]); }
+
+            const K& key() const noexcept { return m_leaf->m_keys[m_pos]; }
+            const V& value() const noexcept { return m_leaf->m_values[m_pos]; }
+
+            iterator& operator++() { next(); return *this; }
+            iterator operator++(int) { iterator it(*this); next(); return it; }
+
+            iterator& operator--() { prev(); return *this; }
+            iterator operator--(int) { iterator it(*this); prev(); return it; }
+
+            bool operator==(const iterator& other) const { return m_leaf == other.m_leaf && m_pos == other.m_pos; }
+            bool operator!=(const iterator& other) const { return !(*this == other); }
+
+        private:
+
+            inline void next() noexcept;
+            inline void prev() noexcept;
+
+        private:
+
+            const BTree* m_tree;
+
+            Leaf* m_leaf;
+
+            uint32_t m_pos;
+        };
+
+        iterator begin() const { return iterator(this, m_first, 0); }
+        iterator end()   const { return iterator(this, nullptr, 0); }
+
+        // min/max, end() for empty tree, O(1)
+        iterator front() const { return begin(); }
+        iterator back()  const { return (nullptr == m_last) ? end() : iterator(this, m_last, m_last->m_size - 1); }
+
+    public:
+
+        // B+ tree invariants, named as in RBTree for the test harness
+        bool checkRB() const;
+
+    private:
+
+        inline void lock_shared() const;
+
+        inline void unlock_shared() const;
+
+        // first position with key not less (Upper - greater) than the key, end() if none
+        template<bool Upper>
+        iterator bound(const K& key) const noexcept;
+
+        template<bool Upper>
+        static uint32_t search(const Node* node, const K& key) noexcept;
+
+        std::pair<iterator, bool> insert_locked(K&& key, V&& value);
+
+        // leaf of the key, path[i]/slots[i] - inner nodes of the descent and their children taken
+        Leaf* descend(const K& key, Node** path, uint32_t* slots) const noexcept;
+
+        // node at path[index] is short of keys: borrow from a sibling or merge with it
+        void rebalance(Node** path, uint32_t* slots, uint32_t index, Node*& freed) noexcept;
+
+        void merge(Inner* parent, uint32_t separator, Node*& freed) noexcept;
+
+        bool has_spares() const noexcept { return 0 < m_nspare_leaves && m_depth + 1 <= m_nspare_inners; }
+
+        // allocates the spares for a split of depth levels, lock isn't held
+        void reserve(uint32_t depth);
+
+        Leaf* pop_leaf() noexcept;
+        Inner* pop_inner() noexcept;
+
+        // keeps the node as a spare or adds it to freed
+        void release(Node* node, Node*& freed) noexcept;
+
+        void destroy_list(Node* node) noexcept;
+
+        void destroy_node(Node* node) noexcept;
+
+        void destroy_subtree(Node* node) noexcept;
+
+        bool check_subtree(const Node* node, uint32_t depth, const K* low, const K* high,
+                           size_t& size, const Leaf*& prev) const;
+
+        template<class T>
+        static void shift_in(T* array, uint32_t pos, uint32_t size, T&& item) noexcept;
+
+        // the freed last slot gets T()
+        template<class T>
+        static void shift_out(T* array, uint32_t pos, uint32_t size) noexcept;
+
+    private:
+
+        Node* m_root;
+
+        Leaf* m_first;
+
+        Leaf* m_last;
+
+        size_t m_size;
+
+        // number of inner levels
+        uint32_t m_depth;
+
+        leaf_allocator_t m_leaf_alloc;
+
+        inner_allocator_t m_inner_alloc;
+
+        mutable Lock m_lock;
+
+        // chained by m_chain
+        Node* m_spare_leaves;
+
+        Node* m_spare_inners;
+
+        uint32_t m_nspare_leaves;
+
+        uint32_t m_nspare_inners;
+    };
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<typename... Args>
+    std::pair<typename BTree<K, V, L, A>::iterator, bool> BTree<K, V, L, A>::emplace(const K& key, Args&&... args)
+    {
+        return insert_locked(K(key), V(std::forward<Args>(args)...));
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::pair<typename BTree<K, V, L, A>::iterator, bool> BTree<K, V, L, A>::insert(K const key, V const value)
+    {
+        return insert_locked(K(key), V(value));
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::pair<typename BTree<K, V, L, A>::iterator, bool> BTree<K, V, L, A>::insert(const std::pair<K, V>& value)
+    {
+        return insert_locked(K(value.first), V(value.second));
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::pair<typename BTree<K, V, L, A>::iterator, bool> BTree<K, V, L, A>::insert_locked(K&& key, V&& value)
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        m_lock.lock();
+
+        while (!has_spares())
+        {
+            const uint32_t depth = m_depth;
+            m_lock.unlock();
+
+            reserve(depth);
+
+            m_lock.lock();
+        }
+
+        Node* path[s_max_depth];
+        uint32_t slots[s_max_depth];
+        Leaf* leaf = descend(key, path, slots);
+        if (nullptr == leaf)
+        {
+            leaf = pop_leaf();
+            m_root = leaf;
+            m_first = leaf;
+            m_last = leaf;
+        }
+
+        uint32_t pos = search<false>(leaf, key);
+        if (pos < leaf->m_size && !(key < leaf->m_keys[pos]))
+        {
+            m_lock.unlock();
+            return std::make_pair(iterator(this, leaf, pos), false);
+        }
+
+        ++m_size;
+        if (leaf->m_size < s_keys)
+        {
+            shift_in(leaf->m_keys, pos, leaf->m_size, std::move(key));
+            shift_in(leaf->m_values, pos, leaf->m_size, std::move(value));
+            ++leaf->m_size;
+
+            m_lock.unlock();
+            return std::make_pair(iterator(this, leaf, pos), true);
+        }
+
+        // upper half goes to the new right leaf, the value - to the half of its position
+        Leaf* const right = pop_leaf();
+        for (uint32_t i = s_min_keys; i < s_keys; ++i)
+        {
+            right->m_keys[i - s_min_keys] = std::move(leaf->m_keys[i]);
+            right->m_values[i - s_min_keys] = std::move(leaf->m_values[i]);
+            leaf->m_keys[i] = K();
+            leaf->m_values[i] = V();
+        }
+        leaf->m_size = s_min_keys;
+        right->m_size = s_keys - s_min_keys;
+
+        right->m_prev = leaf;
+        right->m_next = leaf->m_next;
+        if (nullptr != leaf->m_next)
+            leaf->m_next->m_prev = right;
+        leaf->m_next = right;
+        if (m_last == leaf)
+            m_last = right;
+
+        Leaf* const target = (pos <= s_min_keys) ? leaf : right;
+        if (right == target)
+            pos -= s_min_keys;
+
+        shift_in(target->m_keys, pos, target->m_size, std::move(key));
+        shift_in(target->m_values, pos, target->m_size, std::move(value));
+        ++target->m_size;
+        const iterator result(this, target, pos);
+
+        // separator and the new right node go up while parents are full
+        K separator = right->m_keys[0];
+        Node* child = right;
+        uint32_t level = m_depth;
+        for (; 0 < level; --level)
+        {
+            Inner* const parent = static_cast<Inner*>(path[level - 1]);
+            const uint32_t slot = slots[level - 1];
+            if (parent->m_size < s_keys)
+            {
+                shift_in(parent->m_keys, slot, parent->m_size, std::move(separator));
+                shift_in(parent->m_children, slot + 1, parent->m_size + 1, std::move(child));
+                ++parent->m_size;
+                break;
+            }
+
+            // both halves get s_min_keys keys, one of the 17 keys goes up
+            Inner* const sibling = pop_inner();
+            K up;
+            if (slot == s_min_keys)
+            {
+                up = std::move(separator);
+                sibling->m_children[0] = child;
+                for (uint32_t i = s_min_keys; i < s_keys; ++i)
+                {
+                    sibling->m_keys[i - s_min_keys] = std::move(parent->m_keys[i]);
+                    sibling->m_children[i - s_min_keys + 1] = parent->m_children[i + 1];
+                    parent->m_keys[i] = K();
+                    parent->m_children[i + 1] = nullptr;
+                }
+                parent->m_size = s_min_keys;
+                sibling->m_size = s_keys - s_min_keys;
+            }
+            else
+            {
+                // middle is the last key staying on the left
+                const uint32_t middle = (slot < s_min_keys) ? s_min_keys - 1 : s_min_keys;
+                up = std::move(parent->m_keys[middle]);
+                parent->m_keys[middle] = K();
+                for (uint32_t i = middle + 1; i < s_keys; ++i)
+                {
+                    sibling->m_keys[i - middle - 1] = std::move(parent->m_keys[i]);
+                    parent->m_keys[i] = K();
+                }
+                for (uint32_t i = middle + 1; i <= s_keys; ++i)
+                {
+                    sibling->m_children[i - middle - 1] = parent->m_children[i];
+                    parent->m_children[i] = nullptr;
+                }
+                parent->m_size = middle;
+                sibling->m_size = s_keys - middle - 1;
+
+                Inner* const half = (slot < s_min_keys) ? parent : sibling;
+                const uint32_t half_slot = (slot < s_min_keys) ? slot : slot - middle - 1;
+                shift_in(half->m_keys, half_slot, half->m_size, std::move(separator));
+                shift_in(half->m_children, half_slot + 1, half->m_size + 1, std::move(child));
+                ++half->m_size;
+            }
+
+            separator = std::move(up);
+            child = sibling;
+        }
+
+        if (0 == level)
+        {
+            Inner* const root = pop_inner();
+            root->m_keys[0] = std::move(separator);
+            root->m_children[0] = m_root;
+            root->m_children[1] = child;
+            root->m_size = 1;
+            m_root = root;
+            ++m_depth;
+        }
+
+        m_lock.unlock();
+
+        return std::make_pair(result, true);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t BTree<K, V, L, A>::erase(K key)
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        m_lock.lock();
+
+        Node* path[s_max_depth + 1];
+        uint32_t slots[s_max_depth];
+        Leaf* const leaf = descend(key, path, slots);
+        const uint32_t pos = (nullptr == leaf) ? 0 : search<false>(leaf, key);
+        if (nullptr == leaf || leaf->m_size == pos || key < leaf->m_keys[pos])
+        {
+            m_lock.unlock();
+            return 0;
+        }
+
+        shift_out(leaf->m_keys, pos, leaf->m_size);
+        shift_out(leaf->m_values, pos, leaf->m_size);
+        --leaf->m_size;
+        --m_size;
+
+        Node* freed = nullptr;
+        if (0 == m_size)
+        {
+            release(leaf, freed);
+            m_root = nullptr;
+            m_first = nullptr;
+            m_last = nullptr;
+        }
+        else if (0 < m_depth && leaf->m_size < s_min_keys)
+        {
+            // leaf is the last node of the path
+            path[m_depth] = leaf;
+            rebalance(path, slots, m_depth, freed);
+
+            if (0 == m_root->m_size)
+            {
+                Inner* const root = static_cast<Inner*>(m_root);
+                m_root = root->m_children[0];
+                root->m_children[0] = nullptr;
+                --m_depth;
+                release(root, freed);
+            }
+        }
+
+        m_lock.unlock();
+
+        destroy_list(freed);
+
+        return 1;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::rebalance(Node** path, uint32_t* slots, uint32_t index, Node*& freed) noexcept
+    {
+        for (; 0 < index; --index)
+        {
+            Node* const node = path[index];
+            if (s_min_keys <= node->m_size)
+                return;
+
+            Inner* const parent = static_cast<Inner*>(path[index - 1]);
+            const uint32_t slot = slots[index - 1];
+            Node* const left = (0 < slot) ? parent->m_children[slot - 1] : nullptr;
+            Node* const right = (slot < parent->m_size) ? parent->m_children[slot + 1] : nullptr;
+
+            if (nullptr != left && s_min_keys < left->m_size)
+            {
+                const uint32_t last = left->m_size - 1;
+                if (node->m_is_leaf)
+                {
+                    Leaf* const from = static_cast<Leaf*>(left);
+                    Leaf* const to = static_cast<Leaf*>(node);
+                    shift_in(to->m_keys, 0, to->m_size, std::move(from->m_keys[last]));
+                    shift_in(to->m_values, 0, to->m_size, std::move(from->m_values[last]));
+                    from->m_keys[last] = K();
+                    from->m_values[last] = V();
+                    parent->m_keys[slot - 1] = to->m_keys[0];
+                }
+                else
+                {
+                    // separator comes down, the last key of the left goes up instead
+                    Inner* const from = static_cast<Inner*>(left);
+                    Inner* const to = static_cast<Inner*>(node);
+                    shift_in(to->m_keys, 0, to->m_size, std::move(parent->m_keys[slot - 1]));
+                    shift_in(to->m_children, 0, to->m_size + 1, std::move(from->m_children[last + 1]));
+                    parent->m_keys[slot - 1] = std::move(from->m_keys[last]);
+                    from->m_keys[last] = K();
+                    from->m_children[last + 1] = nullptr;
+                }
+
+                --left->m_size;
+                ++node->m_size;
+                return;
+            }
+
+            if (nullptr != right && s_min_keys < right->m_size)
+            {
+                const uint32_t end = node->m_size;
+                if (node->m_is_leaf)
+                {
+                    Leaf* const from = static_cast<Leaf*>(right);
+                    Leaf* const to = static_cast<Leaf*>(node);
+                    to->m_keys[end] = std::move(from->m_keys[0]);
+                    to->m_values[end] = std::move(from->m_values[0]);
+                    shift_out(from->m_keys, 0, from->m_size);
+                    shift_out(from->m_values, 0, from->m_size);
+                    parent->m_keys[slot] = from->m_keys[0];
+                }
+                else
+                {
+                    Inner* const from = static_cast<Inner*>(right);
+                    Inner* const to = static_cast<Inner*>(node);
+                    to->m_keys[end] = std::move(parent->m_keys[slot]);
+                    to->m_children[end + 1] = from->m_children[0];
+                    parent->m_keys[slot] = std::move(from->m_keys[0]);
+                    shift_out(from->m_keys, 0, from->m_size);
+                    shift_out(from->m_children, 0, from->m_size + 1);
+                }
+
+                --right->m_size;
+                ++node->m_size;
+                return;
+            }
+
+            // both siblings have s_min_keys: the pair fits one node
+            merge(parent, (0 < slot) ? slot - 1 : slot, freed);
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::merge(Inner* parent, uint32_t separator, Node*& freed) noexcept
+    {
+        Node* const left = parent->m_children[separator];
+        Node* const right = parent->m_children[separator + 1];
+        const uint32_t end = left->m_size;
+
+        if (left->m_is_leaf)
+        {
+            Leaf* const to = static_cast<Leaf*>(left);
+            Leaf* const from = static_cast<Leaf*>(right);
+            for (uint32_t i = 0; i < from->m_size; ++i)
+            {
+                to->m_keys[end + i] = std::move(from->m_keys[i]);
+                to->m_values[end + i] = std::move(from->m_values[i]);
+            }
+            to->m_size += from->m_size;
+
+            to->m_next = from->m_next;
+            if (nullptr != from->m_next)
+                from->m_next->m_prev = to;
+            if (m_last == from)
+                m_last = to;
+        }
+        else
+        {
+            Inner* const to = static_cast<Inner*>(left);
+            Inner* const from = static_cast<Inner*>(right);
+            to->m_keys[end] = std::move(parent->m_keys[separator]);
+            for (uint32_t i = 0; i < from->m_size; ++i)
+                to->m_keys[end + 1 + i] = std::move(from->m_keys[i]);
+            for (uint32_t i = 0; i <= from->m_size; ++i)
+                to->m_children[end + 1 + i] = from->m_children[i];
+            to->m_size += from->m_size + 1;
+        }
+
+        shift_out(parent->m_keys, separator, parent->m_size);
+        shift_out(parent->m_children, separator + 1, parent->m_size + 1);
+        --parent->m_size;
+
+        release(right, freed);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename BTree<K, V, L, A>::iterator BTree<K, V, L, A>::find(const K& key) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        iterator it = bound<false>(key);
+        if (end() != it && key < it.key())
+            it = end();
+
+        unlock_shared();
+
+        return it;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    bool BTree<K, V, L, A>::contains(const K& key) const
+    {
+        return end() != find(key);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t BTree<K, V, L, A>::count(const K& key) const
+    {
+        return contains(key) ? 1 : 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename BTree<K, V, L, A>::iterator BTree<K, V, L, A>::lower_bound(const K& key) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const iterator it = bound<false>(key);
+
+        unlock_shared();
+
+        return it;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename BTree<K, V, L, A>::iterator BTree<K, V, L, A>::upper_bound(const K& key) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const iterator it = bound<true>(key);
+
+        unlock_shared();
+
+        return it;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::pair<typename BTree<K, V, L, A>::iterator, typename BTree<K, V, L, A>::iterator>
+    BTree<K, V, L, A>::equal_range(const K& key) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const iterator first = bound<false>(key);
+        iterator last = first;
+        if (end() != last && !(key < last.key()))
+            ++last;
+
+        unlock_shared();
+
+        return std::make_pair(first, last);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class Visitor>
+    void BTree<K, V, L, A>::for_each(Visitor visitor) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        for (const Leaf* leaf = m_first; nullptr != leaf; leaf = leaf->m_next)
+        {
+            prefetch(leaf->m_next);
+            for (uint32_t i = 0; i < leaf->m_size; ++i)
+                visitor(leaf->m_keys[i], leaf->m_values[i]);
+        }
+
+        unlock_shared();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class Visitor>
+    void BTree<K, V, L, A>::for_each_range(const K& first, const K& last, Visitor visitor) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const iterator it = bound<false>(first);
+        uint32_t pos = it.m_pos;
+        for (const Leaf* leaf = it.m_leaf; nullptr != leaf; leaf = leaf->m_next, pos = 0)
+        {
+            for (; pos < leaf->m_size; ++pos)
+            {
+                if (!(leaf->m_keys[pos] < last))
+                {
+                    unlock_shared();
+                    return;
+                }
+
+                visitor(leaf->m_keys[pos], leaf->m_values[pos]);
+            }
+        }
+
+        unlock_shared();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::clear() noexcept
+    {
+        destroy_subtree(m_root);
+        destroy_list(m_spare_leaves);
+        destroy_list(m_spare_inners);
+
+        m_root = nullptr;
+        m_first = nullptr;
+        m_last = nullptr;
+        m_size = 0;
+        m_depth = 0;
+        m_spare_leaves = nullptr;
+        m_spare_inners = nullptr;
+        m_nspare_leaves = 0;
+        m_nspare_inners = 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t BTree<K, V, L, A>::size() const noexcept
+    {
+        return m_size;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    bool BTree<K, V, L, A>::checkRB() const
+    {
+        size_t size = 0;
+        const Leaf* prev = nullptr;
+        if (!check_subtree(m_root, 0, nullptr, nullptr, size, prev))
+            return false;
+
+        if (size != m_size || prev != m_last || (nullptr != m_root && 0 == m_root->m_size))
+            return false;
+
+        return (nullptr == m_root) == (nullptr == m_first);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    bool BTree<K, V, L, A>::check_subtree(const Node* node, uint32_t depth, const K* low, const K* high,
+                                          size_t& size, const Leaf*& prev) const
+    {
+        if (nullptr == node)
+            return 0 == depth;
+
+        if (node->m_is_leaf != (m_depth == depth) || s_keys < node->m_size)
+            return false;
+
+        if (m_root != node && node->m_size < s_min_keys)
+            return false;
+
+        for (uint32_t i = 0; i < node->m_size; ++i)
+        {
+            const K& key = node->m_keys[i];
+            if ((0 < i && !(node->m_keys[i - 1] < key)) || (nullptr != low && key < *low) ||
+                (nullptr != high && !(key < *high)))
+            {
+                return false;
+            }
+        }
+
+        if (node->m_is_leaf)
+        {
+            const Leaf* const leaf = static_cast<const Leaf*>(node);
+            if (leaf->m_prev != prev || (nullptr == prev ? m_first != leaf : prev->m_next != leaf))
+                return false;
+
+            size += leaf->m_size;
+            prev = leaf;
+            return true;
+        }
+
+        const Inner* const inner = static_cast<const Inner*>(node);
+        for (uint32_t i = 0; i <= inner->m_size; ++i)
+        {
+            const K* const child_low = (0 == i) ? low : &inner->m_keys[i - 1];
+            const K* const child_high = (inner->m_size == i) ? high : &inner->m_keys[i];
+            if (nullptr == inner->m_children[i] ||
+                !check_subtree(inner->m_children[i], depth + 1, child_low, child_high, size, prev))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::lock_shared() const
+    {
+        // exclusive for locks without shared mode (std::mutex)
+        if constexpr (IsSharedLock<L>::value)
+            m_lock.lock_shared();
+        else
+            m_lock.lock();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::unlock_shared() const
+    {
+        if constexpr (IsSharedLock<L>::value)
+            m_lock.unlock_shared();
+        else
+            m_lock.unlock();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<bool Upper>
+    typename BTree<K, V, L, A>::iterator BTree<K, V, L, A>::bound(const K& key) const noexcept
+    {
+        const Node* node = m_root;
+        if (nullptr == node)
+            return end();
+
+        while (!node->m_is_leaf)
+            node = static_cast<const Inner*>(node)->m_children[search<true>(node, key)];
+
+        // the next leaf starts not before the separator, which is greater than the key
+        Leaf* const leaf = const_cast<Leaf*>(static_cast<const Leaf*>(node));
+        const uint32_t pos = search<Upper>(leaf, key);
+        if (leaf->m_size == pos)
+            return iterator(this, leaf->m_next, 0);
+
+        return iterator(this, leaf, pos);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<bool Upper>
+    uint32_t BTree<K, V, L, A>::search(const Node* node, const K& key) noexcept
+    {
+        if constexpr (std::is_same<K, uint32_t>::value)
+        {
+            return Detail::count_keys<Upper>(node->m_keys, node->m_size, key);
+        }
+        else if constexpr (std::is_arithmetic<K>::value)
+        {
+            uint32_t count = 0;
+            for (uint32_t i = 0; i < node->m_size; ++i)
+                count += Upper ? !(key < node->m_keys[i]) : (node->m_keys[i] < key);
+            return count;
+        }
+        else
+        {
+            const K* const last = node->m_keys + node->m_size;
+            const K* const it = Upper ? std::upper_bound(node->m_keys, last, key) : std::lower_bound(node->m_keys, last, key);
+            return (uint32_t)(it - node->m_keys);
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename BTree<K, V, L, A>::Leaf* BTree<K, V, L, A>::descend(const K& key, Node** path, uint32_t* slots) const noexcept
+    {
+        Node* node = m_root;
+        if (nullptr == node)
+            return nullptr;
+
+        for (uint32_t level = 0; !node->m_is_leaf; ++level)
+        {
+            Inner* const inner = static_cast<Inner*>(node);
+            const uint32_t slot = search<true>(inner, key);
+            path[level] = inner;
+            slots[level] = slot;
+            node = inner->m_children[slot];
+        }
+
+        return static_cast<Leaf*>(node);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::reserve(uint32_t depth)
+    {
+        // a leaf and an inner node per level, one more for the new root
+        Node* leaves = nullptr;
+        Node* inners = nullptr;
+        Node* last_inner = nullptr;
+        try
+        {
+            Leaf* const leaf = leaf_traits_t::allocate(m_leaf_alloc, 1);
+            try
+            {
+                leaf_traits_t::construct(m_leaf_alloc, leaf);
+            }
+            catch (...)
+            {
+                leaf_traits_t::deallocate(m_leaf_alloc, leaf, 1);
+                throw;
+            }
+            leaves = leaf;
+
+            for (uint32_t i = 0; i <= depth; ++i)
+            {
+                Inner* const inner = inner_traits_t::allocate(m_inner_alloc, 1);
+                try
+                {
+                    inner_traits_t::construct(m_inner_alloc, inner);
+                }
+                catch (...)
+                {
+                    inner_traits_t::deallocate(m_inner_alloc, inner, 1);
+                    throw;
+                }
+
+                inner->m_chain = inners;
+                inners = inner;
+                if (nullptr == last_inner)
+                    last_inner = inner;
+            }
+        }
+        catch (...)
+        {
+            destroy_list(leaves);
+            destroy_list(inners);
+            throw;
+        }
+
+        // no guard
+        // for simple remove of fake lock by optimizer
+        m_lock.lock();
+
+        leaves->m_chain = m_spare_leaves;
+        m_spare_leaves = leaves;
+        ++m_nspare_leaves;
+
+        last_inner->m_chain = m_spare_inners;
+        m_spare_inners = inners;
+        m_nspare_inners += depth + 1;
+
+        m_lock.unlock();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename BTree<K, V, L, A>::Leaf* BTree<K, V, L, A>::pop_leaf() noexcept
+    {
+        Leaf* const leaf = static_cast<Leaf*>(m_spare_leaves);
+        m_spare_leaves = leaf->m_chain;
+        --m_nspare_leaves;
+        leaf->m_chain = nullptr;
+        return leaf;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename BTree<K, V, L, A>::Inner* BTree<K, V, L, A>::pop_inner() noexcept
+    {
+        Inner* const inner = static_cast<Inner*>(m_spare_inners);
+        m_spare_inners = inner->m_chain;
+        --m_nspare_inners;
+        inner->m_chain = nullptr;
+        return inner;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::release(Node* node, Node*& freed) noexcept
+    {
+        // moved out keys/values of a merged node are reset as well
+        node->m_size = 0;
+        std::fill(node->m_keys, node->m_keys + s_keys, K());
+
+        Node** spares = &m_spare_inners;
+        uint32_t* nspares = &m_nspare_inners;
+        uint32_t max_spares = m_depth + 1;
+        if (node->m_is_leaf)
+        {
+            Leaf* const leaf = static_cast<Leaf*>(node);
+            std::fill(leaf->m_values, leaf->m_values + s_keys, V());
+            leaf->m_prev = nullptr;
+            leaf->m_next = nullptr;
+
+            // one is enough for any insert
+            spares = &m_spare_leaves;
+            nspares = &m_nspare_leaves;
+            max_spares = 1;
+        }
+        else
+        {
+            Inner* const inner = static_cast<Inner*>(node);
+            std::fill(inner->m_children, inner->m_children + s_keys + 1, nullptr);
+        }
+
+        if (*nspares < max_spares)
+        {
+            node->m_chain = *spares;
+            *spares = node;
+            ++*nspares;
+            return;
+        }
+
+        node->m_chain = freed;
+        freed = node;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::destroy_list(Node* node) noexcept
+    {
+        while (nullptr != node)
+        {
+            Node* const next = node->m_chain;
+            destroy_node(node);
+            node = next;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::destroy_node(Node* node) noexcept
+    {
+        if (node->m_is_leaf)
+        {
+            Leaf* const leaf = static_cast<Leaf*>(node);
+            leaf_traits_t::destroy(m_leaf_alloc, leaf);
+            leaf_traits_t::deallocate(m_leaf_alloc, leaf, 1);
+        }
+        else
+        {
+            Inner* const inner = static_cast<Inner*>(node);
+            inner_traits_t::destroy(m_inner_alloc, inner);
+            inner_traits_t::deallocate(m_inner_alloc, inner, 1);
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::destroy_subtree(Node* node) noexcept
+    {
+        if (nullptr == node)
+            return;
+
+        if (!node->m_is_leaf)
+        {
+            Inner* const inner = static_cast<Inner*>(node);
+            for (uint32_t i = 0; i <= inner->m_size; ++i)
+                destroy_subtree(inner->m_children[i]);
+        }
+
+        destroy_node(node);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class T>
+    void BTree<K, V, L, A>::shift_in(T* array, uint32_t pos, uint32_t size, T&& item) noexcept
+    {
+        std::move_backward(array + pos, array + size, array + size + 1);
+        array[pos] = std::move(item);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class T>
+    void BTree<K, V, L, A>::shift_out(T* array, uint32_t pos, uint32_t size) noexcept
+    {
+        std::move(array + pos + 1, array + size, array + pos);
+        array[size - 1] = T();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::iterator::next() noexcept
+    {
+        if (++m_pos == m_leaf->m_size)
+        {
+            m_leaf = m_leaf->m_next;
+            m_pos = 0;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void BTree<K, V, L, A>::iterator::prev() noexcept
+    {
+        if (nullptr == m_leaf)
+        {
+            m_leaf = m_tree->m_last;
+            m_pos = m_leaf->m_size - 1;
+        }
+        else if (0 < m_pos)
+        {
+            --m_pos;
+        }
+        else
+        {
+            m_leaf = m_leaf->m_prev;
+            m_pos = m_leaf->m_size - 1;
+        }
+    }
+}
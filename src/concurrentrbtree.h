@@ -0,0 +1,1155 @@
+#pragma once
+
+#include "stdint.h"
+#include <atomic>
+#include <cassert>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include "epoch.h"
+#include "locks.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // Red-black tree for many writers. A writer locks its path hand over hand and rebalances
+    // top-down on the way (color flips and rotations inside the locked window, the tree is valid
+    // after every step), so writers in disjoint subtrees meet only at the top of the tree.
+    // Nothing is allocated under the locks.
+    // Finds don't lock: they check the version of every node they pass, as SeqLock readers
+    // do for the whole tree, and start again from the root if it has changed.
+    // Erase moves the predecessor of the erased key to its place, finds that could miss
+    // the moved key meanwhile retry (m_moves). Erased values are disposed by epochs.
+    // V - pointer to T with T* m_left, m_right; K m_key; std::atomic<uint64_t> m_state.
+    // insert/erase/find/contains are linearizable, the rest needs no concurrent writers.
+    template<class K, class V>
+    class ConcurrentNoNodeRBTree
+    {
+        static_assert(std::is_pointer<V>::value, "");
+
+        using value_t = std::remove_pointer_t<V>;
+
+        // unlinked values are chained by m_left, finds don't follow links of them
+        using reclaimer_t = EpochReclaimer<value_t, &value_t::m_left>;
+
+    public:
+
+        using guard_t = typename reclaimer_t::Guard;
+
+        ConcurrentNoNodeRBTree();
+
+        ConcurrentNoNodeRBTree(const ConcurrentNoNodeRBTree& other) = delete;
+        ConcurrentNoNodeRBTree(ConcurrentNoNodeRBTree&& other) noexcept = delete;
+        ConcurrentNoNodeRBTree& operator=(const ConcurrentNoNodeRBTree& other) = delete;
+        ConcurrentNoNodeRBTree& operator=(ConcurrentNoNodeRBTree&& other) noexcept = delete;
+
+        // false if the key is in the tree already, the value isn't linked then
+        bool insert(V value) noexcept;
+
+        // dispose(V) once no find can read the erased value, maybe later and by another erase:
+        // all disposers must do the same
+        template<class Disposer>
+        bool erase(const K& key, Disposer dispose) noexcept;
+
+        // the value can't be disposed while a pin() taken before it is alive
+        V find(const K& key) const noexcept;
+
+        bool contains(const K& key) const noexcept;
+
+        // pins may be nested
+        guard_t pin() const noexcept;
+
+        size_t size() const noexcept;
+
+        // erased values waiting for finds
+        size_t retired() const noexcept;
+
+        // in order, visitor(V)
+        template<class Visitor>
+        void for_each(Visitor visitor) const;
+
+        // dispose(V) for the values of the tree and the erased ones
+        template<class Disposer>
+        void clear(Disposer dispose) noexcept;
+
+    public:
+
+        bool checkRB() const noexcept;
+
+    private:
+
+        // node link, the link to the root for nullptr (the head above it)
+        inline V& link(V node, bool dir) noexcept;
+
+        // lock and version of the node, of the head for nullptr
+        inline std::atomic<uint64_t>& state(V node) const noexcept;
+
+        // nullptr is black, color of the node may be read under its lock or the lock of its parent,
+        // it's changed under both
+        static inline bool is_red(V node) noexcept;
+
+        // by the owner of the lock
+        static inline void set_red(V node, bool is_red) noexcept;
+
+        inline void lock(V node) noexcept;
+
+        inline void unlock(V node) noexcept;
+
+        // links of the locked node are changed between them
+        inline void begin_change(V node) noexcept;
+
+        inline void end_change(V node, uint64_t flags = 0) noexcept;
+
+        static inline V load_link(const V& link) noexcept;
+
+        static inline void store_link(V& link, V value) noexcept;
+
+        // state without changes in progress
+        static inline uint64_t stable(const std::atomic<uint64_t>& state) noexcept;
+
+        // no changes of links since the stable state was read
+        static inline bool is_valid(const std::atomic<uint64_t>& state, uint64_t stable) noexcept;
+
+        // false if the path has changed under it
+        bool descend(const K& key, V& result) const noexcept;
+
+        template<class Visitor>
+        static void walk(V node, Visitor& visitor);
+
+        template<class Disposer>
+        static void dispose_tree(V node, Disposer& dispose) noexcept;
+
+        // black height, 0 for a broken subtree
+        static uint32_t check_subtree(V node, const K* min, const K* max, size_t& size) noexcept;
+
+    private:
+
+        static constexpr uint64_t s_locked = 1;
+
+        static constexpr uint64_t s_changing = 2;
+
+        static constexpr uint64_t s_unlinked = 4;
+
+        static constexpr uint64_t s_red = 8;
+
+        static constexpr uint64_t s_version = 16;
+
+        // what finds check: all but the lock and the color
+        static constexpr uint64_t s_shape = ~(s_locked | s_red);
+
+        // m_moves: moves begun in the high bits, moves in progress in the low ones
+        static constexpr uint64_t s_move = uint64_t(1) << 32;
+
+        static constexpr uint64_t s_moving = s_move - 1;
+
+        static constexpr size_t s_cache_line = 64;
+
+        // the head: lock and version of the link to the root
+        alignas(s_cache_line) mutable std::atomic<uint64_t> m_head;
+
+        V m_root;
+
+        alignas(s_cache_line) std::atomic<uint64_t> m_moves;
+
+        alignas(s_cache_line) std::atomic<size_t> m_size;
+
+        reclaimer_t m_reclaimer;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // Map over ConcurrentNoNodeRBTree: nodes are allocated before the locks and destroyed
+    // by epochs after erase. Allocator must be thread safe.
+    template<class K, class V, class Allocator = std::allocator<std::pair<const K, V>>>
+    class ConcurrentRBTree
+    {
+        struct Node
+        {
+            template<typename... Args>
+            Node(const K& key, Args&&... args)
+              : m_left(nullptr),
+                m_right(nullptr),
+                m_state(0),
+                m_key(key),
+                m_value(std::forward<Args>(args)...)
+            { }
+
+            Node() = delete;
+
+            Node* m_left;
+            Node* m_right;
+            std::atomic<uint64_t> m_state;
+            K m_key;
+            V m_value;
+        };
+
+        using node_allocator_t = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+
+        using node_traits_t = std::allocator_traits<node_allocator_t>;
+
+        using tree_t = ConcurrentNoNodeRBTree<K, Node*>;
+
+    public:
+
+        explicit ConcurrentRBTree(const Allocator& alloc = Allocator())
+          : m_tree(),
+            m_alloc(alloc)
+        { }
+
+        ~ConcurrentRBTree()
+        { clear(); }
+
+        ConcurrentRBTree(const ConcurrentRBTree& other) = delete;
+        ConcurrentRBTree(ConcurrentRBTree&& other) noexcept = delete;
+        ConcurrentRBTree& operator=(const ConcurrentRBTree& other) = delete;
+        ConcurrentRBTree& operator=(ConcurrentRBTree&& other) noexcept = delete;
+
+        template<typename... Args>
+        bool emplace(const K& key, Args&&... args);
+
+        bool insert(K const key, V const value);
+
+        bool insert(const std::pair<K, V>& value);
+
+        size_t erase(const K& key);
+
+        bool contains(const K& key) const noexcept;
+
+        size_t count(const K& key) const noexcept;
+
+        // copy of the value, it may be erased meanwhile
+        std::optional<V> find(const K& key) const;
+
+        // in order, visitor(const K&, const V&), no concurrent writers
+        template<class Visitor>
+        void for_each(Visitor visitor) const;
+
+        // no concurrent users
+        void clear() noexcept;
+
+        size_t size() const noexcept;
+
+        // erased nodes waiting for finds
+        size_t retired() const noexcept;
+
+    public:
+
+        bool checkRB() const noexcept;
+
+    private:
+
+        template<typename... Args>
+        inline Node* create_node(Args&&... args);
+
+        inline void destroy_node(Node* node) noexcept;
+
+    private:
+
+        tree_t m_tree;
+
+        node_allocator_t m_alloc;
+    };
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    ConcurrentNoNodeRBTree<K, V>::ConcurrentNoNodeRBTree()
+      : m_head(0),
+        m_root(nullptr),
+        m_moves(0),
+        m_size(0),
+        m_reclaimer()
+    { }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    bool ConcurrentNoNodeRBTree<K, V>::insert(V value) noexcept
+    {
+        const K& key = value->m_key;
+
+        // red leaf, locked while it's in the window
+        store_link(value->m_left, nullptr);
+        store_link(value->m_right, nullptr);
+        value->m_state.store(s_locked | s_red, std::memory_order_relaxed);
+
+        lock(nullptr);
+
+        V q = m_root;
+        if (nullptr == q)
+        {
+            set_red(value, false);
+
+            begin_change(nullptr);
+            store_link(m_root, value);
+            end_change(nullptr);
+
+            unlock(value);
+            unlock(nullptr);
+
+            m_size.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        lock(q);
+
+        // locked window of the path t -> g -> p -> q, nullptr is the head,
+        // t and g are missing at the top and after rotations
+        V t = nullptr;
+        V g = nullptr;
+        V p = nullptr;
+        bool has_t = false;
+        bool has_g = false;
+
+        // from g to p and from p to q
+        bool plast = false;
+        bool last = false;
+
+        // children of q locked by the double rotation
+        V kids[2] = {nullptr, nullptr};
+
+        bool is_inserted = false;
+        while (true)
+        {
+            // splits 4-node, the root stays black
+            const V left = q->m_left;
+            const V right = q->m_right;
+            if (is_red(left) && is_red(right))
+            {
+                lock(left);
+                lock(right);
+
+                set_red(left, false);
+                set_red(right, false);
+                if (nullptr != p)
+                    set_red(q, true);
+
+                unlock(left);
+                unlock(right);
+            }
+
+            // red q under red p, so p isn't the root and t, g are locked
+            if (nullptr != p && is_red(q) && is_red(p))
+            {
+                assert(has_t && has_g);
+
+                const bool gdir = (nullptr != t) && (t->m_right == g);
+                if (last == plast)
+                {
+                    begin_change(t);
+                    begin_change(g);
+                    begin_change(p);
+
+                    store_link(link(g, plast), link(p, !plast));
+                    store_link(link(p, !plast), g);
+                    store_link(link(t, gdir), p);
+
+                    set_red(g, true);
+                    set_red(p, false);
+
+                    end_change(p);
+                    end_change(g);
+                    end_change(t);
+
+                    unlock(g);
+
+                    // t -> p -> q
+                    g = t;
+                    has_t = false;
+                }
+                else
+                {
+                    const V near = link(q, plast);
+                    const V far = link(q, !plast);
+
+                    begin_change(t);
+                    begin_change(g);
+                    begin_change(p);
+                    begin_change(q);
+
+                    store_link(link(p, !plast), near);
+                    store_link(link(g, plast), far);
+                    store_link(link(q, plast), p);
+                    store_link(link(q, !plast), g);
+                    store_link(link(t, gdir), q);
+
+                    set_red(g, true);
+                    set_red(q, false);
+
+                    end_change(q);
+                    end_change(p);
+                    end_change(g);
+                    end_change(t);
+
+                    // t -> q -> p, g
+                    kids[plast] = p;
+                    kids[!plast] = g;
+
+                    p = t;
+                    has_g = false;
+                    has_t = false;
+                }
+            }
+
+            if (key == q->m_key)
+                break;
+
+            const bool dir = q->m_key < key;
+
+            V next;
+            if (nullptr != kids[0])
+            {
+                next = kids[dir];
+                unlock(kids[!dir]);
+                kids[0] = nullptr;
+                kids[1] = nullptr;
+            }
+            else
+            {
+                next = link(q, dir);
+                if (nullptr == next)
+                {
+                    begin_change(q);
+                    store_link(link(q, dir), value);
+                    end_change(q);
+
+                    next = value;
+                    is_inserted = true;
+                }
+                else
+                {
+                    lock(next);
+                }
+            }
+
+            if (has_t)
+                unlock(t);
+
+            t = g;
+            has_t = has_g;
+            g = p;
+            has_g = true;
+            p = q;
+            q = next;
+            plast = last;
+            last = dir;
+        }
+
+        if (nullptr != kids[0])
+        {
+            unlock(kids[0]);
+            unlock(kids[1]);
+        }
+
+        unlock(q);
+        unlock(p);
+        if (has_g)
+            unlock(g);
+        if (has_t)
+            unlock(t);
+
+        if (is_inserted)
+            m_size.fetch_add(1, std::memory_order_relaxed);
+
+        return is_inserted;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    template<class Disposer>
+    bool ConcurrentNoNodeRBTree<K, V>::erase(const K& key, Disposer dispose) noexcept
+    {
+        lock(nullptr);
+
+        V q = m_root;
+        if (nullptr == q)
+        {
+            unlock(nullptr);
+            return false;
+        }
+        lock(q);
+
+        // locked window of the path g -> p -> q, nullptr is the head, g is missing at the top
+        // and after rotations
+        V g = nullptr;
+        V p = nullptr;
+        bool has_g = false;
+
+        // from p to q
+        bool last = false;
+
+        // f has the key, it's replaced by its predecessor at the end of the path:
+        // f and its parent fp stay locked since f is found
+        V f = nullptr;
+        V fp = nullptr;
+
+        const auto release = [this, &f, &fp](V node)
+        {
+            if (nullptr == f || (node != f && node != fp))
+                unlock(node);
+        };
+
+        while (true)
+        {
+            if (key == q->m_key)
+            {
+                f = q;
+                fp = p;
+            }
+
+            // to the predecessor after f
+            const bool dir = q->m_key < key;
+
+            // pushes red down: q or its next child becomes red
+            if (!is_red(q) && !is_red(link(q, dir)))
+            {
+                const V r = link(q, !dir);
+                if (is_red(r))
+                {
+                    lock(r);
+
+                    begin_change(p);
+                    begin_change(q);
+                    begin_change(r);
+
+                    store_link(link(q, !dir), link(r, dir));
+                    store_link(link(r, dir), q);
+                    store_link(link(p, last), r);
+
+                    set_red(q, true);
+                    set_red(r, false);
+
+                    end_change(r);
+                    end_change(q);
+                    end_change(p);
+
+                    if (f == q)
+                        fp = r;
+
+                    // p -> r -> q
+                    if (has_g)
+                        release(g);
+                    release(p);
+
+                    p = r;
+                    has_g = false;
+                }
+                else if (nullptr != p)
+                {
+                    // p is red unless it's the root, then g is the head
+                    assert(has_g);
+
+                    const V s = link(p, !last);
+                    if (nullptr != s)
+                    {
+                        lock(s);
+
+                        const V near = link(s, last);
+                        const V far = link(s, !last);
+                        if (!is_red(near) && !is_red(far))
+                        {
+                            set_red(p, false);
+                            set_red(s, true);
+                            set_red(q, true);
+
+                            unlock(s);
+                        }
+                        else
+                        {
+                            const bool gdir = (nullptr != g) && (g->m_right == p);
+
+                            V top;
+                            V other;
+                            if (is_red(near))
+                            {
+                                lock(near);
+
+                                begin_change(g);
+                                begin_change(p);
+                                begin_change(s);
+                                begin_change(near);
+
+                                store_link(link(s, last), link(near, !last));
+                                store_link(link(p, !last), link(near, last));
+                                store_link(link(near, !last), s);
+                                store_link(link(near, last), p);
+                                store_link(link(g, gdir), near);
+
+                                top = near;
+                                other = s;
+                            }
+                            else
+                            {
+                                lock(far);
+
+                                begin_change(g);
+                                begin_change(p);
+                                begin_change(s);
+
+                                store_link(link(p, !last), near);
+                                store_link(link(s, last), p);
+                                store_link(link(g, gdir), s);
+
+                                top = s;
+                                other = far;
+                            }
+
+                            // the root stays black
+                            set_red(top, nullptr != g);
+                            set_red(p, false);
+                            set_red(other, false);
+                            set_red(q, true);
+
+                            if (top == near)
+                                end_change(near);
+                            end_change(s);
+                            end_change(p);
+                            end_change(g);
+
+                            if (f == p)
+                                fp = top;
+
+                            // g -> top -> p -> q
+                            release(g);
+                            release(top);
+                            release(other);
+
+                            has_g = false;
+                        }
+                    }
+                }
+            }
+
+            const V next = link(q, dir);
+            if (nullptr == next)
+                break;
+
+            lock(next);
+
+            if (has_g)
+                release(g);
+
+            g = p;
+            has_g = true;
+            p = q;
+            q = next;
+            last = dir;
+        }
+
+        if (nullptr == f)
+        {
+            unlock(q);
+            unlock(p);
+            if (has_g)
+                unlock(g);
+
+            return false;
+        }
+
+        // q is red or the root, so the child is a red leaf of the root
+        const V child = link(q, nullptr == q->m_left);
+        if (nullptr != child)
+            lock(child);
+
+        const bool is_moved = f != q;
+        if (is_moved)
+        {
+            m_moves.fetch_add(s_move + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+
+            begin_change(f);
+            begin_change(fp);
+        }
+        begin_change(p);
+        begin_change(q);
+
+        store_link(link(p, (nullptr != p) && (p->m_right == q)), child);
+        if (nullptr != child)
+            set_red(child, false);
+
+        if (is_moved)
+        {
+            store_link(q->m_left, f->m_left);
+            store_link(q->m_right, f->m_right);
+            set_red(q, is_red(f));
+            store_link(link(fp, (nullptr != fp) && (fp->m_right == f)), q);
+
+            end_change(q);
+            end_change(p);
+            end_change(fp);
+            end_change(f, s_unlinked);
+
+            m_moves.fetch_sub(1, std::memory_order_release);
+        }
+        else
+        {
+            end_change(q, s_unlinked);
+            end_change(p);
+        }
+
+        if (nullptr != child)
+            unlock(child);
+
+        // the window, f and fp may overlap
+        V held[5];
+        uint32_t nheld = 0;
+        const auto hold = [&held, &nheld](V node)
+        {
+            for (uint32_t i = 0; i < nheld; ++i)
+            {
+                if (held[i] == node)
+                    return;
+            }
+            held[nheld++] = node;
+        };
+
+        hold(q);
+        hold(p);
+        if (has_g)
+            hold(g);
+        hold(f);
+        hold(fp);
+
+        for (uint32_t i = 0; i < nheld; ++i)
+            unlock(held[i]);
+
+        m_size.fetch_sub(1, std::memory_order_relaxed);
+
+        store_link(f->m_left, nullptr);
+        m_reclaimer.retire(f, dispose);
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    V ConcurrentNoNodeRBTree<K, V>::find(const K& key) const noexcept
+    {
+        const guard_t guard = m_reclaimer.pin();
+
+        SpinWait spin;
+        while (true)
+        {
+            // a moved key may be missed by the descent started before the move
+            const uint64_t moves = m_moves.load(std::memory_order_acquire);
+            if (0 != (moves & s_moving))
+            {
+                spin.wait();
+                continue;
+            }
+
+            V result;
+            if (!descend(key, result))
+                continue;
+
+            if (nullptr != result)
+                return result;
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (moves == m_moves.load(std::memory_order_relaxed))
+                return nullptr;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    bool ConcurrentNoNodeRBTree<K, V>::contains(const K& key) const noexcept
+    {
+        return nullptr != find(key);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    typename ConcurrentNoNodeRBTree<K, V>::guard_t ConcurrentNoNodeRBTree<K, V>::pin() const noexcept
+    {
+        return m_reclaimer.pin();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    size_t ConcurrentNoNodeRBTree<K, V>::size() const noexcept
+    {
+        return m_size.load(std::memory_order_relaxed);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    size_t ConcurrentNoNodeRBTree<K, V>::retired() const noexcept
+    {
+        return m_reclaimer.pending();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    template<class Visitor>
+    void ConcurrentNoNodeRBTree<K, V>::for_each(Visitor visitor) const
+    {
+        walk(m_root, visitor);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    template<class Disposer>
+    void ConcurrentNoNodeRBTree<K, V>::clear(Disposer dispose) noexcept
+    {
+        const V root = m_root;
+        m_root = nullptr;
+        m_size.store(0, std::memory_order_relaxed);
+
+        dispose_tree(root, dispose);
+        m_reclaimer.reclaim(dispose);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    bool ConcurrentNoNodeRBTree<K, V>::checkRB() const noexcept
+    {
+        if (0 != (m_head.load(std::memory_order_relaxed) & (s_locked | s_changing)))
+            return false;
+
+        if (nullptr == m_root)
+            return 0 == size();
+
+        if (is_red(m_root))
+            return false;
+
+        size_t size = 0;
+        if (0 == check_subtree(m_root, nullptr, nullptr, size))
+            return false;
+
+        return size == this->size();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    V& ConcurrentNoNodeRBTree<K, V>::link(V node, bool dir) noexcept
+    {
+        if (nullptr == node)
+            return m_root;
+
+        return dir ? node->m_right : node->m_left;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    std::atomic<uint64_t>& ConcurrentNoNodeRBTree<K, V>::state(V node) const noexcept
+    {
+        return (nullptr == node) ? m_head : node->m_state;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    bool ConcurrentNoNodeRBTree<K, V>::is_red(V node) noexcept
+    {
+        return (nullptr != node) && (0 != (node->m_state.load(std::memory_order_relaxed) & s_red));
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    void ConcurrentNoNodeRBTree<K, V>::set_red(V node, bool is_red) noexcept
+    {
+        const uint64_t word = node->m_state.load(std::memory_order_relaxed);
+        node->m_state.store(is_red ? (word | s_red) : (word & ~s_red), std::memory_order_relaxed);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    void ConcurrentNoNodeRBTree<K, V>::lock(V node) noexcept
+    {
+        std::atomic<uint64_t>& word = state(node);
+
+        SpinWait spin;
+        while (true)
+        {
+            uint64_t current = word.load(std::memory_order_relaxed);
+            if (0 == (current & s_locked) &&
+                word.compare_exchange_weak(current, current | s_locked, std::memory_order_acquire))
+            {
+                return;
+            }
+
+            spin.wait();
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    void ConcurrentNoNodeRBTree<K, V>::unlock(V node) noexcept
+    {
+        // nobody else writes the locked state
+        std::atomic<uint64_t>& word = state(node);
+        word.store(word.load(std::memory_order_relaxed) & ~s_locked, std::memory_order_release);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    void ConcurrentNoNodeRBTree<K, V>::begin_change(V node) noexcept
+    {
+        std::atomic<uint64_t>& word = state(node);
+        word.store(word.load(std::memory_order_relaxed) | s_changing, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    void ConcurrentNoNodeRBTree<K, V>::end_change(V node, uint64_t flags) noexcept
+    {
+        std::atomic<uint64_t>& word = state(node);
+        const uint64_t current = word.load(std::memory_order_relaxed);
+        word.store(((current & ~s_changing) | flags) + s_version, std::memory_order_release);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    V ConcurrentNoNodeRBTree<K, V>::load_link(const V& link) noexcept
+    {
+        V result;
+        __atomic_load(&link, &result, __ATOMIC_RELAXED);
+        return result;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    void ConcurrentNoNodeRBTree<K, V>::store_link(V& link, V value) noexcept
+    {
+        __atomic_store(&link, &value, __ATOMIC_RELAXED);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    uint64_t ConcurrentNoNodeRBTree<K, V>::stable(const std::atomic<uint64_t>& state) noexcept
+    {
+        SpinWait spin;
+        while (true)
+        {
+            const uint64_t word = state.load(std::memory_order_acquire);
+            if (0 == (word & s_changing))
+                return word;
+
+            spin.wait();
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    bool ConcurrentNoNodeRBTree<K, V>::is_valid(const std::atomic<uint64_t>& state, uint64_t stable) noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return 0 == ((state.load(std::memory_order_relaxed) ^ stable) & s_shape);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    bool ConcurrentNoNodeRBTree<K, V>::descend(const K& key, V& result) const noexcept
+    {
+        // node is the child of parent while the parent keeps its stable state,
+        // and the parent is linked then: unlink changes the state
+        const std::atomic<uint64_t>* parent = &m_head;
+        uint64_t parent_stable = stable(m_head);
+
+        V node = load_link(m_root);
+        while (nullptr != node)
+        {
+            const uint64_t node_stable = stable(node->m_state);
+            if (!is_valid(*parent, parent_stable))
+                return false;
+
+            if (key == node->m_key)
+            {
+                result = node;
+                return true;
+            }
+
+            const V next = load_link((key < node->m_key) ? node->m_left : node->m_right);
+
+            parent = &node->m_state;
+            parent_stable = node_stable;
+            node = next;
+        }
+
+        if (!is_valid(*parent, parent_stable))
+            return false;
+
+        result = nullptr;
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    template<class Visitor>
+    void ConcurrentNoNodeRBTree<K, V>::walk(V node, Visitor& visitor)
+    {
+        while (nullptr != node)
+        {
+            walk(node->m_left, visitor);
+            visitor(node);
+            node = node->m_right;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    template<class Disposer>
+    void ConcurrentNoNodeRBTree<K, V>::dispose_tree(V node, Disposer& dispose) noexcept
+    {
+        while (nullptr != node)
+        {
+            dispose_tree(node->m_left, dispose);
+
+            const V right = node->m_right;
+            dispose(node);
+            node = right;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    uint32_t ConcurrentNoNodeRBTree<K, V>::check_subtree(V node, const K* min, const K* max, size_t& size) noexcept
+    {
+        if (nullptr == node)
+            return 1;
+
+        const uint64_t word = node->m_state.load(std::memory_order_relaxed);
+        if (0 != (word & (s_locked | s_changing | s_unlinked)))
+            return 0;
+
+        if ((nullptr != min && !(*min < node->m_key)) || (nullptr != max && !(node->m_key < *max)))
+            return 0;
+
+        const bool is_node_red = is_red(node);
+        if (is_node_red && (is_red(node->m_left) || is_red(node->m_right)))
+            return 0;
+
+        ++size;
+
+        const uint32_t left = check_subtree(node->m_left, min, &node->m_key, size);
+        const uint32_t right = check_subtree(node->m_right, &node->m_key, max, size);
+        if (0 == left || left != right)
+            return 0;
+
+        return is_node_red ? left : left + 1;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<typename... Args>
+    bool ConcurrentRBTree<K, V, A>::emplace(const K& key, Args&&... args)
+    {
+        Node* const node = create_node(key, std::forward<Args>(args)...);
+        if (m_tree.insert(node))
+            return true;
+
+        // never linked
+        destroy_node(node);
+        return false;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    bool ConcurrentRBTree<K, V, A>::insert(K const key, V const value)
+    {
+        return emplace(key, value);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    bool ConcurrentRBTree<K, V, A>::insert(const std::pair<K, V>& value)
+    {
+        return emplace(value.first, value.second);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t ConcurrentRBTree<K, V, A>::erase(const K& key)
+    {
+        return m_tree.erase(key, [this](Node* node) { destroy_node(node); }) ? 1 : 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    bool ConcurrentRBTree<K, V, A>::contains(const K& key) const noexcept
+    {
+        return m_tree.contains(key);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t ConcurrentRBTree<K, V, A>::count(const K& key) const noexcept
+    {
+        return m_tree.contains(key) ? 1 : 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    std::optional<V> ConcurrentRBTree<K, V, A>::find(const K& key) const
+    {
+        const auto guard = m_tree.pin();
+
+        const Node* const node = m_tree.find(key);
+        if (nullptr == node)
+            return std::nullopt;
+
+        return node->m_value;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void ConcurrentRBTree<K, V, A>::for_each(Visitor visitor) const
+    {
+        m_tree.for_each([&visitor](const Node* node) { visitor(node->m_key, node->m_value); });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void ConcurrentRBTree<K, V, A>::clear() noexcept
+    {
+        m_tree.clear([this](Node* node) { destroy_node(node); });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t ConcurrentRBTree<K, V, A>::size() const noexcept
+    {
+        return m_tree.size();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t ConcurrentRBTree<K, V, A>::retired() const noexcept
+    {
+        return m_tree.retired();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    bool ConcurrentRBTree<K, V, A>::checkRB() const noexcept
+    {
+        return m_tree.checkRB();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<typename... Args>
+    typename ConcurrentRBTree<K, V, A>::Node* ConcurrentRBTree<K, V, A>::create_node(Args&&... args)
+    {
+        Node* const node = node_traits_t::allocate(m_alloc, 1);
+        try
+        {
+            node_traits_t::construct(m_alloc, node, std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            node_traits_t::deallocate(m_alloc, node, 1);
+            throw;
+        }
+
+        return node;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void ConcurrentRBTree<K, V, A>::destroy_node(Node* node) noexcept
+    {
+        node_traits_t::destroy(m_alloc, node);
+        node_traits_t::deallocate(m_alloc, node, 1);
+    }
+}
@@ -0,0 +1,354 @@
+#pragma once
+
+#include "stdint.h"
+#include <atomic>
+#include <memory>
+#include "locks.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // Epoch-based reclamation of values unlinked from a structure with lock-free readers.
+    // A reader pins the global epoch for its pass (Guard), a writer retires unlinked values
+    // to the bin of its thread tagged with the epoch. The epoch is advanced only when nobody
+    // is pinned at the previous one, so values retired at epoch e are unreachable at e + 2:
+    // they are disposed then, by batches, by the next retire() to the same bin.
+    // Every batch also sweeps one more bin in turn, for threads that don't retire any more.
+    // Threads are spread over s_slots slots, threads of one slot share its counters and bin.
+    // Retired values are linked by Link.
+    template<class T, T* T::*Link>
+    class EpochReclaimer
+    {
+    public:
+
+        // keeps the epoch of the reader pinned, movable
+        class Guard
+        {
+            friend class EpochReclaimer<T, Link>;
+
+            explicit Guard(std::atomic<uint32_t>* readers) noexcept
+              : m_readers(readers)
+            { }
+
+        public:
+
+            Guard(Guard&& other) noexcept
+              : m_readers(other.m_readers)
+            { other.m_readers = nullptr; }
+
+            ~Guard()
+            {
+                if (nullptr != m_readers)
+                    m_readers->fetch_sub(1, std::memory_order_release);
+            }
+
+            Guard(const Guard& other) = delete;
+            Guard& operator=(const Guard& other) = delete;
+            Guard& operator=(Guard&& other) noexcept = delete;
+
+        private:
+
+            std::atomic<uint32_t>* m_readers;
+        };
+
+        EpochReclaimer();
+
+        EpochReclaimer(const EpochReclaimer& other) = delete;
+        EpochReclaimer(EpochReclaimer&& other) noexcept = delete;
+        EpochReclaimer& operator=(const EpochReclaimer& other) = delete;
+        EpochReclaimer& operator=(EpochReclaimer&& other) noexcept = delete;
+
+        // values retired after it stay alive until the guard is gone, pins may be nested
+        Guard pin() const noexcept;
+
+        // list - values linked by Link, already unreachable for new readers
+        // dispose(T*) for every value nobody can read any more, of this list or of earlier ones
+        template<class Disposer>
+        void retire(T* list, Disposer dispose) noexcept;
+
+        // dispose(T*) for all retired values at once, nobody may be pinned
+        template<class Disposer>
+        void reclaim(Disposer dispose) noexcept;
+
+        // forgets all retired values, for the owner that frees their memory by itself
+        void clear() noexcept;
+
+        // values waiting for their epoch
+        size_t pending() const noexcept;
+
+    private:
+
+        // readers pinned at even/odd epochs
+        struct alignas(64) Pins
+        {
+            std::atomic<uint32_t> m_readers[2];
+        };
+
+        // retired values by epoch % 3: older ones are always safe
+        struct alignas(64) Bin
+        {
+            SpinLock m_lock;
+
+            T* m_lists[3];
+
+            uint64_t m_epochs[3];
+
+            size_t m_counts[3];
+
+            // retired since the last try to advance the epoch
+            size_t m_fresh;
+        };
+
+    private:
+
+        static uint32_t slot() noexcept { return ThreadIndex() % s_slots; }
+
+        // the next epoch if nobody is pinned at the previous one, returns the current epoch
+        uint64_t advance() noexcept;
+
+        // moves lists of the bin safe at the epoch to safe, the bin is locked
+        static void collect(Bin& bin, uint64_t epoch, T* (&safe)[3]) noexcept;
+
+        template<class Disposer>
+        static void dispose_list(T* list, Disposer& dispose) noexcept;
+
+    private:
+
+        static constexpr uint32_t s_slots = 64;
+
+        // values retired to a bin between tries to advance the epoch
+        static constexpr size_t s_batch = 64;
+
+        std::atomic<uint64_t> m_epoch;
+
+        // the next bin to sweep
+        std::atomic<uint32_t> m_sweep;
+
+        std::unique_ptr<Pins[]> m_pins;
+
+        std::unique_ptr<Bin[]> m_bins;
+    };
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    EpochReclaimer<T, Link>::EpochReclaimer()
+      : m_epoch(0),
+        m_sweep(0),
+        m_pins(new Pins[s_slots]),
+        m_bins(new Bin[s_slots])
+    {
+        for (uint32_t i = 0; i < s_slots; ++i)
+        {
+            m_pins[i].m_readers[0].store(0, std::memory_order_relaxed);
+            m_pins[i].m_readers[1].store(0, std::memory_order_relaxed);
+
+            Bin& bin = m_bins[i];
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                bin.m_lists[j] = nullptr;
+                bin.m_epochs[j] = 0;
+                bin.m_counts[j] = 0;
+            }
+            bin.m_fresh = 0;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    typename EpochReclaimer<T, Link>::Guard EpochReclaimer<T, Link>::pin() const noexcept
+    {
+        std::atomic<uint32_t>* const readers = m_pins[slot()].m_readers;
+        while (true)
+        {
+            const uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+            readers[epoch & 1].fetch_add(1, std::memory_order_seq_cst);
+
+            // the pin could get visible after the epoch was advanced past it
+            if (epoch == m_epoch.load(std::memory_order_seq_cst))
+                return Guard(&readers[epoch & 1]);
+
+            readers[epoch & 1].fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    template<class Disposer>
+    void EpochReclaimer<T, Link>::retire(T* list, Disposer dispose) noexcept
+    {
+        if (nullptr == list)
+            return;
+
+        T* last = list;
+        size_t count = 1;
+        for (; nullptr != last->*Link; last = last->*Link)
+            ++count;
+
+        // unlinks are ordered before the epoch the values are tagged with
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        T* safe[3] = {nullptr, nullptr, nullptr};
+
+        Bin& bin = m_bins[slot()];
+        bin.m_lock.lock();
+
+        // loaded under the lock, so epochs of the bin only grow
+        uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+        const uint32_t index = epoch % 3;
+        if (epoch != bin.m_epochs[index])
+        {
+            // 3 epochs ago or earlier
+            safe[index] = bin.m_lists[index];
+            bin.m_lists[index] = nullptr;
+            bin.m_epochs[index] = epoch;
+            bin.m_counts[index] = 0;
+        }
+
+        // readers may still load the link of an unlinked value
+        __atomic_store(&(last->*Link), &bin.m_lists[index], __ATOMIC_RELAXED);
+        bin.m_lists[index] = list;
+        bin.m_counts[index] += count;
+
+        bin.m_fresh += count;
+        if (s_batch > bin.m_fresh)
+        {
+            bin.m_lock.unlock();
+
+            dispose_list(safe[index], dispose);
+            return;
+        }
+
+        bin.m_fresh = 0;
+        epoch = advance();
+        collect(bin, epoch, safe);
+
+        bin.m_lock.unlock();
+
+        for (T* safe_list : safe)
+            dispose_list(safe_list, dispose);
+
+        Bin& other = m_bins[m_sweep.fetch_add(1, std::memory_order_relaxed) % s_slots];
+        if (&other == &bin || !other.m_lock.try_lock())
+            return;
+
+        T* other_safe[3] = {nullptr, nullptr, nullptr};
+        collect(other, epoch, other_safe);
+
+        other.m_lock.unlock();
+
+        for (T* safe_list : other_safe)
+            dispose_list(safe_list, dispose);
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    template<class Disposer>
+    void EpochReclaimer<T, Link>::reclaim(Disposer dispose) noexcept
+    {
+        for (uint32_t i = 0; i < s_slots; ++i)
+        {
+            Bin& bin = m_bins[i];
+            T* lists[3];
+
+            bin.m_lock.lock();
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                lists[j] = bin.m_lists[j];
+                bin.m_lists[j] = nullptr;
+                bin.m_counts[j] = 0;
+            }
+            bin.m_fresh = 0;
+            bin.m_lock.unlock();
+
+            for (T* list : lists)
+                dispose_list(list, dispose);
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    void EpochReclaimer<T, Link>::clear() noexcept
+    {
+        // the values may be gone already
+        for (uint32_t i = 0; i < s_slots; ++i)
+        {
+            Bin& bin = m_bins[i];
+
+            bin.m_lock.lock();
+            for (uint32_t j = 0; j < 3; ++j)
+            {
+                bin.m_lists[j] = nullptr;
+                bin.m_counts[j] = 0;
+            }
+            bin.m_fresh = 0;
+            bin.m_lock.unlock();
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    size_t EpochReclaimer<T, Link>::pending() const noexcept
+    {
+        size_t res = 0;
+        for (uint32_t i = 0; i < s_slots; ++i)
+        {
+            Bin& bin = m_bins[i];
+
+            bin.m_lock.lock();
+            res += bin.m_counts[0] + bin.m_counts[1] + bin.m_counts[2];
+            bin.m_lock.unlock();
+        }
+
+        return res;
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    uint64_t EpochReclaimer<T, Link>::advance() noexcept
+    {
+        uint64_t epoch = m_epoch.load(std::memory_order_seq_cst);
+
+        // readers of the previous epoch have the parity of the next one
+        const uint32_t parity = (epoch + 1) & 1;
+        for (uint32_t i = 0; i < s_slots; ++i)
+        {
+            if (0 != m_pins[i].m_readers[parity].load(std::memory_order_seq_cst))
+                return epoch;
+        }
+
+        // failure loads the epoch advanced by somebody else
+        if (m_epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst))
+            ++epoch;
+
+        return epoch;
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    void EpochReclaimer<T, Link>::collect(Bin& bin, uint64_t epoch, T* (&safe)[3]) noexcept
+    {
+        for (uint32_t i = 0; i < 3; ++i)
+        {
+            if (nullptr != bin.m_lists[i] && bin.m_epochs[i] + 2 <= epoch)
+            {
+                safe[i] = bin.m_lists[i];
+                bin.m_lists[i] = nullptr;
+                bin.m_counts[i] = 0;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, T* T::*Link>
+    template<class Disposer>
+    void EpochReclaimer<T, Link>::dispose_list(T* list, Disposer& dispose) noexcept
+    {
+        while (nullptr != list)
+        {
+            T* const next = list->*Link;
+            dispose(list);
+            list = next;
+        }
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "stdint.h"
+#include <cassert>
+#include <vector>
+#include "nonoderbtree.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // Immutable point-in-time view of a tree (RBTree::freeze()): sorted keys and values
+    // in two arrays. No locks: any number of readers, the source tree changes independently.
+    // Search is a branchless binary search with prefetch of both next probes,
+    // the last s_block keys are counted by a plain loop (vectorized for arithmetic keys).
+    // Positions are indexes of the arrays, size() - past the end.
+    template<class K, class V>
+    class FrozenRBTree
+    {
+    public:
+
+        FrozenRBTree() = default;
+
+        // keys must be strictly increasing, keys.size() == values.size()
+        FrozenRBTree(std::vector<K>&& keys, std::vector<V>&& values) noexcept
+          : m_keys(std::move(keys)),
+            m_values(std::move(values))
+        {
+            assert(m_keys.size() == m_values.size());
+        }
+
+        FrozenRBTree(const FrozenRBTree& other) = delete;
+        FrozenRBTree(FrozenRBTree&& other) noexcept = default;
+        FrozenRBTree& operator=(const FrozenRBTree& other) = delete;
+        FrozenRBTree& operator=(FrozenRBTree&& other) noexcept = default;
+
+        // nullptr if there is no such key
+        const V* find(const K& key) const noexcept;
+
+        bool contains(const K& key) const noexcept { return nullptr != find(key); }
+
+        size_t count(const K& key) const noexcept { return contains(key) ? 1 : 0; }
+
+        // first position with key not less than the key
+        size_t lower_bound(const K& key) const noexcept;
+
+        // first position with key greater than the key
+        size_t upper_bound(const K& key) const noexcept;
+
+        const K& key(size_t pos) const noexcept { return m_keys[pos]; }
+
+        const V& value(size_t pos) const noexcept { return m_values[pos]; }
+
+        // visitor(const K&, const V&) in key order
+        template<class Visitor>
+        void for_each(Visitor visitor) const;
+
+        // visitor(const K&, const V&) for keys in [first, last)
+        template<class Visitor>
+        void for_each_range(const K& first, const K& last, Visitor visitor) const;
+
+        size_t size() const noexcept { return m_keys.size(); }
+
+        bool empty() const noexcept { return m_keys.empty(); }
+
+    private:
+
+        // first position where is_less(key at it, key) is false
+        template<class Less>
+        size_t search(const K& key, Less is_less) const noexcept;
+
+    private:
+
+        // keys left for the final count
+        static constexpr size_t s_block = 16;
+
+        std::vector<K> m_keys;
+
+        std::vector<V> m_values;
+    };
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    const V* FrozenRBTree<K, V>::find(const K& key) const noexcept
+    {
+        const size_t pos = lower_bound(key);
+        if (m_keys.size() == pos || key < m_keys[pos])
+            return nullptr;
+
+        return &m_values[pos];
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    size_t FrozenRBTree<K, V>::lower_bound(const K& key) const noexcept
+    {
+        return search(key, [](const K& one, const K& other) { return one < other; });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    size_t FrozenRBTree<K, V>::upper_bound(const K& key) const noexcept
+    {
+        return search(key, [](const K& one, const K& other) { return !(other < one); });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    template<class Visitor>
+    void FrozenRBTree<K, V>::for_each(Visitor visitor) const
+    {
+        for (size_t pos = 0; pos < m_keys.size(); ++pos)
+            visitor(m_keys[pos], m_values[pos]);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    template<class Visitor>
+    void FrozenRBTree<K, V>::for_each_range(const K& first, const K& last, Visitor visitor) const
+    {
+        for (size_t pos = lower_bound(first); pos < m_keys.size() && m_keys[pos] < last; ++pos)
+            visitor(m_keys[pos], m_values[pos]);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V>
+    template<class Less>
+    size_t FrozenRBTree<K, V>::search(const K& key, Less is_less) const noexcept
+    {
+        // the answer is always in [base, base + size]
+        const K* base = m_keys.data();
+        size_t size = m_keys.size();
+        while (s_block < size)
+        {
+            const size_t half = size / 2;
+            const size_t rest = size - half;
+            prefetch(base + rest / 2);
+            prefetch(base + half + rest / 2);
+
+            base = is_less(base[half], key) ? base + half : base;
+            size = rest;
+        }
+
+        size_t pos = base - m_keys.data();
+        for (size_t i = 0; i < size; ++i)
+            pos += is_less(base[i], key);
+
+        return pos;
+    }
+}
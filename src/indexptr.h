@@ -0,0 +1,155 @@
+#pragma once
+
+#include "stdint.h"
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // 32-bit link to a value of IndexPool<T, Tag>, for T* in NoNodeRBTree<K, IndexPtr<T>>:
+    // three links take 12 bytes instead of 24.
+    // raw: 0bOOO...OOOXXX
+    // O - byte offset of the value in the pool: index * sizeof(T), index 0 - nullptr
+    // X - bits for the tree (color), as the low bits of an aligned pointer,
+    //     zero in offset as sizeof(T) is multiple of 8
+    // Offset saves shift/multiply on every dereference, pool is limited to 4GB.
+    // Links don't depend on the pool address, moved (mmap-ed) pool needs only attach().
+    template<class T, class Tag = void>
+    class IndexPtr
+    {
+    public:
+
+        using element_type = T;
+
+        IndexPtr() noexcept
+          : m_raw(0)
+        { }
+
+        IndexPtr(std::nullptr_t) noexcept
+          : m_raw(0)
+        { }
+
+        // (V)((size_t)ptr | 1) of the tree
+        explicit IndexPtr(size_t raw) noexcept
+          : m_raw((uint32_t)raw)
+        {
+            assert(raw <= UINT32_MAX);
+        }
+
+        explicit operator size_t() const noexcept { return m_raw; }
+
+        static IndexPtr from_index(uint32_t index) noexcept
+        {
+            static_assert(0 == sizeof(T) % (1 << s_tag_bits), "value size must be multiple of 8");
+            assert(index <= max_index());
+            return IndexPtr((size_t)index * sizeof(T));
+        }
+
+        uint32_t index() const noexcept { return m_raw / sizeof(T); }
+
+        // raw is never tagged here, the tree dereferences pure() links only
+        T* get() const noexcept { return reinterpret_cast<T*>(reinterpret_cast<char*>(s_base) + m_raw); }
+
+        T& operator*() const noexcept { return *get(); }
+        T* operator->() const noexcept { return get(); }
+
+        friend bool operator==(const IndexPtr& one, const IndexPtr& other) noexcept { return one.m_raw == other.m_raw; }
+        friend bool operator!=(const IndexPtr& one, const IndexPtr& other) noexcept { return one.m_raw != other.m_raw; }
+
+        // values of the pool are at base[1, capacity]
+        static void attach(T* base) noexcept { s_base = base; }
+
+        static T* base() noexcept { return s_base; }
+
+        static constexpr uint32_t max_index() noexcept { return UINT32_MAX / sizeof(T); }
+
+    private:
+
+        static constexpr uint32_t s_tag_bits = 3;
+
+        static inline T* s_base = nullptr;
+
+        uint32_t m_raw;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // Contiguous storage for values linked by IndexPtr<T, Tag>.
+    // The pool attaches itself, so only one pool of (T, Tag) is alive at a time.
+    // Not thread safe, as the tree it's used with.
+    template<class T, class Tag = void>
+    class IndexPool
+    {
+    public:
+
+        using pointer = IndexPtr<T, Tag>;
+
+        explicit IndexPool(uint32_t capacity)
+          : m_values(),
+            m_capacity(capacity),
+            m_bump(0),
+            m_free()
+        {
+            if (pointer::max_index() < capacity)
+                throw std::length_error("IndexPool capacity");
+
+            // index 0 is nullptr
+            m_values.reset(new T[(size_t)capacity + 1]);
+            m_free.reserve(capacity);
+            pointer::attach(m_values.get());
+        }
+
+        ~IndexPool()
+        {
+            if (pointer::base() == m_values.get())
+                pointer::attach(nullptr);
+        }
+
+        IndexPool(const IndexPool& other) = delete;
+        IndexPool(IndexPool&& other) noexcept = delete;
+        IndexPool& operator=(const IndexPool& other) = delete;
+        IndexPool& operator=(IndexPool&& other) noexcept = delete;
+
+        // nullptr if the pool is full
+        pointer allocate() noexcept
+        {
+            if (!m_free.empty())
+            {
+                const uint32_t index = m_free.back();
+                m_free.pop_back();
+                return pointer::from_index(index);
+            }
+
+            if (m_capacity == m_bump)
+                return nullptr;
+
+            return pointer::from_index(++m_bump);
+        }
+
+        void deallocate(pointer ptr) noexcept
+        {
+            assert(nullptr != ptr);
+
+            // never reallocates, reserved
+            m_free.push_back(ptr.index());
+        }
+
+        uint32_t capacity() const noexcept { return m_capacity; }
+
+    private:
+
+        std::unique_ptr<T[]> m_values;
+
+        uint32_t m_capacity;
+
+        // last index given out by the bump
+        uint32_t m_bump;
+
+        std::vector<uint32_t> m_free;
+    };
+}
@@ -0,0 +1,442 @@
+#pragma once
+
+#include "stdint.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
+
+#if defined(__SANITIZE_THREAD__)
+#define RBTREE_TSAN 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define RBTREE_TSAN 1
+#endif
+#endif
+
+#ifdef RBTREE_TSAN
+extern "C" void AnnotateIgnoreReadsBegin(const char* file, int line);
+extern "C" void AnnotateIgnoreReadsEnd(const char* file, int line);
+#endif
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    inline void cpu_relax() noexcept
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+
+    //////////////////////////////////////////////////////////////////
+
+    class SpinWait
+    {
+    public:
+        inline void wait() noexcept
+        {
+            // give the cpu away if owner is preempted
+            if (m_count < s_spins)
+            {
+                ++m_count;
+                cpu_relax();
+            }
+            else
+            {
+                std::this_thread::yield();
+            }
+        }
+
+    private:
+
+        static constexpr uint32_t s_spins = 64;
+
+        uint32_t m_count = 0;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // small dense per-thread number, for per-thread slots
+    inline uint32_t ThreadIndex() noexcept
+    {
+        static std::atomic<uint32_t> s_counter(0);
+        thread_local const uint32_t index = s_counter.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    //////////////////////////////////////////////////////////////////
+
+    struct FakeLock
+    {
+        inline void lock() { };
+        inline void unlock() { };
+
+        inline void lock_shared() { };
+        inline void unlock_shared() { };
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    class SpinLock
+    {
+    public:
+        SpinLock()
+          : m_locked(false)
+        { }
+
+        SpinLock(const SpinLock& other) = delete;
+        SpinLock(SpinLock&& other) noexcept = delete;
+        SpinLock& operator=(const SpinLock& other) = delete;
+        SpinLock& operator=(SpinLock&& other) noexcept = delete;
+
+        inline void lock() noexcept
+        {
+            SpinWait spin;
+            while (m_locked.exchange(true, std::memory_order_acquire))
+            {
+                while (m_locked.load(std::memory_order_relaxed))
+                    spin.wait();
+            }
+        }
+
+        inline bool try_lock() noexcept
+        {
+            return !m_locked.load(std::memory_order_relaxed) &&
+                !m_locked.exchange(true, std::memory_order_acquire);
+        }
+
+        inline void unlock() noexcept
+        {
+            m_locked.store(false, std::memory_order_release);
+        }
+
+    private:
+
+        std::atomic<bool> m_locked;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // state: 0bRRR...RRPW
+    // W - writer holds the lock
+    // P - writer is waiting, new readers stay out
+    // R - readers count
+    class SpinRWLock
+    {
+    public:
+        SpinRWLock()
+          : m_state(0)
+        { }
+
+        SpinRWLock(const SpinRWLock& other) = delete;
+        SpinRWLock(SpinRWLock&& other) noexcept = delete;
+        SpinRWLock& operator=(const SpinRWLock& other) = delete;
+        SpinRWLock& operator=(SpinRWLock&& other) noexcept = delete;
+
+        inline void lock() noexcept
+        {
+            SpinWait spin;
+            while (true)
+            {
+                uint32_t state = m_state.load(std::memory_order_relaxed);
+                if (0 == (state & ~s_pending))
+                {
+                    if (m_state.compare_exchange_weak(state, s_writer, std::memory_order_acquire))
+                        return;
+                }
+                else if (0 == (state & s_pending))
+                {
+                    m_state.fetch_or(s_pending, std::memory_order_relaxed);
+                }
+
+                spin.wait();
+            }
+        }
+
+        inline void unlock() noexcept
+        {
+            m_state.fetch_and(~s_writer, std::memory_order_release);
+        }
+
+        inline void lock_shared() noexcept
+        {
+            SpinWait spin;
+            while (true)
+            {
+                uint32_t state = m_state.load(std::memory_order_relaxed);
+                if (0 == (state & (s_writer | s_pending)))
+                {
+                    if (m_state.compare_exchange_weak(state, state + s_reader, std::memory_order_acquire))
+                        return;
+                }
+
+                spin.wait();
+            }
+        }
+
+        inline void unlock_shared() noexcept
+        {
+            m_state.fetch_sub(s_reader, std::memory_order_release);
+        }
+
+    private:
+
+        static constexpr uint32_t s_writer = 0b01;
+        static constexpr uint32_t s_pending = 0b10;
+        static constexpr uint32_t s_reader = 0b100;
+
+        std::atomic<uint32_t> m_state;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // Racy reads between read_begin() and read_retry() race with writers by design,
+    // ThreadSanitizer is told to skip them.
+    inline void racy_reads_begin() noexcept
+    {
+#ifdef RBTREE_TSAN
+        AnnotateIgnoreReadsBegin(__FILE__, __LINE__);
+#endif
+    }
+
+    inline void racy_reads_end() noexcept
+    {
+#ifdef RBTREE_TSAN
+        AnnotateIgnoreReadsEnd(__FILE__, __LINE__);
+#endif
+    }
+
+    //////////////////////////////////////////////////////////////////
+
+    // Writers are serialized and make m_version odd while they work.
+    // Readers don't write shared memory at all:
+    //     version = read_begin(); <racy reads>; if (read_retry(version)) repeat
+    // lock_shared() excludes writers without touching m_version, for readers that
+    // can't be optimistic (iteration, bounds); such readers don't exclude each other.
+    class SeqLock
+    {
+    public:
+        SeqLock()
+          : m_version(0),
+            m_writer()
+        { }
+
+        SeqLock(const SeqLock& other) = delete;
+        SeqLock(SeqLock&& other) noexcept = delete;
+        SeqLock& operator=(const SeqLock& other) = delete;
+        SeqLock& operator=(SeqLock&& other) noexcept = delete;
+
+        inline void lock() noexcept
+        {
+            m_writer.lock();
+
+            m_version.store(m_version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        inline void unlock() noexcept
+        {
+            m_version.store(m_version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+
+            m_writer.unlock();
+        }
+
+        inline void lock_shared() noexcept
+        {
+            m_writer.lock_shared();
+        }
+
+        inline void unlock_shared() noexcept
+        {
+            m_writer.unlock_shared();
+        }
+
+        inline uint64_t read_begin() const noexcept
+        {
+            SpinWait spin;
+            while (true)
+            {
+                const uint64_t version = m_version.load(std::memory_order_acquire);
+                if (0 == (version & 1))
+                    return version;
+
+                spin.wait();
+            }
+        }
+
+        inline bool read_retry(uint64_t version) const noexcept
+        {
+            std::atomic_thread_fence(std::memory_order_acquire);
+            return version != m_version.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        std::atomic<uint64_t> m_version;
+
+        SpinRWLock m_writer;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // Flat combining: a writer publishes its request to the slot of its thread
+    // and the one that gets the lock runs all published requests in one pass,
+    // the others only wait for their m_is_done instead of handing the lock over.
+    // Request - struct with std::atomic<bool> m_is_done, the same for all users of the lock.
+    // IsSorted - the combiner sorts a pass by keys (RBTree), for descents close to each other.
+    // lock()/unlock() serialize with passes as an ordinary lock.
+    template<bool IsSorted = true>
+    class FlatCombiningLock
+    {
+    public:
+        static constexpr bool s_is_sorted = IsSorted;
+
+        FlatCombiningLock()
+          : m_lock(),
+            m_nslots(0),
+            m_slots(new Slot[s_slots])
+        {
+            for (uint32_t i = 0; i < s_slots; ++i)
+                m_slots[i].m_request.store(nullptr, std::memory_order_relaxed);
+        }
+
+        FlatCombiningLock(const FlatCombiningLock& other) = delete;
+        FlatCombiningLock(FlatCombiningLock&& other) noexcept = delete;
+        FlatCombiningLock& operator=(const FlatCombiningLock& other) = delete;
+        FlatCombiningLock& operator=(FlatCombiningLock&& other) noexcept = delete;
+
+        inline void lock() noexcept { m_lock.lock(); }
+
+        inline bool try_lock() noexcept { return m_lock.try_lock(); }
+
+        inline void unlock() noexcept { m_lock.unlock(); }
+
+        // combine(Request** requests, size_t count) runs requests under the lock,
+        // request is done when it returns
+        template<class Request, class Combine>
+        void execute(Request* request, Combine combine) noexcept;
+
+    private:
+
+        struct alignas(64) Slot
+        {
+            std::atomic<void*> m_request;
+        };
+
+        // takes published requests and own (may be nullptr), the lock is held
+        template<class Request, class Combine>
+        void run(Request* own, Combine& combine) noexcept;
+
+    private:
+
+        static constexpr uint32_t s_slots = 64;
+
+        SpinLock m_lock;
+
+        // slots in use are below it
+        std::atomic<uint32_t> m_nslots;
+
+        std::unique_ptr<Slot[]> m_slots;
+    };
+
+    //--------------------------------------------------------------//
+    template<bool IsSorted>
+    template<class Request, class Combine>
+    void FlatCombiningLock<IsSorted>::execute(Request* request, Combine combine) noexcept
+    {
+        request->m_is_done.store(false, std::memory_order_relaxed);
+
+        const uint32_t index = ThreadIndex() % s_slots;
+        uint32_t nslots = m_nslots.load(std::memory_order_relaxed);
+        while (nslots <= index &&
+               !m_nslots.compare_exchange_weak(nslots, index + 1, std::memory_order_relaxed))
+        { }
+
+        // the slot may be busy with another thread of it
+        void* expected = nullptr;
+        if (!m_slots[index].m_request.compare_exchange_strong(expected, request,
+                std::memory_order_release, std::memory_order_relaxed))
+        {
+            m_lock.lock();
+            run(request, combine);
+            m_lock.unlock();
+            return;
+        }
+
+        SpinWait spin;
+        while (!request->m_is_done.load(std::memory_order_acquire))
+        {
+            if (m_lock.try_lock())
+            {
+                // taken by this pass or done by the previous one before its unlock
+                run<Request>(nullptr, combine);
+                m_lock.unlock();
+                return;
+            }
+
+            spin.wait();
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<bool IsSorted>
+    template<class Request, class Combine>
+    void FlatCombiningLock<IsSorted>::run(Request* own, Combine& combine) noexcept
+    {
+        Request* requests[s_slots + 1];
+        size_t count = 0;
+        if (nullptr != own)
+            requests[count++] = own;
+
+        // only the holder of the lock empties slots
+        const uint32_t nslots = m_nslots.load(std::memory_order_relaxed);
+        for (uint32_t i = 0; i < nslots; ++i)
+        {
+            void* const request = m_slots[i].m_request.load(std::memory_order_acquire);
+            if (nullptr == request)
+                continue;
+
+            m_slots[i].m_request.store(nullptr, std::memory_order_relaxed);
+            requests[count++] = static_cast<Request*>(request);
+        }
+
+        if (0 != count)
+            combine(requests, count);
+
+        // a request may be gone as soon as it is done
+        for (size_t i = 0; i < count; ++i)
+            requests[i]->m_is_done.store(true, std::memory_order_release);
+    }
+
+    //////////////////////////////////////////////////////////////////
+
+    // Lock with lock_shared()/unlock_shared() (std::shared_mutex, SpinRWLock)
+    template<class L, class = void>
+    struct IsSharedLock : std::false_type { };
+
+    template<class L>
+    struct IsSharedLock<L, std::void_t<
+        decltype(std::declval<L&>().lock_shared()),
+        decltype(std::declval<L&>().unlock_shared())>> : std::true_type { };
+
+    // Lock with lock-free optimistic readers (SeqLock)
+    template<class L, class = void>
+    struct IsOptimisticLock : std::false_type { };
+
+    template<class L>
+    struct IsOptimisticLock<L, std::void_t<
+        decltype(std::declval<const L&>().read_begin()),
+        decltype(std::declval<const L&>().read_retry(uint64_t{}))>> : std::true_type { };
+
+    // Lock running writes by flat combining (FlatCombiningLock)
+    template<class L, class = void>
+    struct IsCombiningLock : std::false_type { };
+
+    template<class L>
+    struct IsCombiningLock<L, std::void_t<
+        decltype(L::s_is_sorted)>> : std::true_type { };
+}
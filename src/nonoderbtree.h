@@ -1,23 +1,71 @@
 #pragma once
 
 #include "stdint.h"
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <memory>
 #include <queue>
 
 namespace RBTree
 {
+    // threadpool.h
+    class ThreadPool;
+
+    //////////////////////////////////////////////////////////////////
+
+    inline void prefetch(const void* ptr) noexcept
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(ptr);
+#else
+        (void)ptr;
+#endif
+    }
+
+    //////////////////////////////////////////////////////////////////
+
+    // value with size_t m_count field - tree keeps subtree sizes there
+    template<class T, class = void>
+    struct HasCount : std::false_type { };
+
+    template<class T>
+    struct HasCount<T, std::void_t<decltype(std::declval<T&>().m_count)>> : std::true_type { };
+
+    // summary of the subtree (interval max, sum, ...) kept in the value itself:
+    // A()(node) recomputes node's fields from node->m_left and node->m_right summaries,
+    // children are always up to date when it's called. See augment.h.
+    struct NoAugment
+    {
+        template<class V>
+        inline void operator()(V node) const noexcept { (void)node; }
+    };
+
     //////////////////////////////////////////////////////////////////
-    template<class K, class V>
+    template<class K, class V, class Augment = NoAugment>
     class NoNodeRBTree
     {
         // ptr: 0bXXXXX...XXXY
         // Y - color (0 - black, 1 - red)
+        // V - pointer or 32-bit IndexPtr (indexptr.h), both cast to size_t and back
 
         using value_t = V;
-        static_assert(std::is_pointer<V>(), "");
+        static_assert(std::is_pointer<V>() || sizeof(V) <= sizeof(size_t), "");
+
+        // order statistics: rank(), select(), count_range()
+        static constexpr bool s_is_counted = HasCount<typename std::pointer_traits<V>::element_type>::value;
+
+        static constexpr bool s_is_augmented = s_is_counted || !std::is_same<Augment, NoAugment>();
 
     public:
 
-        class iterator;
+        template<bool Reverse>
+        class basic_iterator;
+
+        using iterator = basic_iterator<false>;
+
+        // walks from back() to front(), *it is the value it points to
+        using reverse_iterator = basic_iterator<true>;
 
         NoNodeRBTree();
 
@@ -26,61 +74,244 @@ namespace RBTree
         NoNodeRBTree& operator=(const NoNodeRBTree& other) = delete;
         NoNodeRBTree& operator=(NoNodeRBTree&& other) noexcept = delete;
 
-        iterator find(const K& key) noexcept;
+        iterator find(const K& key) const noexcept;
+
+        // descent from the hint as insert(hint, value), for keys close to each other
+        iterator find(iterator hint, const K& key) const noexcept;
+
+        // out[i] = value with key *(first + i), nullptr if there is none
+        // s_lanes descents go in lockstep, so their cache misses overlap
+        template<class It, class Out>
+        void find_batch(It first, It last, Out out) const noexcept;
+
+        bool contains(const K& key) const noexcept;
+
+        size_t count(const K& key) const noexcept;
+
+        iterator lower_bound(const K& key) const noexcept;
+
+        iterator upper_bound(const K& key) const noexcept;
+
+        std::pair<iterator, iterator> equal_range(const K& key) const noexcept;
+
+        // find that tolerates concurrent writer (seqlock readers)
+        // false - descent gave up, result is garbage anyway
+        // result is valid only if the writer didn't run meanwhile
+        bool find_optimistic(const K& key, iterator& result) const noexcept;
 
         std::pair<iterator, bool> emplace(const K& key, V value);
 
         std::pair<iterator, bool> insert(V value) noexcept;
 
+        // hint - position just after (as std::map) or just before the value
+        // O(1) rebalancing aside if hint is right, descent from the hint otherwise
+        // returns iterator to the value or to the node with the same key
+        iterator insert(iterator hint, V value) noexcept;
+
+        // values sorted by key, each descent starts from the previous insertion point (finger)
+        // reject(V) for values with key already in the tree
+        // returns number of inserted values
+        template<class It, class Reject>
+        size_t insert_batch(It first, It last, Reject reject) noexcept;
+
         size_t erase(const K& key) noexcept;
 
+        // sorted keys, finger descent as insert_batch
+        // disposer(V) for every erased value, returns their number
+        template<class It, class Disposer>
+        size_t erase_batch(It first, It last, Disposer disposer) noexcept;
+
         iterator erase(iterator iter) noexcept;
 
+        // min/max, end() for empty tree, O(1)
+        iterator front() const noexcept { return iterator(this, m_leftmost); }
+        iterator back() const noexcept { return iterator(this, m_rightmost); }
+
+        // unlinks min/max value and returns it, nullptr for empty tree
+        V pop_front() noexcept;
+        V pop_back() noexcept;
+
+        // for values with m_count, O(log n)
+        // number of keys less than key
+        size_t rank(const K& key) const noexcept;
+
+        // k-th key (from 0), end() if k >= size()
+        iterator select(size_t k) const noexcept;
+
+        // number of keys in [first, last)
+        size_t count_range(const K& first, const K& last) const noexcept;
+
+        // visitor(V) for every value in key order, faster than iterator:
+        // right subtrees are prefetched as soon as their parents are reached
+        template<class Visitor>
+        void for_each(Visitor visitor) const;
+
+        // visitor(V) for values with keys in [first, last)
+        template<class Visitor>
+        void for_each_range(const K& first, const K& last, Visitor visitor) const;
+
         void clear() noexcept;
 
         void clearWithDestruct() noexcept;
 
+        // disposer(V) for every node, children first
+        template<class Disposer>
+        void clearWithDispose(Disposer disposer) noexcept;
+
         size_t size() const noexcept;
 
+        // for queries over augmented subtrees (augment.h)
+        V root() const noexcept { return m_root; }
+
+        // takes values already linked into a valid tree (mapped image, treeimage.h) as is
+        // previous content is dropped as by clear()
+        void adopt(V root, size_t size) noexcept;
+
+        // visitor(V) in van Emde Boas order of the tree shape: the top half of the levels,
+        // then every subtree under it the same way, so a descent stays within few blocks
+        template<class Visitor>
+        void for_each_veb(Visitor visitor) const;
+
+        // every value was copied with its links to [first, last) (copies or pointers to them)
+        // and got its copy address in m_left,
+        // links of the copies are turned to the copies, old values aren't used any more
+        template<class It>
+        void relocate(It first, It last) noexcept;
+
+        // links [first, last) values with strictly increasing keys into a balanced tree, O(n)
+        // previous content is dropped as by clear()
+        template<class It>
+        void build_from_sorted(It first, It last) noexcept;
+
+        // Join-based operations: a tree is cut along one descent path
+        // and the pieces are linked back at the height of the shorter one.
+
+        // unlinks values with keys in [first, last), disposer(V) for every one of them
+        // O(log n) plus the erased values, returns their number
+        template<class Disposer>
+        size_t erase_range(const K& first, const K& last, Disposer disposer) noexcept;
+
+        // moves values with keys not less than the key to the empty right tree,
+        // O(log n) with m_count, O(log n + min(k, n - k)) for parts of k and n - k values without it:
+        // sizes of the parts are taken from m_count or counted over the smaller part
+        void split(const K& key, NoNodeRBTree& right) noexcept;
+
+        // all keys of right are greater than the keys here: moves them to this tree, O(log n)
+        void join(NoNodeRBTree& right) noexcept;
+
+        // the same with the value between the trees
+        void join(V value, NoNodeRBTree& right) noexcept;
+
+        // Set algebra: the root of other splits this tree, both halves are processed
+        // the same way and joined back. O(m log(n / m + 1)) for sizes m <= n,
+        // so linear for similar trees and logarithmic per value for a small one.
+
+        // moves values of other here, other gets empty
+        // disposer(V) for values of other with keys already here, returns number of moved values
+        template<class Disposer>
+        size_t unite(NoNodeRBTree& other, Disposer disposer) noexcept;
+
+        // unlinks values with keys missing in other, disposer(V) for them, returns their number
+        template<class Disposer>
+        size_t intersect(const NoNodeRBTree& other, Disposer disposer) noexcept;
+
+        // unlinks values with keys present in other, disposer(V) for them, returns their number
+        template<class Disposer>
+        size_t subtract(const NoNodeRBTree& other, Disposer disposer) noexcept;
+
+        // Parallel bulk operations over ThreadPool (threadpool.h), defined in parallel.h:
+        // the top pool.fork_depth() levels are forked, the subtrees under them are processed
+        // as by the plain versions.
+
+        // as build_from_sorted(), random access iterators
+        template<class It>
+        void build_from_sorted(ThreadPool& pool, It first, It last) noexcept;
+
+        // visitor(V) from the pool threads at once, in key order within every forked subtree
+        // an exception of visitor comes out once the running forks are done, other values may be skipped
+        template<class Visitor>
+        void for_each(ThreadPool& pool, Visitor visitor) const;
+
+        // combine(combine(identity, map(V)), map(V)) ... over values in key order,
+        // combine must be associative and identity neutral for it; exceptions come out as of for_each()
+        template<class T, class Map, class Combine>
+        T reduce(ThreadPool& pool, T identity, Map map, Combine combine) const;
+
+        // disposer(V) from the pool threads at once, children first
+        template<class Disposer>
+        void clearWithDispose(ThreadPool& pool, Disposer disposer) noexcept;
+
+        void clearWithDestruct(ThreadPool& pool) noexcept;
+
+        // as unite(), both halves of every forked split are united at once,
+        // disposer(V) from the pool threads at once
+        template<class Disposer>
+        size_t unite(ThreadPool& pool, NoNodeRBTree& other, Disposer disposer) noexcept;
+
     public:
 
-        class iterator : public std::iterator<std::input_iterator_tag, V> {
-            friend class NoNodeRBTree<K, V>;
+        // bidirectional, --end() is the last value
+        template<bool Reverse>
+        class basic_iterator : public std::iterator<std::bidirectional_iterator_tag, V> {
+            friend class NoNodeRBTree<K, V, Augment>;
 
-            iterator(V node) : m_node(node) { }
+            basic_iterator(const NoNodeRBTree* tree, V node) : m_tree(tree), m_node(node) { }
 
         public:
 
-            iterator(const iterator& it) : m_node(it.m_node) { }
-            ~iterator() = default;
+            // singular, only to be assigned to
+            basic_iterator() : m_tree(nullptr), m_node(nullptr) { }
+            basic_iterator(const basic_iterator& it) : m_tree(it.m_tree), m_node(it.m_node) { }
+            ~basic_iterator() = default;
 
-            iterator& operator=(const iterator& it) { m_node = it.m_node; return *this; }
+            basic_iterator& operator=(const basic_iterator& it) { m_tree = it.m_tree; m_node = it.m_node; return *this; }
 
             const V& operator*() const noexcept { return m_node; }
             std::pair<K, V> operator*() { return std::pair<K, V>(m_node->m_key, m_node); }
             V operator->() const { return m_node; }
 
-            iterator& operator++() { m_node = next(m_node); return *this; }
-            iterator operator++(int) { iterator it(*this); ++(*this); return it; }
+            basic_iterator& operator++() { m_node = Reverse ? prev(m_node) : next(m_node); return *this; }
+            basic_iterator operator++(int) { basic_iterator it(*this); ++(*this); return it; }
+
+            basic_iterator& operator--()
+            {
+                if (nullptr == m_node)
+                    m_node = Reverse ? m_tree->m_leftmost : m_tree->m_rightmost;
+                else
+                    m_node = Reverse ? next(m_node) : prev(m_node);
+
+                return *this;
+            }
+            basic_iterator operator--(int) { basic_iterator it(*this); --(*this); return it; }
 
-            bool operator==(const iterator& other) const { return m_node == other.m_node; }
-            bool operator!=(const iterator& other) const { return m_node != other.m_node; }
+            bool operator==(const basic_iterator& other) const { return m_node == other.m_node; }
+            bool operator!=(const basic_iterator& other) const { return m_node != other.m_node; }
 
         private:
 
+            const NoNodeRBTree* m_tree;
+
             V m_node;
         };
 
         iterator begin() const
         {
-            if (nullptr == m_root)
-                return end();
-            return iterator(maxLeft(m_root));
+            return iterator(this, m_leftmost);
         }
 
         iterator end() const
         {
-            return iterator(nullptr);
+            return iterator(this, nullptr);
+        }
+
+        reverse_iterator rbegin() const
+        {
+            return reverse_iterator(this, m_rightmost);
+        }
+
+        reverse_iterator rend() const
+        {
+            return reverse_iterator(this, nullptr);
         }
 
     public:
@@ -91,10 +322,115 @@ namespace RBTree
 
         static V next(V node) noexcept;
 
+        static V prev(V node) noexcept;
+
         static inline V maxLeft(V node) noexcept;
 
+        static inline V maxRight(V node) noexcept;
+
+        // node with the key or leaf to link it to, from the node subtree
+        static inline V descend(V node, const K& key) noexcept;
+
+        // as descend(), but from any node of the tree
+        static V descend_from(V finger, const K& key) noexcept;
+
+        void insert_at(V node, V value) noexcept;
+
+        // node is red under red parent, rotation at the top changes the root
+        // true if black height of the root grew
+        static bool insert_repair(V& root, V parent, V node) noexcept;
+
+        static inline V load_link(const V& link) noexcept;
+
         static void erase_swap(V one, V other) noexcept;
 
+        // in-order walk from node up to the last key (nullptr - to the end)
+        template<class Visitor>
+        static void walk(V node, const K* last, Visitor& visitor);
+
+        static uint32_t height(V node) noexcept;
+
+        // top height levels of the node subtree in van Emde Boas order
+        template<class Visitor>
+        static void veb(V node, uint32_t height, Visitor& visitor);
+
+        // nodes depth levels under the node, from left to right
+        template<class Visitor>
+        static void at_depth(V node, uint32_t depth, Visitor& visitor);
+
+        template<class It>
+        static V build_subtree(It& it, size_t size, uint32_t depth, uint32_t red_depth) noexcept;
+
+        // links children built at depth + 1
+        static inline void link_children(V node, V left, V right, uint32_t depth, uint32_t red_depth) noexcept;
+
+        // depth of the lowest level of build_from_sorted(), it is made red
+        static uint32_t lowest_depth(size_t size) noexcept;
+
+        // parallel steps, last - key bound of the subtree (nullptr - to the end)
+
+        template<class It>
+        static V build_subtree(ThreadPool& pool, It first, size_t size, uint32_t depth, uint32_t red_depth,
+                               uint32_t fork_depth) noexcept;
+
+        template<class Visitor>
+        static void for_each_subtree(ThreadPool& pool, V node, const K* last, Visitor& visitor,
+                                     uint32_t fork_depth);
+
+        template<class T, class Map, class Combine>
+        static T reduce_subtree(ThreadPool& pool, V node, const K* last, const T& identity, Map& map,
+                                Combine& combine, uint32_t fork_depth);
+
+        template<class Disposer>
+        static void dispose(ThreadPool& pool, V node, Disposer& disposer, uint32_t fork_depth) noexcept;
+
+        // disposer(V) for every value of the subtree, children first, returns their number
+        template<class Disposer>
+        static size_t dispose(V root, Disposer& disposer) noexcept;
+
+    private:
+
+        // part of a tree with its black height (black nodes on a path down, root included)
+        struct Subtree
+        {
+            V m_root;
+
+            uint32_t m_height;
+        };
+
+        static uint32_t black_height(V root) noexcept;
+
+        // root becomes black and loses its parent
+        static inline Subtree detach(Subtree tree) noexcept;
+
+        // keys of left < value < keys of right
+        static Subtree join_subtrees(Subtree left, V value, Subtree right) noexcept;
+
+        // keys of left < keys of right
+        static Subtree concat(Subtree left, Subtree right) noexcept;
+
+        // left gets keys less than the key, right - greater ones
+        // returns unlinked value with the key, nullptr if there is none
+        static V split_subtree(Subtree tree, const K& key, Subtree& left, Subtree& right) noexcept;
+
+        // number of values of right, in lockstep with left: O(smaller part)
+        static size_t count_right(V left, V right, size_t size) noexcept;
+
+        // set algebra steps, other is split by its values, count - number of disposed values
+
+        template<class Disposer>
+        static Subtree unite_subtrees(Subtree tree, Subtree other, Disposer& disposer, size_t& count) noexcept;
+
+        template<class Disposer>
+        static Subtree unite_subtrees(ThreadPool& pool, Subtree tree, Subtree other, Disposer& disposer,
+                                      size_t& count, uint32_t fork_depth) noexcept;
+
+        template<class Disposer>
+        static Subtree intersect_subtrees(Subtree tree, V other, Disposer& disposer, size_t& count) noexcept;
+
+        template<class Disposer>
+        static Subtree subtract_subtrees(Subtree tree, V other, Disposer& disposer, size_t& count) noexcept;
+
     private:
 
         static V uncle(V const parent) noexcept;
@@ -107,6 +443,18 @@ namespace RBTree
 
         static inline bool isChildsBlack(V node);
 
+    private:
+
+        // subtree augmentation (m_count, Augment), no-op for plain values
+
+        static inline size_t subtree_count(V node) noexcept;
+
+        // node from its children
+        static inline void update(V node) noexcept;
+
+        // node and all its ancestors
+        static inline void propagate(V node) noexcept;
+
     private:
 
         static inline size_t color(V node);
@@ -125,22 +473,35 @@ namespace RBTree
 
         static inline void assert_pure(V ptr);
 
+    private:
+
+        // red-black tree height is less than 2 * log2(n + 1)
+        static constexpr uint32_t s_max_height = 2 * 64;
+
+        // descents in flight for find_batch
+        static constexpr uint32_t s_lanes = 16;
+
     private:
 
         V m_root;
 
+        // min and max nodes, nullptr for empty tree
+        V m_leftmost;
+
+        V m_rightmost;
+
         size_t m_size;
     };
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    NoNodeRBTree<K, V>::NoNodeRBTree()
-      : m_root(nullptr), m_size(0)
+    template<class K, class V, class A>
+    NoNodeRBTree<K, V, A>::NoNodeRBTree()
+      : m_root(nullptr), m_leftmost(nullptr), m_rightmost(nullptr), m_size(0)
     { }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    typename NoNodeRBTree<K, V>::iterator NoNodeRBTree<K, V>::find(const K& key) noexcept
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::iterator NoNodeRBTree<K, V, A>::find(const K& key) const noexcept
     {
         if (nullptr == m_root)
         {
@@ -178,176 +539,517 @@ namespace RBTree
             }
         }
 
-        return iterator(node);
+        return iterator(this, node);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    std::pair<typename NoNodeRBTree<K, V>::iterator, bool> NoNodeRBTree<K, V>::emplace(const K& key, V value)
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::iterator NoNodeRBTree<K, V, A>::find(iterator hint, const K& key) const noexcept
     {
-        // TODO: except
-        value->m_key = key;
+        if (nullptr == hint.m_node)
+            return find(key);
 
-        return insert(value);
+        V const node = descend_from(hint.m_node, key);
+
+        // TODO: except
+        return (key == node->m_key) ? iterator(this, node) : end();
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    std::pair<typename NoNodeRBTree<K, V>::iterator, bool> NoNodeRBTree<K, V>::insert(V const value) noexcept
+    template<class K, class V, class A>
+    template<class It, class Out>
+    void NoNodeRBTree<K, V, A>::find_batch(It first, It last, Out out) const noexcept
     {
-        const K& key = value->m_key;
-
-        if (nullptr == m_root)
-        {
-            m_root = value;
-            value->m_left = nullptr;
-            value->m_right = nullptr;
-            value->m_parent = nullptr;
-            ++m_size;
-            return std::pair<iterator, bool>(iterator(value), true);
-        }
-
-        V node = m_root;
-        while (true)
+        // Every lane makes one step and prefetches its next node for the next round.
+        // Finished lane takes the next key at once (AMAC), so lanes stay busy.
+        struct Lane
         {
-            // TODO: except
-            if (key == node->m_key)
-                return std::pair<iterator, bool>(iterator(node), false);
-
-            V const next = pure((key < node->m_key) ? node->m_left : node->m_right);
+            It m_key;
 
-            if (nullptr == next)
-                break;
-            else
-                node = next;
-        }
+            V m_node;
 
-        // TODO: except
-        if (key < node->m_key)
-            node->m_left = value;
-        else
-            node->m_right = value;
+            size_t m_index;
+        };
 
-        value->m_parent = red(node);
-        value->m_key = key;
-        value->m_left = nullptr;
-        value->m_right = nullptr;
-        ++m_size;
-        const iterator result_iterator = iterator(value);
+        Lane lanes[s_lanes];
+        uint32_t nlanes = 0;
+        size_t index = 0;
 
-        if (is_node_black(node))
+        if (nullptr == m_root)
         {
-            return std::pair<iterator, bool>(result_iterator, true);
+            for (; last != first; ++first)
+                out[index++] = nullptr;
+
+            return;
         }
 
-        // repair
-        V parent = node;
-        node = value;
+        for (; nlanes < s_lanes && last != first; ++first)
+            lanes[nlanes++] = Lane{first, m_root, index++};
 
-        // grandfather definitely exists and is black (parent is red)
-        V grandpa = pure(parent->m_parent);
-        V uncle = pure((pure(grandpa->m_left) == parent) ? grandpa->m_right : grandpa->m_left);
-        //while (is_ptr_red(uncle))
-        while ((nullptr != uncle) && is_node_red(uncle))
+        while (0 != nlanes)
         {
-            assert(nullptr != grandpa && is_node_black(grandpa));
-            parent->m_parent = grandpa; // black
-            uncle->m_parent = grandpa; // black
-
-            if (nullptr == grandpa->m_parent)
+            for (uint32_t i = 0; i < nlanes;)
             {
-                return std::pair<iterator, bool>(result_iterator, true);
-            }
+                Lane& lane = lanes[i];
+                const K& key = *lane.m_key;
+                V const node = lane.m_node;
 
-            V const grandgrandpa = pure(grandpa->m_parent);
-            grandpa->m_parent = red(grandgrandpa);
-
-            if (is_node_black(grandgrandpa))
-            {
-                return std::pair<iterator, bool>(result_iterator, true);
-            }
+                V result = node;
+                if (key != node->m_key)
+                {
+                    V const next = pure((key < node->m_key) ? node->m_left : node->m_right);
+                    if (nullptr != next)
+                    {
+                        prefetch(&*next);
+                        lane.m_node = next;
+                        ++i;
+                        continue;
+                    }
 
-            parent = grandgrandpa;
-            node = grandpa;
-            grandpa = pure(grandgrandpa->m_parent);
-            uncle = pure((pure(grandpa->m_left) == parent) ? grandpa->m_right : grandpa->m_left);
-        }
+                    result = nullptr;
+                }
 
-        // uncle is black
-        if (pure(parent->m_right) == node && pure(grandpa->m_left) == parent)
-        {
-            pred_rotate(parent, node, grandpa);
-            rotate_left(parent, node);
-            node->m_parent = red(node->m_parent);
-            //parent->m_parent = red(parent->m_parent);
-            std::swap(parent, node);
-        }
-        else if (pure(parent->m_left) == node && pure(grandpa->m_right) == parent)
-        {
-            pred_rotate(parent, node, grandpa);
-            rotate_right(parent, node);
-            node->m_parent = red(node->m_parent);
-            //parent->m_parent = red(parent->m_parent);
-            std::swap(parent, node);
-        }
+                out[lane.m_index] = result;
 
-        // case 5 (cascade)
-        //pred_rotate(grandpa, parent, grandgrandpa);
-        {
-            assert(is_node_black(grandpa));
-            V const grandgrandpa = grandpa->m_parent; // pure (black)
-            parent->m_parent = grandgrandpa;
-            if (nullptr != grandgrandpa)
-            {
-                if (pure(grandgrandpa->m_left) == grandpa)
-                    grandgrandpa->m_left = parent;
+                if (last != first)
+                {
+                    lane = Lane{first, m_root, index++};
+                    ++first;
+                    ++i;
+                }
                 else
-                    grandgrandpa->m_right = parent;
-            }
-            else
-            {
-                assert(grandpa == m_root);
-                m_root = parent;
+                {
+                    lane = lanes[--nlanes];
+                }
             }
         }
-        if (pure(parent->m_left) == node) // && pure(grandpa->m_left) == parent)
-        {
-            rotate_right(grandpa, parent);
-        }
-        else // pure(parent->m_right) == node) && pure(grandpa->m_right) == parent)
-        {
-            rotate_left(grandpa, parent);
-        }
+    }
 
-        return std::pair<iterator, bool>(result_iterator, true);
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    bool NoNodeRBTree<K, V, A>::contains(const K& key) const noexcept
+    {
+        return end() != find(key);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    size_t NoNodeRBTree<K, V>::erase(const K& key) noexcept
+    template<class K, class V, class A>
+    size_t NoNodeRBTree<K, V, A>::count(const K& key) const noexcept
     {
-        iterator iter = find(key);
-        if (nullptr == iter.m_node)
-            return 0;
+        return contains(key) ? 1 : 0;
+    }
 
-        assert(iter.m_node->m_key == key);
-        erase(iter);
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::iterator NoNodeRBTree<K, V, A>::lower_bound(const K& key) const noexcept
+    {
+        // TODO: except
+        V result = nullptr;
+        V node = m_root;
+        while (nullptr != node)
+        {
+            const bool is_less = (node->m_key < key);
+            result = is_less ? result : node;
+            node = pure(is_less ? node->m_right : node->m_left);
+        }
 
-        return 1;
+        return iterator(this, result);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    typename NoNodeRBTree<K, V>::iterator NoNodeRBTree<K, V>::erase(iterator iter) noexcept
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::iterator NoNodeRBTree<K, V, A>::upper_bound(const K& key) const noexcept
     {
-        if (nullptr == iter.m_node)
-            return iter;
+        // TODO: except
+        V result = nullptr;
+        V node = m_root;
+        while (nullptr != node)
+        {
+            const bool is_less = (key < node->m_key);
+            result = is_less ? node : result;
+            node = pure(is_less ? node->m_left : node->m_right);
+        }
 
-        assert(nullptr != m_root);
+        return iterator(this, result);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    std::pair<typename NoNodeRBTree<K, V, A>::iterator, typename NoNodeRBTree<K, V, A>::iterator>
+    NoNodeRBTree<K, V, A>::equal_range(const K& key) const noexcept
+    {
+        // single descent: upper is the last node we turned left at,
+        // or the leftmost node of the right subtree of the match
+
+        // TODO: except
+        V upper = nullptr;
+        V node = m_root;
+        while (nullptr != node)
+        {
+            if (key < node->m_key)
+            {
+                upper = node;
+                node = pure(node->m_left);
+            }
+            else if (node->m_key < key)
+            {
+                node = pure(node->m_right);
+            }
+            else
+            {
+                V const right = pure(node->m_right);
+                if (nullptr != right)
+                    upper = maxLeft(right);
+
+                return std::pair<iterator, iterator>(iterator(this, node), iterator(this, upper));
+            }
+        }
+
+        return std::pair<iterator, iterator>(iterator(this, upper), iterator(this, upper));
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    __attribute__((no_sanitize("thread")))
+    bool NoNodeRBTree<K, V, A>::find_optimistic(const K& key, iterator& result) const noexcept
+    {
+        // Only child links are followed: they never carry the color bit
+        // and every rotation/swap stores only pointers to live nodes there.
+        // Writer may make a cycle for a moment (erase_swap), so the descent is bounded.
+
+        // TODO: except
+        V node = load_link(m_root);
+        for (uint32_t height = 0; height < s_max_height; ++height)
+        {
+            if (nullptr == node)
+            {
+                result = end();
+                return true;
+            }
+
+            if (key == node->m_key)
+            {
+                result = iterator(this, node);
+                return true;
+            }
+
+            node = load_link((key < node->m_key) ? node->m_left : node->m_right);
+        }
+
+        return false;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    std::pair<typename NoNodeRBTree<K, V, A>::iterator, bool> NoNodeRBTree<K, V, A>::emplace(const K& key, V value)
+    {
+        // TODO: except
+        value->m_key = key;
+
+        return insert(value);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    std::pair<typename NoNodeRBTree<K, V, A>::iterator, bool> NoNodeRBTree<K, V, A>::insert(V const value) noexcept
+    {
+        const K& key = value->m_key;
+
+        if (nullptr == m_root)
+        {
+            m_root = value;
+            m_leftmost = value;
+            m_rightmost = value;
+            value->m_left = nullptr;
+            value->m_right = nullptr;
+            value->m_parent = nullptr;
+            update(value);
+            ++m_size;
+            return std::pair<iterator, bool>(iterator(this, value), true);
+        }
+
+        V const node = descend(m_root, key);
+
+        // TODO: except
+        if (key == node->m_key)
+            return std::pair<iterator, bool>(iterator(this, node), false);
+
+        insert_at(node, value);
+
+        return std::pair<iterator, bool>(iterator(this, value), true);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::iterator NoNodeRBTree<K, V, A>::insert(iterator hint, V const value) noexcept
+    {
+        if (nullptr == m_root)
+            return insert(value).first;
+
+        // TODO: except
+        const K& key = value->m_key;
+        V node = hint.m_node;
+        if (nullptr == node)
+        {
+            // end(): after the last one
+            V const last = m_rightmost;
+            if (last->m_key < key)
+            {
+                insert_at(last, value);
+                return iterator(this, value);
+            }
+
+            node = last;
+        }
+        else if (key < node->m_key)
+        {
+            // left leaf of hint or right leaf of its predecessor
+            V const before = (node == m_leftmost) ? nullptr :
+                (nullptr == node->m_left) ? prev(node) : maxRight(pure(node->m_left));
+            if (nullptr == before || before->m_key < key)
+            {
+                insert_at((nullptr == node->m_left) ? node : before, value);
+                return iterator(this, value);
+            }
+        }
+        else if (node->m_key < key)
+        {
+            V const after = (node == m_rightmost) ? nullptr :
+                (nullptr == node->m_right) ? next(node) : maxLeft(pure(node->m_right));
+            if (nullptr == after || key < after->m_key)
+            {
+                insert_at((nullptr == node->m_right) ? node : after, value);
+                return iterator(this, value);
+            }
+        }
+        else
+        {
+            return hint;
+        }
+
+        // wrong hint
+        V const parent = descend_from(node, key);
+        if (key == parent->m_key)
+            return iterator(this, parent);
+
+        insert_at(parent, value);
+        return iterator(this, value);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class It, class Reject>
+    size_t NoNodeRBTree<K, V, A>::insert_batch(It first, It last, Reject reject) noexcept
+    {
+        size_t count = 0;
+        V finger = m_root;
+        for (; last != first; ++first)
+        {
+            V const value = *first;
+            if (nullptr == finger)
+            {
+                insert(value);
+                finger = value;
+                ++count;
+                continue;
+            }
+
+            V const node = descend_from(finger, value->m_key);
+
+            // TODO: except
+            if (value->m_key == node->m_key)
+            {
+                reject(value);
+                finger = node;
+                continue;
+            }
+
+            insert_at(node, value);
+            finger = value;
+            ++count;
+        }
+
+        return count;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::insert_at(V node, V const value) noexcept
+    {
+        // node - leaf side parent from descent, value isn't linked yet
+        const K& key = value->m_key;
+
+        // TODO: except
+        if (key < node->m_key)
+        {
+            node->m_left = value;
+            if (node == m_leftmost)
+                m_leftmost = value;
+        }
+        else
+        {
+            node->m_right = value;
+            if (node == m_rightmost)
+                m_rightmost = value;
+        }
+
+        value->m_parent = red(node);
+        value->m_left = nullptr;
+        value->m_right = nullptr;
+        propagate(value);
+        ++m_size;
+
+        if (is_node_black(node))
+        {
+            return;
+        }
+
+        insert_repair(m_root, node, value);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    bool NoNodeRBTree<K, V, A>::insert_repair(V& root, V parent, V node) noexcept
+    {
+        // grandfather definitely exists and is black (parent is red)
+        V grandpa = pure(parent->m_parent);
+        V uncle = pure((pure(grandpa->m_left) == parent) ? grandpa->m_right : grandpa->m_left);
+        //while (is_ptr_red(uncle))
+        while ((nullptr != uncle) && is_node_red(uncle))
+        {
+            assert(nullptr != grandpa && is_node_black(grandpa));
+            parent->m_parent = grandpa; // black
+            uncle->m_parent = grandpa; // black
+
+            if (nullptr == grandpa->m_parent)
+            {
+                // both children of the root got black
+                return true;
+            }
+
+            V const grandgrandpa = pure(grandpa->m_parent);
+            grandpa->m_parent = red(grandgrandpa);
+
+            if (is_node_black(grandgrandpa))
+            {
+                return false;
+            }
+
+            parent = grandgrandpa;
+            node = grandpa;
+            grandpa = pure(grandgrandpa->m_parent);
+            uncle = pure((pure(grandpa->m_left) == parent) ? grandpa->m_right : grandpa->m_left);
+        }
+
+        // uncle is black
+        if (pure(parent->m_right) == node && pure(grandpa->m_left) == parent)
+        {
+            pred_rotate(parent, node, grandpa);
+            rotate_left(parent, node);
+            node->m_parent = red(node->m_parent);
+            //parent->m_parent = red(parent->m_parent);
+            std::swap(parent, node);
+        }
+        else if (pure(parent->m_left) == node && pure(grandpa->m_right) == parent)
+        {
+            pred_rotate(parent, node, grandpa);
+            rotate_right(parent, node);
+            node->m_parent = red(node->m_parent);
+            //parent->m_parent = red(parent->m_parent);
+            std::swap(parent, node);
+        }
+
+        // case 5 (cascade)
+        //pred_rotate(grandpa, parent, grandgrandpa);
+        {
+            assert(is_node_black(grandpa));
+            V const grandgrandpa = grandpa->m_parent; // pure (black)
+            parent->m_parent = grandgrandpa;
+            if (nullptr != grandgrandpa)
+            {
+                if (pure(grandgrandpa->m_left) == grandpa)
+                    grandgrandpa->m_left = parent;
+                else
+                    grandgrandpa->m_right = parent;
+            }
+            else
+            {
+                assert(grandpa == root);
+                root = parent;
+            }
+        }
+        if (pure(parent->m_left) == node) // && pure(grandpa->m_left) == parent)
+        {
+            rotate_right(grandpa, parent);
+        }
+        else // pure(parent->m_right) == node) && pure(grandpa->m_right) == parent)
+        {
+            rotate_left(grandpa, parent);
+        }
+
+        return false;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t NoNodeRBTree<K, V, A>::erase(const K& key) noexcept
+    {
+        iterator iter = find(key);
+        if (nullptr == iter.m_node)
+            return 0;
+
+        assert(iter.m_node->m_key == key);
+        erase(iter);
+
+        return 1;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class It, class Disposer>
+    size_t NoNodeRBTree<K, V, A>::erase_batch(It first, It last, Disposer disposer) noexcept
+    {
+        size_t count = 0;
+        V finger = m_root;
+        for (; last != first && nullptr != m_root; ++first)
+        {
+            const K& key = *first;
+            V const node = descend_from(finger, key);
+
+            // TODO: except
+            if (!(key == node->m_key))
+            {
+                finger = node;
+                continue;
+            }
+
+            V const next_node = erase(iterator(this, node)).m_node;
+            disposer(node);
+            finger = (nullptr != next_node) ? next_node : m_root;
+            ++count;
+        }
+
+        return count;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::iterator NoNodeRBTree<K, V, A>::erase(iterator iter) noexcept
+    {
+        if (nullptr == iter.m_node)
+            return iter;
+
+        assert(nullptr != m_root);
         --m_size;
         
-        const iterator next_iter = iterator(next(iter.m_node));
+        const iterator next_iter = iterator(this, next(iter.m_node));
         V node = iter.m_node;
+
+        if (node == m_leftmost)
+            m_leftmost = next_iter.m_node;
+        if (node == m_rightmost)
+            m_rightmost = prev(node);
+
         if ((nullptr != node->m_left) && (nullptr != node->m_right))
         {
             V const min_right = maxLeft(pure(node->m_right));
@@ -366,6 +1068,7 @@ namespace RBTree
             else
                 parent->m_right = nullptr;
 
+            propagate(parent);
             return next_iter;
         }
 
@@ -387,6 +1090,7 @@ namespace RBTree
             }
             child->m_parent = parent; // black
 
+            propagate(parent);
             return next_iter;
         }
 
@@ -406,6 +1110,8 @@ namespace RBTree
         else
             parent->m_right = nullptr;
 
+        propagate(parent);
+
         // repair
         V brother = (nullptr == parent->m_left) ? parent->m_right : parent->m_left;
         while (true)
@@ -523,6 +1229,9 @@ namespace RBTree
             parent->m_parent = brother; // black
             brother->m_left = parent;
             brother->m_right->m_parent = black(brother->m_right->m_parent);
+
+            update(parent);
+            update(brother);
         }
         else
         {
@@ -565,69 +1274,415 @@ namespace RBTree
             parent->m_parent = brother; // black
             brother->m_right = parent;
             brother->m_left->m_parent = black(brother->m_left->m_parent);
+
+            update(parent);
+            update(brother);
         }
 
         return next_iter;
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    void NoNodeRBTree<K, V>::clear() noexcept
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::pop_front() noexcept
     {
-        m_root = nullptr;
-        m_size = 0;
+        V const node = m_leftmost;
+        erase(iterator(this, node));
+
+        return node;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::pop_back() noexcept
+    {
+        V const node = m_rightmost;
+        erase(iterator(this, node));
+
+        return node;
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    void NoNodeRBTree<K, V>::clearWithDestruct() noexcept
+    template<class K, class V, class A>
+    size_t NoNodeRBTree<K, V, A>::rank(const K& key) const noexcept
     {
+        static_assert(s_is_counted, "value has no m_count");
+
+        // TODO: except
+        size_t rank = 0;
         V node = m_root;
         while (nullptr != node)
         {
-            V next = node->m_left;
-            if (nullptr == next)
+            if (node->m_key < key)
             {
-                next = node->m_right;
-                if (nullptr == next)
-                {
-                    next = pure(node->m_parent);
-                    if (nullptr != next)
-                    {
-                        if (node == next->m_left)
-                            next->m_left = nullptr;
-                        else
-                            next->m_right = nullptr;
-                    }
-                    delete node;
-                }
+                rank += 1 + subtree_count(node->m_left);
+                node = node->m_right;
+            }
+            else
+            {
+                node = node->m_left;
             }
+        }
 
-            node = next;
+        return rank;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::iterator NoNodeRBTree<K, V, A>::select(size_t k) const noexcept
+    {
+        static_assert(s_is_counted, "value has no m_count");
+
+        V node = m_root;
+        while (nullptr != node)
+        {
+            const size_t left = subtree_count(node->m_left);
+            if (k == left)
+                return iterator(this, node);
+
+            if (k < left)
+            {
+                node = node->m_left;
+            }
+            else
+            {
+                k -= left + 1;
+                node = node->m_right;
+            }
         }
-        
+
+        return end();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t NoNodeRBTree<K, V, A>::count_range(const K& first, const K& last) const noexcept
+    {
+        const size_t first_rank = rank(first);
+        const size_t last_rank = rank(last);
+
+        return (first_rank < last_rank) ? last_rank - first_rank : 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void NoNodeRBTree<K, V, A>::for_each(Visitor visitor) const
+    {
+        walk(m_leftmost, nullptr, visitor);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void NoNodeRBTree<K, V, A>::for_each_range(const K& first, const K& last, Visitor visitor) const
+    {
+        walk(lower_bound(first).m_node, &last, visitor);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::clear() noexcept
+    {
         m_root = nullptr;
+        m_leftmost = nullptr;
+        m_rightmost = nullptr;
         m_size = 0;
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    size_t NoNodeRBTree<K, V>::size() const noexcept
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::adopt(V root, size_t size) noexcept
+    {
+        assert((nullptr == root) == (0 == size));
+
+        m_root = root;
+        m_leftmost = (nullptr == root) ? nullptr : maxLeft(root);
+        m_rightmost = (nullptr == root) ? nullptr : maxRight(root);
+        m_size = size;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void NoNodeRBTree<K, V, A>::for_each_veb(Visitor visitor) const
+    {
+        veb(m_root, height(m_root), visitor);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class It>
+    void NoNodeRBTree<K, V, A>::relocate(It first, It last) noexcept
+    {
+        const auto forward = [](V old) { return (nullptr == old) ? old : old->m_left; };
+
+        for (; last != first; ++first)
+        {
+            V copy;
+            if constexpr (std::is_convertible<decltype(*first), V>::value)
+                copy = *first;
+            else
+                copy = &*first;
+
+            copy->m_left = forward(copy->m_left);
+            copy->m_right = forward(copy->m_right);
+            copy->m_parent = (V)((size_t)forward(pure(copy->m_parent)) | color(copy));
+        }
+
+        m_root = forward(m_root);
+        m_leftmost = forward(m_leftmost);
+        m_rightmost = forward(m_rightmost);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::clearWithDestruct() noexcept
+    {
+        clearWithDispose([](V node) { delete node; });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    void NoNodeRBTree<K, V, A>::clearWithDispose(Disposer disposer) noexcept
+    {
+        dispose(m_root, disposer);
+
+        m_root = nullptr;
+        m_leftmost = nullptr;
+        m_rightmost = nullptr;
+        m_size = 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t NoNodeRBTree<K, V, A>::size() const noexcept
     {
         return m_size;
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    bool NoNodeRBTree<K, V>::checkRB() noexcept
+    template<class K, class V, class A>
+    template<class It>
+    void NoNodeRBTree<K, V, A>::build_from_sorted(It first, It last) noexcept
+    {
+        const size_t size = std::distance(first, last);
+
+        m_root = build_subtree(first, size, 0, lowest_depth(size));
+        if (nullptr != m_root)
+            m_root->m_parent = nullptr;
+
+        m_leftmost = (nullptr != m_root) ? maxLeft(m_root) : nullptr;
+        m_rightmost = (nullptr != m_root) ? maxRight(m_root) : nullptr;
+        m_size = size;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    uint32_t NoNodeRBTree<K, V, A>::lowest_depth(size_t size) noexcept
+    {
+        // halves differ by at most one node, so only the lowest level is incomplete:
+        // making it red keeps black height equal for all paths
+        uint32_t depth = 0;
+        for (size_t n = size; 1 < n; n >>= 1)
+            ++depth;
+
+        return depth;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class It>
+    V NoNodeRBTree<K, V, A>::build_subtree(It& it, size_t size, uint32_t depth, uint32_t red_depth) noexcept
+    {
+        // in-order, so "it" is passed only once
+        if (0 == size)
+            return nullptr;
+
+        const size_t left_size = (size - 1) / 2;
+        V const left = build_subtree(it, left_size, depth + 1, red_depth);
+
+        V const node = *it;
+        ++it;
+
+        V const right = build_subtree(it, size - 1 - left_size, depth + 1, red_depth);
+
+        link_children(node, left, right, depth, red_depth);
+        return node;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::link_children(V const node, V const left, V const right,
+                                              uint32_t depth, uint32_t red_depth) noexcept
+    {
+        node->m_left = left;
+        node->m_right = right;
+
+        const bool is_child_red = (depth + 1 == red_depth);
+        if (nullptr != left)
+        {
+            assert(left->m_key < node->m_key);
+            left->m_parent = is_child_red ? red(node) : node;
+        }
+        if (nullptr != right)
+        {
+            assert(node->m_key < right->m_key);
+            right->m_parent = is_child_red ? red(node) : node;
+        }
+
+        update(node);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    size_t NoNodeRBTree<K, V, A>::erase_range(const K& first, const K& last, Disposer disposer) noexcept
+    {
+        // TODO: except
+        if (nullptr == m_root || !(first < last))
+            return 0;
+
+        Subtree low;
+        Subtree rest;
+        V const first_node = split_subtree(Subtree{m_root, black_height(m_root)}, first, low, rest);
+
+        Subtree middle;
+        Subtree high;
+        V const last_node = split_subtree(rest, last, middle, high);
+        if (nullptr != last_node)
+            high = join_subtrees(Subtree{nullptr, 0}, last_node, high);
+
+        size_t count = dispose(middle.m_root, disposer);
+        if (nullptr != first_node)
+        {
+            disposer(first_node);
+            ++count;
+        }
+
+        const Subtree tree = concat(low, high);
+        adopt(tree.m_root, m_size - count);
+
+        return count;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::split(const K& key, NoNodeRBTree& right) noexcept
+    {
+        assert(this != &right && nullptr == right.m_root);
+
+        Subtree low;
+        Subtree high;
+        V const node = split_subtree(Subtree{m_root, black_height(m_root)}, key, low, high);
+        if (nullptr != node)
+            high = join_subtrees(Subtree{nullptr, 0}, node, high);
+
+        size_t high_size;
+        if constexpr (s_is_counted)
+            high_size = subtree_count(high.m_root);
+        else
+            high_size = count_right(low.m_root, high.m_root, m_size);
+
+        right.adopt(high.m_root, high_size);
+        adopt(low.m_root, m_size - high_size);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::join(NoNodeRBTree& right) noexcept
+    {
+        assert(this != &right);
+
+        if (nullptr == right.m_root)
+            return;
+
+        V const value = right.pop_front();
+        join(value, right);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::join(V const value, NoNodeRBTree& right) noexcept
+    {
+        assert(this != &right);
+        assert(nullptr == m_rightmost || m_rightmost->m_key < value->m_key);
+        assert(nullptr == right.m_leftmost || value->m_key < right.m_leftmost->m_key);
+
+        const Subtree tree = join_subtrees(Subtree{m_root, black_height(m_root)}, value,
+                                           Subtree{right.m_root, black_height(right.m_root)});
+
+        adopt(tree.m_root, m_size + 1 + right.m_size);
+        right.clear();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    size_t NoNodeRBTree<K, V, A>::unite(NoNodeRBTree& other, Disposer disposer) noexcept
+    {
+        assert(this != &other);
+
+        size_t count = 0;
+        const Subtree tree = unite_subtrees(Subtree{m_root, black_height(m_root)},
+                                            Subtree{other.m_root, black_height(other.m_root)}, disposer, count);
+
+        const size_t moved = other.m_size - count;
+        adopt(tree.m_root, m_size + moved);
+        other.clear();
+
+        return moved;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    size_t NoNodeRBTree<K, V, A>::intersect(const NoNodeRBTree& other, Disposer disposer) noexcept
+    {
+        assert(this != &other);
+
+        size_t count = 0;
+        const Subtree tree = intersect_subtrees(Subtree{m_root, black_height(m_root)}, other.m_root, disposer, count);
+        adopt(tree.m_root, m_size - count);
+
+        return count;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    size_t NoNodeRBTree<K, V, A>::subtract(const NoNodeRBTree& other, Disposer disposer) noexcept
+    {
+        assert(this != &other);
+
+        size_t count = 0;
+        const Subtree tree = subtract_subtrees(Subtree{m_root, black_height(m_root)}, other.m_root, disposer, count);
+        adopt(tree.m_root, m_size - count);
+
+        return count;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    bool NoNodeRBTree<K, V, A>::checkRB() noexcept
     {
         if (nullptr == m_root)
         {
             assert(0 == m_size);
-            return true;
+            return (nullptr == m_leftmost) && (nullptr == m_rightmost);
         }
         assert(is_node_black(m_root));
 
+        if (maxLeft(m_root) != m_leftmost || maxRight(m_root) != m_rightmost)
+            return false;
+
+        if constexpr (s_is_counted)
+        {
+            if (m_size != m_root->m_count)
+                return false;
+        }
+
         size_t size = 1;
 
         uint32_t depth = 0;
@@ -663,6 +1718,12 @@ namespace RBTree
                 if (is_black)
                     ++d;
 
+                if constexpr (s_is_counted)
+                {
+                    if (node->m_count != 1 + subtree_count(node->m_left) + subtree_count(node->m_right))
+                        return false;
+                }
+
                 queue.emplace(node->m_left, d);
                 queue.emplace(node->m_right, d);
             }
@@ -673,27 +1734,515 @@ namespace RBTree
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    V NoNodeRBTree<K, V>::next(V node) noexcept
+    template<class K, class V, class A>
+    template<class Disposer>
+    size_t NoNodeRBTree<K, V, A>::dispose(V const root, Disposer& disposer) noexcept
+    {
+        size_t count = 0;
+        V node = root;
+        while (nullptr != node)
+        {
+            V next = node->m_left;
+            if (nullptr == next)
+            {
+                next = node->m_right;
+                if (nullptr == next)
+                {
+                    next = pure(node->m_parent);
+                    if (nullptr != next)
+                    {
+                        if (node == next->m_left)
+                            next->m_left = nullptr;
+                        else
+                            next->m_right = nullptr;
+                    }
+                    disposer(node);
+                    ++count;
+                }
+            }
+
+            node = next;
+        }
+
+        return count;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    uint32_t NoNodeRBTree<K, V, A>::black_height(V node) noexcept
+    {
+        uint32_t height = 0;
+        for (; nullptr != node; node = node->m_left)
+        {
+            if (is_node_black(node))
+                ++height;
+        }
+
+        return height;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::Subtree NoNodeRBTree<K, V, A>::detach(Subtree tree) noexcept
+    {
+        if (nullptr != tree.m_root)
+        {
+            if (is_node_red(tree.m_root))
+                ++tree.m_height;
+
+            tree.m_root->m_parent = nullptr; // black
+        }
+
+        return tree;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::Subtree
+    NoNodeRBTree<K, V, A>::join_subtrees(Subtree left, V const value, Subtree right) noexcept
+    {
+        left = detach(left);
+        right = detach(right);
+
+        if (left.m_height == right.m_height)
+        {
+            value->m_parent = nullptr;
+            value->m_left = left.m_root;
+            value->m_right = right.m_root;
+            if (nullptr != left.m_root)
+                left.m_root->m_parent = value; // black
+            if (nullptr != right.m_root)
+                right.m_root->m_parent = value; // black
+
+            update(value);
+            return Subtree{value, left.m_height + 1};
+        }
+
+        // Down the inner spine of the taller tree to the black node as high as the shorter tree:
+        // the value takes its place as red node with the node and the shorter tree as children.
+        // Only red-red may be broken there, it is repaired as after insert.
+        const bool is_left_taller = (right.m_height < left.m_height);
+        Subtree& taller = is_left_taller ? left : right;
+        const Subtree& shorter = is_left_taller ? right : left;
+
+        V parent = nullptr;
+        V node = taller.m_root;
+        uint32_t height = taller.m_height;
+        while (height != shorter.m_height || (nullptr != node && is_node_red(node)))
+        {
+            if (is_node_black(node))
+                --height;
+
+            parent = node;
+            node = pure(is_left_taller ? node->m_right : node->m_left);
+        }
+        assert(nullptr != parent);
+
+        if (is_left_taller)
+        {
+            parent->m_right = value;
+            value->m_left = node;
+            value->m_right = shorter.m_root;
+        }
+        else
+        {
+            parent->m_left = value;
+            value->m_left = shorter.m_root;
+            value->m_right = node;
+        }
+        value->m_parent = red(parent);
+
+        if (nullptr != node)
+            node->m_parent = value; // black
+        if (nullptr != shorter.m_root)
+            shorter.m_root->m_parent = value; // black
+
+        propagate(value);
+
+        if (is_node_red(parent) && insert_repair(taller.m_root, parent, value))
+            ++taller.m_height;
+
+        return taller;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    typename NoNodeRBTree<K, V, A>::Subtree NoNodeRBTree<K, V, A>::concat(Subtree left, Subtree right) noexcept
+    {
+        if (nullptr == left.m_root)
+            return detach(right);
+
+        if (nullptr == right.m_root)
+            return detach(left);
+
+        // max of left is the value between them
+        Subtree rest;
+        Subtree empty;
+        V const last = split_subtree(left, maxRight(left.m_root)->m_key, rest, empty);
+        assert(nullptr != last && nullptr == empty.m_root);
+
+        return join_subtrees(rest, last, right);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::split_subtree(Subtree tree, const K& key, Subtree& left, Subtree& right) noexcept
+    {
+        // Every node of the path is joined with its other subtree to the piece of its side,
+        // from the bottom up. Pieces grow in height, so joins cost O(log n) all together.
+        struct Step
+        {
+            V m_node;
+
+            uint32_t m_height;
+
+            bool m_is_left;
+        };
+
+        Step path[s_max_height];
+        uint32_t depth = 0;
+
+        // TODO: except
+        V found = nullptr;
+        V node = tree.m_root;
+        uint32_t height = tree.m_height;
+        while (nullptr != node)
+        {
+            const bool is_left = (key < node->m_key);
+            if (!is_left && !(node->m_key < key))
+            {
+                found = node;
+                break;
+            }
+
+            path[depth++] = Step{node, height, is_left};
+
+            if (is_node_black(node))
+                --height;
+
+            node = pure(is_left ? node->m_left : node->m_right);
+        }
+
+        Subtree low{nullptr, 0};
+        Subtree high{nullptr, 0};
+        if (nullptr != found)
+        {
+            const uint32_t child_height = is_node_black(found) ? height - 1 : height;
+            low = Subtree{pure(found->m_left), child_height};
+            high = Subtree{pure(found->m_right), child_height};
+        }
+
+        while (0 != depth)
+        {
+            const Step& step = path[--depth];
+            V const parent = step.m_node;
+            const uint32_t child_height = is_node_black(parent) ? step.m_height - 1 : step.m_height;
+
+            if (step.m_is_left)
+                high = join_subtrees(high, parent, Subtree{pure(parent->m_right), child_height});
+            else
+                low = join_subtrees(Subtree{pure(parent->m_left), child_height}, parent, low);
+        }
+
+        left = detach(low);
+        right = detach(high);
+
+        return found;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t NoNodeRBTree<K, V, A>::count_right(V left, V right, size_t size) noexcept
+    {
+        left = (nullptr == left) ? nullptr : maxLeft(left);
+        right = (nullptr == right) ? nullptr : maxLeft(right);
+
+        size_t count = 0;
+        while (nullptr != left && nullptr != right)
+        {
+            left = next(left);
+            right = next(right);
+            ++count;
+        }
+
+        return (nullptr == right) ? count : size - count;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    typename NoNodeRBTree<K, V, A>::Subtree
+    NoNodeRBTree<K, V, A>::unite_subtrees(Subtree tree, Subtree other, Disposer& disposer, size_t& count) noexcept
+    {
+        if (nullptr == other.m_root)
+            return detach(tree);
+
+        if (nullptr == tree.m_root)
+            return detach(other);
+
+        V const value = other.m_root;
+        const uint32_t child_height = is_node_black(value) ? other.m_height - 1 : other.m_height;
+        const Subtree other_left{pure(value->m_left), child_height};
+        const Subtree other_right{pure(value->m_right), child_height};
+
+        Subtree left;
+        Subtree right;
+        V const same = split_subtree(tree, value->m_key, left, right);
+
+        left = unite_subtrees(left, other_left, disposer, count);
+        right = unite_subtrees(right, other_right, disposer, count);
+
+        if (nullptr == same)
+            return join_subtrees(left, value, right);
+
+        disposer(value);
+        ++count;
+
+        return join_subtrees(left, same, right);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    typename NoNodeRBTree<K, V, A>::Subtree
+    NoNodeRBTree<K, V, A>::intersect_subtrees(Subtree tree, V const other, Disposer& disposer, size_t& count) noexcept
+    {
+        tree = detach(tree);
+        if (nullptr == tree.m_root)
+            return tree;
+
+        if (nullptr == other)
+        {
+            count += dispose(tree.m_root, disposer);
+            return Subtree{nullptr, 0};
+        }
+
+        Subtree left;
+        Subtree right;
+        V const same = split_subtree(tree, other->m_key, left, right);
+
+        left = intersect_subtrees(left, pure(other->m_left), disposer, count);
+        right = intersect_subtrees(right, pure(other->m_right), disposer, count);
+
+        if (nullptr == same)
+            return concat(left, right);
+
+        return join_subtrees(left, same, right);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    typename NoNodeRBTree<K, V, A>::Subtree
+    NoNodeRBTree<K, V, A>::subtract_subtrees(Subtree tree, V const other, Disposer& disposer, size_t& count) noexcept
+    {
+        if (nullptr == tree.m_root || nullptr == other)
+            return detach(tree);
+
+        Subtree left;
+        Subtree right;
+        V const same = split_subtree(tree, other->m_key, left, right);
+
+        left = subtract_subtrees(left, pure(other->m_left), disposer, count);
+        right = subtract_subtrees(right, pure(other->m_right), disposer, count);
+
+        if (nullptr != same)
+        {
+            disposer(same);
+            ++count;
+        }
+
+        return concat(left, right);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::next(V node) noexcept
     {
         if (nullptr != node->m_right)
         {
             return maxLeft(pure(node->m_right));
         }
 
+        // pointer identity, no key compares
+        V parent = pure(node->m_parent);
+        while (nullptr != parent && node == parent->m_right)
+        {
+            node = parent;
+            parent = pure(node->m_parent);
+        }
+
+        return parent;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void NoNodeRBTree<K, V, A>::walk(V node, const K* last, Visitor& visitor)
+    {
+        // Same steps as next(). Going down a left path every right child is prefetched,
+        // its load overlaps with the visits of the left subtree.
+        while (nullptr != node && (nullptr == last || node->m_key < *last))
+        {
+            V const right = node->m_right;
+            if (nullptr != right)
+                prefetch(&*right);
+
+            visitor(node);
+
+            if (nullptr != right)
+            {
+                node = right;
+                while (true)
+                {
+                    if (nullptr != node->m_right)
+                        prefetch(&*node->m_right);
+
+                    if (nullptr == node->m_left)
+                        break;
+
+                    node = node->m_left;
+                }
+            }
+            else
+            {
+                V parent = pure(node->m_parent);
+                while (nullptr != parent && node == parent->m_right)
+                {
+                    node = parent;
+                    parent = pure(node->m_parent);
+                }
+
+                node = parent;
+            }
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    uint32_t NoNodeRBTree<K, V, A>::height(V node) noexcept
+    {
+        if (nullptr == node)
+            return 0;
+
+        return 1 + std::max(height(node->m_left), height(node->m_right));
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void NoNodeRBTree<K, V, A>::veb(V node, uint32_t height, Visitor& visitor)
+    {
+        if (nullptr == node)
+            return;
+
+        if (1 == height)
+        {
+            visitor(node);
+            return;
+        }
+
+        const uint32_t top = height / 2;
+        veb(node, top, visitor);
+
+        auto bottom = [&visitor, height = height - top](V subtree) { veb(subtree, height, visitor); };
+        at_depth(node, top, bottom);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void NoNodeRBTree<K, V, A>::at_depth(V node, uint32_t depth, Visitor& visitor)
+    {
+        if (nullptr == node)
+            return;
+
+        if (0 == depth)
+        {
+            visitor(node);
+            return;
+        }
+
+        at_depth(node->m_left, depth - 1, visitor);
+        at_depth(node->m_right, depth - 1, visitor);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::descend(V node, const K& key) noexcept
+    {
         // TODO: except
+        while (true)
+        {
+            if (key == node->m_key)
+                return node;
+
+            V const next = pure((key < node->m_key) ? node->m_left : node->m_right);
+            if (nullptr == next)
+                return node;
+
+            node = next;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::descend_from(V const finger, const K& key) noexcept
+    {
+        // For key > finger only the upper bound of a subtree matters (mirrored for key < finger).
+        // Climbing, that bound is the first parent we come to from the left,
+        // so start from the highest node below the first such parent greater than the key.
+
+        // TODO: except
+        if (key == finger->m_key)
+            return finger;
+
+        const bool is_greater = (finger->m_key < key);
+        V start = finger;
+        V node = finger;
         V parent = pure(node->m_parent);
-        while (nullptr != parent && parent->m_key <= node->m_key)
+        while (nullptr != parent)
         {
-            parent = pure(parent->m_parent);
+            if ((parent->m_left == node) == is_greater)
+            {
+                if (is_greater ? (key < parent->m_key) : (parent->m_key < key))
+                    break;
+
+                if (key == parent->m_key)
+                    return parent;
+
+                start = parent;
+            }
+
+            node = parent;
+            parent = pure(node->m_parent);
         }
-        
+
+        return descend(start, key);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::prev(V node) noexcept
+    {
+        if (nullptr != node->m_left)
+        {
+            return maxRight(pure(node->m_left));
+        }
+
+        V parent = pure(node->m_parent);
+        while (nullptr != parent && node == parent->m_left)
+        {
+            node = parent;
+            parent = pure(node->m_parent);
+        }
+
         return parent;
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    V NoNodeRBTree<K, V>::maxLeft(V node) noexcept
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::maxLeft(V node) noexcept
     {
         while (nullptr != node->m_left)
             node = pure(node->m_left);
@@ -702,8 +2251,27 @@ namespace RBTree
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    void NoNodeRBTree<K, V>::erase_swap(V one, V other) noexcept
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::maxRight(V node) noexcept
+    {
+        while (nullptr != node->m_right)
+            node = pure(node->m_right);
+
+        return node;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::load_link(const V& link) noexcept
+    {
+        V result;
+        __atomic_load(&link, &result, __ATOMIC_RELAXED);
+        return result;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::erase_swap(V one, V other) noexcept
     {
         // one may be root
         assert(nullptr != other->m_parent);
@@ -758,8 +2326,8 @@ namespace RBTree
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    V NoNodeRBTree<K, V>::uncle(V const parent) noexcept
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::uncle(V const parent) noexcept
     {
         assert_pure(parent);
 
@@ -773,8 +2341,8 @@ namespace RBTree
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    void NoNodeRBTree<K, V>::pred_rotate(V const parent, V const node, V const grandpa)
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::pred_rotate(V const parent, V const node, V const grandpa)
     {
         assert_pure(parent);
         assert_pure(node);
@@ -790,8 +2358,8 @@ namespace RBTree
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    void NoNodeRBTree<K, V>::rotate_left(V const parent, V const node)
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::rotate_left(V const parent, V const node)
     {
         parent->m_right = node->m_left;
         if (nullptr != node->m_left)
@@ -799,11 +2367,14 @@ namespace RBTree
 
         parent->m_parent = red(node);
         node->m_left = parent;
+
+        update(parent);
+        update(node);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    void NoNodeRBTree<K, V>::rotate_right(V const parent, V const node)
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::rotate_right(V const parent, V const node)
     {        
         parent->m_left = node->m_right;
         if (nullptr != node->m_right)
@@ -811,69 +2382,103 @@ namespace RBTree
 
         parent->m_parent = red(node);
         node->m_right = parent;
+
+        update(parent);
+        update(node);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    bool NoNodeRBTree<K, V>::isChildsBlack(V node)
+    template<class K, class V, class A>
+    bool NoNodeRBTree<K, V, A>::isChildsBlack(V node)
     {
         return ((nullptr == node->m_left)  || is_node_black(node->m_left)) &&
             ((nullptr == node->m_right) || is_node_black(node->m_right));
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    size_t NoNodeRBTree<K, V>::color(V node)
+    template<class K, class V, class A>
+    size_t NoNodeRBTree<K, V, A>::subtree_count(V node) noexcept
+    {
+        if constexpr (s_is_counted)
+            return (nullptr == node) ? 0 : node->m_count;
+        else
+            return 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::update(V node) noexcept
+    {
+        if constexpr (s_is_counted)
+            node->m_count = 1 + subtree_count(node->m_left) + subtree_count(node->m_right);
+
+        A()(node);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::propagate(V node) noexcept
+    {
+        if constexpr (s_is_augmented)
+        {
+            for (; nullptr != node; node = pure(node->m_parent))
+                update(node);
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    size_t NoNodeRBTree<K, V, A>::color(V node)
     {
         return (size_t)node->m_parent & (size_t)1;
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    bool NoNodeRBTree<K, V>::is_node_black(V node)
+    template<class K, class V, class A>
+    bool NoNodeRBTree<K, V, A>::is_node_black(V node)
     {
         return 0 == ((size_t)node->m_parent & (size_t)1);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    bool NoNodeRBTree<K, V>::is_node_red(V node)
+    template<class K, class V, class A>
+    bool NoNodeRBTree<K, V, A>::is_node_red(V node)
     {
         return 0 != ((size_t)node->m_parent & (size_t)1);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    void NoNodeRBTree<K, V>::set_parent_save_color(V node, V parent)
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::set_parent_save_color(V node, V parent)
     {
         assert_pure(parent);
         node->m_parent = (V)((size_t)parent | color(node));
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    V NoNodeRBTree<K, V>::red(V node)
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::red(V node)
     {
         return (V)((size_t)node | (size_t)1);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    V NoNodeRBTree<K, V>::black(V ptr)
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::black(V ptr)
     {
         return (V)((size_t)ptr & (~((size_t)0b1)));
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    V NoNodeRBTree<K, V>::pure(V ptr)
+    template<class K, class V, class A>
+    V NoNodeRBTree<K, V, A>::pure(V ptr)
     {
         return (V)((size_t)ptr & (~((size_t)0b111)));
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V>
-    void NoNodeRBTree<K, V>::assert_pure(V ptr)
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::assert_pure(V ptr)
     {
         assert(0 == (((size_t)ptr) & (size_t)0b111));
     }
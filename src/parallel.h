@@ -0,0 +1,380 @@
+#pragma once
+
+#include "stdint.h"
+#include <atomic>
+#include <exception>
+#include <optional>
+#include <vector>
+#include "rbtree.h"
+#include "threadpool.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // Parallel bulk operations of NoNodeRBTree and RBTree over ThreadPool, declared in the classes.
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class It>
+    void NoNodeRBTree<K, V, A>::build_from_sorted(ThreadPool& pool, It first, It last) noexcept
+    {
+        const size_t size = last - first;
+
+        V root = nullptr;
+        pool.run([&]() { root = build_subtree(pool, first, size, 0, lowest_depth(size), pool.fork_depth()); });
+        if (nullptr != root)
+            root->m_parent = nullptr;
+
+        adopt(root, size);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class It>
+    V NoNodeRBTree<K, V, A>::build_subtree(ThreadPool& pool, It first, size_t size, uint32_t depth,
+                                           uint32_t red_depth, uint32_t fork_depth) noexcept
+    {
+        if (0 == fork_depth || 0 == size)
+            return build_subtree(first, size, depth, red_depth);
+
+        const size_t left_size = (size - 1) / 2;
+        V left = nullptr;
+        V right = nullptr;
+        pool.invoke(
+            [&]() { left = build_subtree(pool, first, left_size, depth + 1, red_depth, fork_depth - 1); },
+            [&]() { right = build_subtree(pool, first + (left_size + 1), size - 1 - left_size,
+                                          depth + 1, red_depth, fork_depth - 1); });
+
+        V const node = first[left_size];
+        link_children(node, left, right, depth, red_depth);
+        return node;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void NoNodeRBTree<K, V, A>::for_each(ThreadPool& pool, Visitor visitor) const
+    {
+        pool.run([&]() { for_each_subtree(pool, m_root, nullptr, visitor, pool.fork_depth()); });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Visitor>
+    void NoNodeRBTree<K, V, A>::for_each_subtree(ThreadPool& pool, V const node, const K* last, Visitor& visitor,
+                                                 uint32_t fork_depth)
+    {
+        if (nullptr == node)
+            return;
+
+        // walk() climbs out of the subtree, but stops at its bound
+        if (0 == fork_depth)
+        {
+            walk(maxLeft(node), last, visitor);
+            return;
+        }
+
+        pool.invoke(
+            [&]() { for_each_subtree(pool, pure(node->m_left), &node->m_key, visitor, fork_depth - 1); },
+            [&]()
+            {
+                visitor(node);
+                for_each_subtree(pool, pure(node->m_right), last, visitor, fork_depth - 1);
+            });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class T, class Map, class Combine>
+    T NoNodeRBTree<K, V, A>::reduce(ThreadPool& pool, T identity, Map map, Combine combine) const
+    {
+        T result = identity;
+        pool.run([&]() { result = reduce_subtree(pool, m_root, nullptr, identity, map, combine, pool.fork_depth()); });
+
+        return result;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class T, class Map, class Combine>
+    T NoNodeRBTree<K, V, A>::reduce_subtree(ThreadPool& pool, V const node, const K* last, const T& identity,
+                                            Map& map, Combine& combine, uint32_t fork_depth)
+    {
+        if (nullptr == node)
+            return identity;
+
+        if (0 == fork_depth)
+        {
+            T result = identity;
+            auto visitor = [&result, &map, &combine](V value) { result = combine(std::move(result), map(value)); };
+            walk(maxLeft(node), last, visitor);
+            return result;
+        }
+
+        T left = identity;
+        T right = identity;
+        pool.invoke(
+            [&]() { left = reduce_subtree(pool, pure(node->m_left), &node->m_key, identity, map, combine, fork_depth - 1); },
+            [&]()
+            {
+                right = combine(map(node),
+                                reduce_subtree(pool, pure(node->m_right), last, identity, map, combine, fork_depth - 1));
+            });
+
+        return combine(std::move(left), std::move(right));
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    void NoNodeRBTree<K, V, A>::clearWithDispose(ThreadPool& pool, Disposer disposer) noexcept
+    {
+        V const root = m_root;
+        clear();
+
+        pool.run([&]() { dispose(pool, root, disposer, pool.fork_depth()); });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    void NoNodeRBTree<K, V, A>::clearWithDestruct(ThreadPool& pool) noexcept
+    {
+        clearWithDispose(pool, [](V node) { delete node; });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    void NoNodeRBTree<K, V, A>::dispose(ThreadPool& pool, V const node, Disposer& disposer, uint32_t fork_depth) noexcept
+    {
+        if (nullptr == node)
+            return;
+
+        // the walk of dispose() stops at the subtree root
+        if (0 == fork_depth)
+        {
+            node->m_parent = nullptr;
+            dispose(node, disposer);
+            return;
+        }
+
+        V const left = pure(node->m_left);
+        V const right = pure(node->m_right);
+        pool.invoke([&]() { dispose(pool, left, disposer, fork_depth - 1); },
+                    [&]() { dispose(pool, right, disposer, fork_depth - 1); });
+
+        disposer(node);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    size_t NoNodeRBTree<K, V, A>::unite(ThreadPool& pool, NoNodeRBTree& other, Disposer disposer) noexcept
+    {
+        assert(this != &other);
+
+        size_t count = 0;
+        Subtree tree{nullptr, 0};
+        pool.run([&]()
+        {
+            tree = unite_subtrees(pool, Subtree{m_root, black_height(m_root)},
+                                  Subtree{other.m_root, black_height(other.m_root)}, disposer, count, pool.fork_depth());
+        });
+
+        const size_t moved = other.m_size - count;
+        adopt(tree.m_root, m_size + moved);
+        other.clear();
+
+        return moved;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class A>
+    template<class Disposer>
+    typename NoNodeRBTree<K, V, A>::Subtree
+    NoNodeRBTree<K, V, A>::unite_subtrees(ThreadPool& pool, Subtree tree, Subtree other, Disposer& disposer,
+                                          size_t& count, uint32_t fork_depth) noexcept
+    {
+        if (0 == fork_depth || nullptr == tree.m_root || nullptr == other.m_root)
+            return unite_subtrees(tree, other, disposer, count);
+
+        V const value = other.m_root;
+        const uint32_t child_height = is_node_black(value) ? other.m_height - 1 : other.m_height;
+        const Subtree other_left{pure(value->m_left), child_height};
+        const Subtree other_right{pure(value->m_right), child_height};
+
+        // the halves share no nodes, so they are split and joined apart
+        Subtree left;
+        Subtree right;
+        V const same = split_subtree(tree, value->m_key, left, right);
+
+        size_t right_count = 0;
+        pool.invoke([&]() { left = unite_subtrees(pool, left, other_left, disposer, count, fork_depth - 1); },
+                    [&]() { right = unite_subtrees(pool, right, other_right, disposer, right_count, fork_depth - 1); });
+        count += right_count;
+
+        if (nullptr == same)
+            return join_subtrees(left, value, right);
+
+        disposer(value);
+        ++count;
+
+        return join_subtrees(left, same, right);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class Visitor>
+    void RBTree<K, V, L, A>::for_each(ThreadPool& pool, Visitor visitor) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        try
+        {
+            m_tree.for_each(pool, [&visitor](const Node* node) { visitor(node->m_key, node->m_value); });
+        }
+        catch (...)
+        {
+            unlock_shared();
+            throw;
+        }
+
+        unlock_shared();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class T, class Map, class Combine>
+    T RBTree<K, V, L, A>::reduce(ThreadPool& pool, T identity, Map map, Combine combine) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        std::optional<T> result;
+        try
+        {
+            result.emplace(m_tree.reduce(pool, std::move(identity),
+                [&map](const Node* node) { return map(node->m_key, node->m_value); }, combine));
+        }
+        catch (...)
+        {
+            unlock_shared();
+            throw;
+        }
+
+        unlock_shared();
+
+        return std::move(*result);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class It>
+    void RBTree<K, V, L, A>::build_from_sorted(ThreadPool& pool, It first, It last)
+    {
+        const size_t size = last - first;
+        std::vector<Node*> nodes(size, nullptr);
+
+        // the first failure is kept, other tasks skip their nodes
+        std::atomic<bool> is_failed(false);
+        std::exception_ptr error;
+        pool.run([&]()
+        {
+            pool.for_range(0, size, s_grain, [&](size_t i)
+            {
+                if (is_failed.load(std::memory_order_relaxed))
+                    return;
+
+                try
+                {
+                    nodes[i] = create_node(first[i].first, first[i].second);
+                }
+                catch (...)
+                {
+                    if (!is_failed.exchange(true))
+                        error = std::current_exception();
+                }
+            });
+        });
+
+        if (nullptr != error)
+        {
+            for (Node* const node : nodes)
+            {
+                if (nullptr != node)
+                    destroy_node(node);
+            }
+            std::rethrow_exception(error);
+        }
+
+        // no guard
+        // for simple remove of fake lock by optimizer
+        m_lock.lock();
+
+        Node* const root = m_tree.root();
+        const size_t old_size = m_tree.size();
+
+        m_tree.build_from_sorted(pool, nodes.begin(), nodes.end());
+
+        m_lock.unlock();
+
+        dispose_detached(pool, root, old_size);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::clear(ThreadPool& pool) noexcept
+    {
+        clear_with([this, &pool]() { m_tree.clearWithDispose(pool, [this](Node* node) { destroy_node(node); }); });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::dispose_detached(ThreadPool& pool, Node* root, size_t size) noexcept
+    {
+        if constexpr (IsOptimisticLock<L>::value)
+        {
+            dispose_detached(root, size);
+        }
+        else
+        {
+            tree_t detached;
+            detached.adopt(root, size);
+            detached.clearWithDispose(pool, [this](Node* node) { destroy_node(node); });
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::unite(ThreadPool& pool, RBTree& other)
+    {
+        assert(this != &other);
+        check_allocator(other);
+
+        // duplicates linked by m_parent, from the pool threads at once
+        std::atomic<Node*> duplicates(nullptr);
+
+        lock_splice(other, other);
+
+        const size_t res = m_tree.unite(pool, other.m_tree, [&duplicates](Node* node)
+        {
+            Node* head = duplicates.load(std::memory_order_relaxed);
+            do
+            {
+                node->m_parent = head;
+            }
+            while (!duplicates.compare_exchange_weak(head, node, std::memory_order_relaxed));
+        });
+
+        unlock_pair(other, false);
+
+        // optimistic readers of other may still stay on them
+        other.retire(duplicates.load(std::memory_order_relaxed));
+
+        return res;
+    }
+}
@@ -0,0 +1,441 @@
+#pragma once
+
+#include "stdint.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <new>
+#include "locks.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // Objects of one size are packed into big cache aligned slabs, freed ones go to a free list.
+    // Every thread works with its own magazine (small free list) and touches
+    // the shared free list only by batches.
+    class SlabPool
+    {
+        friend class PoolSet;
+
+        static constexpr size_t s_cache_line = 64;
+
+        static constexpr size_t s_slab_size = 64 * 1024;
+
+        static constexpr uint32_t s_nmagazines = 64;
+
+        // a free drains the magazine past 2 * s_batch objects,
+        // a refill may add up to s_batch - 1 more to it
+        static constexpr uint32_t s_batch = 32;
+
+        struct FreeObject
+        {
+            FreeObject* m_next;
+        };
+
+        struct Slab
+        {
+            Slab* m_next;
+        };
+
+        struct alignas(s_cache_line) Magazine
+        {
+            SpinLock m_lock;
+
+            FreeObject* m_head = nullptr;
+
+            uint32_t m_count = 0;
+        };
+
+    public:
+
+        // objects of one stride may be of any type with sizeof == stride
+        static constexpr size_t stride(size_t size) noexcept
+        { return (size < sizeof(FreeObject)) ? sizeof(FreeObject) : size; }
+
+        explicit SlabPool(size_t stride) noexcept;
+
+        ~SlabPool();
+
+        SlabPool(const SlabPool& other) = delete;
+        SlabPool(SlabPool&& other) noexcept = delete;
+        SlabPool& operator=(const SlabPool& other) = delete;
+        SlabPool& operator=(SlabPool&& other) noexcept = delete;
+
+        void* allocate();
+
+        void deallocate(void* ptr) noexcept;
+
+        void release() noexcept;
+
+    private:
+
+        FreeObject* refill(uint32_t& count);
+
+        void drain(Magazine& magazine) noexcept;
+
+    private:
+
+        static constexpr size_t s_header = (sizeof(Slab) + s_cache_line - 1) / s_cache_line * s_cache_line;
+
+    private:
+
+        Magazine m_magazines[s_nmagazines];
+
+        const size_t m_stride;
+
+        // objects per slab
+        const size_t m_size;
+
+        SpinLock m_lock;
+
+        FreeObject* m_free;
+
+        char* m_bump;
+
+        char* m_bump_end;
+
+        Slab* m_slabs;
+
+        // the next pool of the set
+        SlabPool* m_next;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // Pools of all object sizes of a PoolAllocator, shared by its copies and rebinds.
+    // A pool is created by the first allocation of its size and lives as long as the set.
+    class PoolSet
+    {
+    public:
+
+        PoolSet() noexcept
+          : m_pools(nullptr),
+            m_lock()
+        { }
+
+        ~PoolSet();
+
+        PoolSet(const PoolSet& other) = delete;
+        PoolSet(PoolSet&& other) noexcept = delete;
+        PoolSet& operator=(const PoolSet& other) = delete;
+        PoolSet& operator=(PoolSet&& other) noexcept = delete;
+
+        // lock-free unless the pool is created
+        SlabPool& pool(size_t stride);
+
+        // the pool the object was allocated from, the stride must be seen by pool() already
+        SlabPool& existing(size_t stride) noexcept;
+
+        void release() noexcept;
+
+    private:
+
+        // newest first, never unlinked
+        std::atomic<SlabPool*> m_pools;
+
+        SpinLock m_lock;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // Copies and rebinds share the pools: PoolAllocator<U>(a) == b for any b == a;
+    // release() drops all slabs at once.
+    template<class T>
+    class PoolAllocator
+    {
+        template<class U>
+        friend class PoolAllocator;
+
+        static_assert(alignof(T) <= 64, "objects are aligned in cache aligned slabs");
+
+        static constexpr size_t s_stride = SlabPool::stride(sizeof(T));
+
+    public:
+
+        using value_type = T;
+
+        template<class U>
+        struct rebind
+        {
+            using other = PoolAllocator<U>;
+        };
+
+        PoolAllocator()
+          : m_pools(std::make_shared<PoolSet>())
+        { }
+
+        PoolAllocator(const PoolAllocator& other) noexcept = default;
+
+        template<class U>
+        PoolAllocator(const PoolAllocator<U>& other) noexcept
+          : m_pools(other.m_pools)
+        { }
+
+        PoolAllocator& operator=(const PoolAllocator& other) noexcept = default;
+
+        T* allocate(size_t n);
+
+        void deallocate(T* ptr, size_t n) noexcept;
+
+        // frees all slabs of all sizes, all objects from the pools are gone
+        // false - pools are shared with other allocator, nothing is done
+        bool release() noexcept;
+
+        template<class U>
+        bool operator==(const PoolAllocator<U>& other) const noexcept { return m_pools == other.m_pools; }
+        template<class U>
+        bool operator!=(const PoolAllocator<U>& other) const noexcept { return m_pools != other.m_pools; }
+
+    private:
+
+        std::shared_ptr<PoolSet> m_pools;
+    };
+
+    //--------------------------------------------------------------//
+    template<class T>
+    T* PoolAllocator<T>::allocate(size_t n)
+    {
+        if (1 != n)
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignof(T))));
+
+        return static_cast<T*>(m_pools->pool(s_stride).allocate());
+    }
+
+    //--------------------------------------------------------------//
+    template<class T>
+    void PoolAllocator<T>::deallocate(T* ptr, size_t n) noexcept
+    {
+        if (1 != n)
+        {
+            ::operator delete(ptr, std::align_val_t(alignof(T)));
+            return;
+        }
+
+        m_pools->existing(s_stride).deallocate(ptr);
+    }
+
+    //--------------------------------------------------------------//
+    template<class T>
+    bool PoolAllocator<T>::release() noexcept
+    {
+        if (1 != m_pools.use_count())
+            return false;
+
+        m_pools->release();
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+    inline PoolSet::~PoolSet()
+    {
+        SlabPool* pool = m_pools.load(std::memory_order_relaxed);
+        while (nullptr != pool)
+        {
+            SlabPool* const next = pool->m_next;
+            delete pool;
+            pool = next;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    inline SlabPool& PoolSet::pool(size_t stride)
+    {
+        for (SlabPool* pool = m_pools.load(std::memory_order_acquire); nullptr != pool; pool = pool->m_next)
+        {
+            if (stride == pool->m_stride)
+                return *pool;
+        }
+
+        std::lock_guard<SpinLock> guard(m_lock);
+
+        // may be created meanwhile
+        SlabPool* const head = m_pools.load(std::memory_order_relaxed);
+        for (SlabPool* pool = head; nullptr != pool; pool = pool->m_next)
+        {
+            if (stride == pool->m_stride)
+                return *pool;
+        }
+
+        SlabPool* const pool = new SlabPool(stride);
+        pool->m_next = head;
+        m_pools.store(pool, std::memory_order_release);
+
+        return *pool;
+    }
+
+    //--------------------------------------------------------------//
+    inline SlabPool& PoolSet::existing(size_t stride) noexcept
+    {
+        SlabPool* pool = m_pools.load(std::memory_order_acquire);
+        while (stride != pool->m_stride)
+            pool = pool->m_next;
+
+        return *pool;
+    }
+
+    //--------------------------------------------------------------//
+    inline void PoolSet::release() noexcept
+    {
+        for (SlabPool* pool = m_pools.load(std::memory_order_acquire); nullptr != pool; pool = pool->m_next)
+            pool->release();
+    }
+
+    //--------------------------------------------------------------//
+    inline SlabPool::SlabPool(size_t stride) noexcept
+      : m_magazines(),
+        m_stride(stride),
+        m_size(((s_slab_size - s_header) / stride < s_batch * 2) ? s_batch * 2 : (s_slab_size - s_header) / stride),
+        m_lock(),
+        m_free(nullptr),
+        m_bump(nullptr),
+        m_bump_end(nullptr),
+        m_slabs(nullptr),
+        m_next(nullptr)
+    { }
+
+    //--------------------------------------------------------------//
+    inline SlabPool::~SlabPool()
+    {
+        release();
+    }
+
+    //--------------------------------------------------------------//
+    inline void* SlabPool::allocate()
+    {
+        Magazine& magazine = m_magazines[ThreadIndex() % s_nmagazines];
+
+        magazine.m_lock.lock();
+        FreeObject* object = magazine.m_head;
+        if (nullptr != object)
+        {
+            magazine.m_head = object->m_next;
+            --magazine.m_count;
+            magazine.m_lock.unlock();
+
+            return object;
+        }
+        magazine.m_lock.unlock();
+
+        uint32_t count = 0;
+        object = refill(count);
+        if (1 < count)
+        {
+            FreeObject* last = object->m_next;
+            while (nullptr != last->m_next)
+                last = last->m_next;
+
+            magazine.m_lock.lock();
+            last->m_next = magazine.m_head;
+            magazine.m_head = object->m_next;
+            magazine.m_count += count - 1;
+            magazine.m_lock.unlock();
+        }
+
+        return object;
+    }
+
+    //--------------------------------------------------------------//
+    inline void SlabPool::deallocate(void* ptr) noexcept
+    {
+        Magazine& magazine = m_magazines[ThreadIndex() % s_nmagazines];
+        FreeObject* const object = static_cast<FreeObject*>(ptr);
+
+        magazine.m_lock.lock();
+        object->m_next = magazine.m_head;
+        magazine.m_head = object;
+        ++magazine.m_count;
+
+        if (2 * s_batch < magazine.m_count)
+            drain(magazine);
+
+        magazine.m_lock.unlock();
+    }
+
+    //--------------------------------------------------------------//
+    inline void SlabPool::release() noexcept
+    {
+        for (Magazine& magazine : m_magazines)
+        {
+            magazine.m_head = nullptr;
+            magazine.m_count = 0;
+        }
+
+        Slab* slab = m_slabs;
+        while (nullptr != slab)
+        {
+            Slab* const next = slab->m_next;
+            ::operator delete(slab, std::align_val_t(s_cache_line));
+            slab = next;
+        }
+
+        m_slabs = nullptr;
+        m_free = nullptr;
+        m_bump = nullptr;
+        m_bump_end = nullptr;
+    }
+
+    //--------------------------------------------------------------//
+    inline SlabPool::FreeObject* SlabPool::refill(uint32_t& count)
+    {
+        // returns list of [1, s_batch] objects
+
+        std::lock_guard<SpinLock> guard(m_lock);
+
+        if (nullptr != m_free)
+        {
+            FreeObject* const head = m_free;
+            FreeObject* last = head;
+            count = 1;
+            while (count < s_batch && nullptr != last->m_next)
+            {
+                last = last->m_next;
+                ++count;
+            }
+
+            m_free = last->m_next;
+            last->m_next = nullptr;
+            return head;
+        }
+
+        if (m_bump == m_bump_end)
+        {
+            Slab* const slab = static_cast<Slab*>(::operator new(s_header + m_stride * m_size,
+                                                                 std::align_val_t(s_cache_line)));
+            slab->m_next = m_slabs;
+            m_slabs = slab;
+
+            m_bump = reinterpret_cast<char*>(slab) + s_header;
+            m_bump_end = m_bump + m_stride * m_size;
+        }
+
+        FreeObject* head = nullptr;
+        for (count = 0; count < s_batch && m_bump != m_bump_end; ++count)
+        {
+            FreeObject* const object = reinterpret_cast<FreeObject*>(m_bump_end - m_stride);
+            m_bump_end -= m_stride;
+
+            object->m_next = head;
+            head = object;
+        }
+
+        return head;
+    }
+
+    //--------------------------------------------------------------//
+    inline void SlabPool::drain(Magazine& magazine) noexcept
+    {
+        // magazine is locked, gives s_batch objects back to the pool
+        FreeObject* const head = magazine.m_head;
+        FreeObject* last = head;
+        for (uint32_t i = 1; i < s_batch; ++i)
+            last = last->m_next;
+
+        magazine.m_head = last->m_next;
+        magazine.m_count -= s_batch;
+
+        std::lock_guard<SpinLock> guard(m_lock);
+        last->m_next = m_free;
+        m_free = head;
+    }
+}
@@ -1,21 +1,34 @@
 #pragma once
 
 #include "stdint.h"
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+#include "epoch.h"
+#include "frozenrbtree.h"
+#include "locks.h"
 #include "nonoderbtree.h"
 
 namespace RBTree
 {
     //////////////////////////////////////////////////////////////////
 
-    struct FakeLock
-    {
-        inline void lock() { };
-        inline void unlock() { };
-    };
+    // Allocator with release() - frees everything it gave out at once (PoolAllocator)
+    template<class A, class = void>
+    struct IsReleasableAllocator : std::false_type { };
+
+    template<class A>
+    struct IsReleasableAllocator<A, std::void_t<
+        decltype(std::declval<A&>().release())>> : std::true_type { };
 
     //////////////////////////////////////////////////////////////////
 
-    template<class K, class V, class Lock = FakeLock>
+    template<class K, class V, class Lock = FakeLock, class Allocator = std::allocator<std::pair<const K, V>>>
     class RBTree
     {
         struct Node
@@ -43,12 +56,70 @@ namespace RBTree
             V m_value;
         };
 
+        using node_allocator_t = typename std::allocator_traits<Allocator>::template rebind_alloc<Node>;
+
+        using node_traits_t = std::allocator_traits<node_allocator_t>;
+
+        using tree_t = NoNodeRBTree<K, Node*>;
+
+        struct NoReclaimer { };
+
+        // nodes placed by compact(), freed with the last of them:
+        // erased ones may wait for optimistic readers longer than the block is current
+        struct Block
+        {
+            Block(Node* nodes, size_t size) noexcept
+              : m_nodes(nodes), m_size(size), m_live(size), m_next(nullptr)
+            { }
+
+            // nullptr once freed
+            std::atomic<Node*> m_nodes;
+
+            const size_t m_size;
+
+            // nodes not destroyed yet
+            std::atomic<size_t> m_live;
+
+            Block* m_next;
+        };
+
+        // erased nodes wait for optimistic readers (SeqLock) in it
+        using reclaimer_t = std::conditional_t<IsOptimisticLock<Lock>::value,
+            EpochReclaimer<Node, &Node::m_parent>, NoReclaimer>;
+
+        // insert or erase published to the combiner (FlatCombiningLock)
+        struct Write
+        {
+            std::atomic<bool> m_is_done;
+
+            // the node to insert, nullptr for erase
+            Node* m_node;
+
+            const K* m_key;
+
+            // insert: the node with the key
+            typename tree_t::iterator m_pos;
+
+            // erase: the unlinked node, nullptr if there was none
+            Node* m_erased;
+        };
+
     public:
 
-        class iterator;
+        template<class TreeIterator>
+        class basic_iterator;
+
+        using iterator = basic_iterator<typename tree_t::iterator>;
 
-        RBTree()
-          : m_tree()
+        // walks from back() to front(), *it is the value it points to
+        using reverse_iterator = basic_iterator<typename tree_t::reverse_iterator>;
+
+        explicit RBTree(const Allocator& alloc = Allocator())
+          : m_tree(),
+            m_alloc(alloc),
+            m_reclaimer(),
+            m_blocks(nullptr),
+            m_is_compacted(false)
         { }
 
         ~RBTree()
@@ -69,170 +140,1335 @@ namespace RBTree
 
         std::pair<iterator, bool> insert(const std::pair<K, V>& value);
 
+        // as std::map: O(1) search if hint is the position just after the key
+        // (or just before it, for increasing keys), descent from the hint otherwise
+        template<typename... Args>
+        iterator emplace_hint(iterator hint, Args&&... args);
+
+        iterator insert(iterator hint, const std::pair<K, V>& value);
+
+        // pairs sorted by key, one lock for the whole batch, nodes are allocated before it
+        // returns number of inserted pairs
+        template<class It>
+        size_t insert_batch(It first, It last);
+
         size_t erase(K key);
 
+        // returns iterator to the next one
+        iterator erase(iterator pos);
+
+        // min/max pair unlinked under one lock, nullopt for empty tree
+        std::optional<std::pair<K, V>> pop_front();
+        std::optional<std::pair<K, V>> pop_back();
+
+        // sorted keys, one lock for the whole batch
+        // returns number of erased keys
+        template<class It>
+        size_t erase_batch(It first, It last);
+
+        // erases keys in [first, last): O(log n) under the lock plus unlinking of the erased nodes,
+        // they are destroyed after it, returns their number
+        size_t erase_range(const K& first, const K& last);
+
+        // moves keys not less than the key to the empty right tree under the locks of both,
+        // O(log n + the smaller part): sizes of the parts are counted (NoNodeRBTree::split())
+        // Trees must have equal allocators (PoolAllocator: copies of one), std::invalid_argument otherwise.
+        // Nodes placed by compact() are moved out of the block first, O(n) once after every compact().
+        void split(const K& key, RBTree& right);
+
+        // moves all keys of right, greater than the keys here, to this tree, O(log n) under the locks of both
+        // The same requirements as for split().
+        void join(RBTree& right);
+
+        // Set algebra by join-based divide and conquer: O(m log(n / m + 1)) for sizes m <= n
+        // under the locks of both trees, unlinked nodes are destroyed after them.
+
+        // moves nodes of other here, other gets empty, its pairs with keys already here are destroyed
+        // The same requirements as for split(). Returns number of moved pairs.
+        size_t unite(RBTree& other);
+
+        // erases keys missing in other, returns their number
+        size_t intersect(const RBTree& other);
+
+        // erases keys present in other, returns their number
+        size_t subtract(const RBTree& other);
+
+        iterator find(const K& key) const;
+
+        bool contains(const K& key) const;
+
+        size_t count(const K& key) const;
+
+        iterator lower_bound(const K& key) const;
+
+        iterator upper_bound(const K& key) const;
+
+        std::pair<iterator, iterator> equal_range(const K& key) const;
+
+        // visitor(const K&, const V&) in key order under shared lock
+        template<class Visitor>
+        void for_each(Visitor visitor) const;
+
+        // visitor(const K&, const V&) for keys in [first, last), under shared lock
+        template<class Visitor>
+        void for_each_range(const K& first, const K& last, Visitor visitor) const;
+
+        // [first, last) - pairs with strictly increasing keys, O(n)
+        // replaces content, nodes are allocated before the lock is taken,
+        // the old ones are detached under it and destroyed after it
+        template<class It>
+        void build_from_sorted(It first, It last);
+
+        // copy of the current content for lock-free readers, O(n) walk under shared lock,
+        // arrays are allocated before it
+        FrozenRBTree<K, V> freeze() const;
+
+        // releasable allocator (PoolAllocator) drops its slabs without tree walk
         void clear() noexcept;
 
+        // Parallel bulk operations over ThreadPool (threadpool.h), defined in parallel.h, see NoNodeRBTree.
+
+        // as build_from_sorted(), nodes are created by the pool threads too, random access iterators
+        template<class It>
+        void build_from_sorted(ThreadPool& pool, It first, It last);
+
+        // visitor(const K&, const V&) from the pool threads at once under shared lock,
+        // in key order within every forked subtree, an exception of visitor comes out after unlock
+        template<class Visitor>
+        void for_each(ThreadPool& pool, Visitor visitor) const;
+
+        // combine(combine(identity, map(const K&, const V&)), ...) in key order under shared lock,
+        // combine must be associative and identity neutral for it; exceptions come out after unlock
+        template<class T, class Map, class Combine>
+        T reduce(ThreadPool& pool, T identity, Map map, Combine combine) const;
+
+        // as clear(), nodes are destroyed by the pool threads
+        void clear(ThreadPool& pool) noexcept;
+
+        // as unite(), the halves of the top splits are united by the pool threads
+        size_t unite(ThreadPool& pool, RBTree& other);
+
+        // Optimistic lock (SeqLock): find/contains/count don't lock at all, they pin an epoch
+        // (epoch.h) instead. Erased nodes wait in per-thread lists until no pinned reader
+        // can stay on them and are destroyed by batches by later erases of the same thread.
+        // The iterator of find() is valid as long as its key isn't erased, as for other locks.
+
+        // destroys erased nodes at once, call it when no optimistic reader is running
+        void reclaim() noexcept;
+
+        // erased nodes not destroyed yet, 0 without optimistic readers
+        size_t retired() const noexcept;
+
+        // Moves all nodes into one block in van Emde Boas order: a lookup touches
+        // O(log n / log B) cache lines/pages instead of O(log n). For read-mostly trees,
+        // later inserts are allocated as usual, the block is freed with the last of its nodes.
+        // Iterators are invalidated. The size is rechecked under the lock, the block is
+        // allocated again if a writer changed it; old nodes are retired as erased ones.
+        void compact();
+
         size_t size() const noexcept;
 
     public:
 
-        class iterator : public std::iterator<std::input_iterator_tag, V> {
-            friend class RBTree<K, V, Lock>;
+        // bidirectional, --end() is the last value
+        template<class TreeIterator>
+        class basic_iterator : public std::iterator<std::bidirectional_iterator_tag, V> {
+            friend class RBTree<K, V, Lock, Allocator>;
 
-            iterator(typename NoNodeRBTree<K, Node*>::iterator it) : m_it(it) { }
+            basic_iterator(TreeIterator it) : m_it(it) { }
 
         public:
 
-            iterator(const iterator& it) : m_it(it.m_it) { }
-            ~iterator() = default;
+            // singular, only to be assigned to
+            basic_iterator() : m_it() { }
+            basic_iterator(const basic_iterator& it) : m_it(it.m_it) { }
+            ~basic_iterator() = default;
 
-            iterator& operator=(const iterator& it) { m_it = it.m_it; return *this; }
+            basic_iterator& operator=(const basic_iterator& it) { m_it = it.m_it; return *this; }
 
             const V& operator*() const noexcept { return m_it->m_value; }
             std::pair<K, V> operator*() { return std::pair<K, V>(m_it->m_key, m_it->m_value); }
             V operator->() const { return m_it; }
 
-            iterator& operator++() { ++m_it; return *this; }
-            iterator operator++(int) { iterator it(*this); ++m_it; return it; }
+            const K& key() const noexcept { return m_it->m_key; }
+            const V& value() const noexcept { return m_it->m_value; }
+
+            basic_iterator& operator++() { ++m_it; return *this; }
+            basic_iterator operator++(int) { basic_iterator it(*this); ++m_it; return it; }
+
+            basic_iterator& operator--() { --m_it; return *this; }
+            basic_iterator operator--(int) { basic_iterator it(*this); --m_it; return it; }
 
-            bool operator==(const iterator& other) const { return m_it == other.m_it; }
-            bool operator!=(const iterator& other) const { return m_it != other.m_it; }
+            bool operator==(const basic_iterator& other) const { return m_it == other.m_it; }
+            bool operator!=(const basic_iterator& other) const { return m_it != other.m_it; }
 
         private:
 
-            typename NoNodeRBTree<K, Node*>::iterator m_it;
+            TreeIterator m_it;
         };
 
         iterator begin() const { return iterator(m_tree.begin()); }
         iterator end()   const { return iterator(m_tree.end());   }
 
+        reverse_iterator rbegin() const { return reverse_iterator(m_tree.rbegin()); }
+        reverse_iterator rend()   const { return reverse_iterator(m_tree.rend());   }
+
+        // min/max, end() for empty tree, O(1)
+        iterator front() const { return iterator(m_tree.front()); }
+        iterator back()  const { return iterator(m_tree.back());  }
+
     public:
 
         bool checkRB() { return m_tree.checkRB(); }
 
     private:
 
-        NoNodeRBTree<K, Node*> m_tree;
+        tree_t m_tree;
 
     private:
 
-        Lock m_lock;
+        inline void lock_shared() const;
+
+        inline void unlock_shared() const;
+
+        // m_tree.insert() under the lock or by the combiner
+        std::pair<typename tree_t::iterator, bool> insert_node(Node* node) noexcept;
+
+        // unlinks the node with the key under the lock or by the combiner, nullptr if there is none
+        Node* unlink(const K& key) noexcept;
+
+        // one pass of the combiner, the lock is held
+        void combine(Write** writes, size_t count) noexcept;
+
+        std::optional<std::pair<K, V>> pop(bool is_front);
+
+        // clear() with dispose() for the nodes of the tree
+        template<class Dispose>
+        void clear_with(Dispose dispose) noexcept;
+
+        // locks of two trees, always in the same order, other is locked shared if is_shared
+        void lock_pair(const RBTree& other, bool is_shared);
+
+        void unlock_pair(const RBTree& other, bool is_shared);
+
+        // std::invalid_argument if nodes of other can't be freed by the allocator here
+        void check_allocator(const RBTree& other) const;
+
+        // lock_pair(other, false) once the donor, which gives its nodes to the other tree,
+        // has none in blocks of compact()
+        void lock_splice(RBTree& other, RBTree& donor);
+
+        // moves the nodes out of the blocks of compact() into nodes of their own
+        void detach_blocks();
+
+        // under the lock: nodes[i] (all nodes of the tree) is moved to copy_of(i),
+        // the old node keeps the address of its copy in m_left for relocate()
+        template<class CopyOf>
+        void move_nodes(const std::vector<Node*>& nodes, CopyOf copy_of) noexcept;
+
+        // old nodes of move_nodes() after the lock
+        void retire_moved(const std::vector<Node*>& nodes) noexcept;
+
+        template<typename... Args>
+        inline Node* create_node(Args&&... args);
+
+        // node of a block is destroyed in place, the block is freed with the last one
+        inline void destroy_node(Node* node) noexcept;
+
+        void destroy_list(Node* node) noexcept;
+
+        // nodes of the tree detached under the lock, destroyed one by one after it
+        // (retired with optimistic readers), never by release() of the allocator
+        void dispose_detached(Node* root, size_t size) noexcept;
+
+        // as dispose_detached(), nodes are destroyed by the pool threads
+        // (retired by this thread with optimistic readers)
+        void dispose_detached(ThreadPool& pool, Node* root, size_t size) noexcept;
+
+        // nodes linked by m_parent, unlinked from the tree: destroyed at once
+        // or, with optimistic readers, once none of them can stay on the nodes
+        void retire(Node* node) noexcept;
+
+    private:
+
+        // nodes created by one task of parallel build_from_sorted()
+        static constexpr size_t s_grain = 4096;
+
+        node_allocator_t m_alloc;
+
+        mutable Lock m_lock;
+
+        reclaimer_t m_reclaimer;
+
+        // blocks of compact(), newest first, headers are deleted by clear()
+        std::atomic<Block*> m_blocks;
+
+        // nodes of the tree are in blocks, under the lock
+        bool m_is_compacted;
     };
 
     //--------------------------------------------------------------//
-    template<class K, class V, class L>
+    template<class K, class V, class L, class A>
     template<typename... Args>
-    std::pair<typename RBTree<K, V, L>::iterator, bool> RBTree<K, V, L>::emplace(const K& key, Args&&... args)
+    std::pair<typename RBTree<K, V, L, A>::iterator, bool> RBTree<K, V, L, A>::emplace(const K& key, Args&&... args)
     {
-        RBTree<K, V, L>::Node* node = new Node(key, std::forward<Args>(args)...);
+        RBTree<K, V, L, A>::Node* node = create_node(key, std::forward<Args>(args)...);
+
+        const auto res = insert_node(node);
+
+        if (!res.second)
+            destroy_node(node);
+
+        return std::pair<iterator, bool>(iterator(res.first), res.second);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<typename... Args>
+    std::pair<typename RBTree<K, V, L, A>::iterator, bool> RBTree<K, V, L, A>::emplace(K&& key, Args&&... args)
+    {
+        RBTree<K, V, L, A>::Node* node =
+            create_node(std::forward<K>(key), std::forward<Args>(args)...);
+
+        const auto res = insert_node(node);
+
+        if (!res.second)
+            destroy_node(node);
+
+        return std::pair<iterator, bool>(iterator(res.first), res.second);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::pair<typename RBTree<K, V, L, A>::iterator, bool> RBTree<K, V, L, A>::insert(K const key, V const value)
+    {
+        RBTree<K, V, L, A>::Node* node = create_node(key, value);
+
+        const auto res = insert_node(node);
+
+        if (!res.second)
+            destroy_node(node);
+
+        return std::pair<iterator, bool>(iterator(res.first), res.second);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::pair<typename RBTree<K, V, L, A>::iterator, bool> RBTree<K, V, L, A>::insert(const std::pair<K, V>& value)
+    {
+        RBTree<K, V, L, A>::Node* node = create_node(value.first, value.second);
+
+        const auto res = insert_node(node);
+
+        if (!res.second)
+            destroy_node(node);
+
+        return std::pair<iterator, bool>(iterator(res.first), res.second);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<typename... Args>
+    typename RBTree<K, V, L, A>::iterator RBTree<K, V, L, A>::emplace_hint(iterator hint, Args&&... args)
+    {
+        RBTree<K, V, L, A>::Node* node = create_node(std::forward<Args>(args)...);
 
         // no guard
         // for simple remove of fake lock by optimizer
         m_lock.lock();
 
-        const auto res = m_tree.insert(node);
+        const auto res = m_tree.insert(hint.m_it, node);
 
         m_lock.unlock();
 
-        return std::pair<iterator, bool>(iterator(res.first), res.second);
+        if (node != *res)
+            destroy_node(node);
+
+        return iterator(res);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V, class L>
-    template<typename... Args>
-    std::pair<typename RBTree<K, V, L>::iterator, bool> RBTree<K, V, L>::emplace(K&& key, Args&&... args)
+    template<class K, class V, class L, class A>
+    typename RBTree<K, V, L, A>::iterator RBTree<K, V, L, A>::insert(iterator hint, const std::pair<K, V>& value)
+    {
+        return emplace_hint(hint, value.first, value.second);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class It>
+    size_t RBTree<K, V, L, A>::insert_batch(It first, It last)
     {
-        RBTree<K, V, L>::Node* node =
-            new Node(std::forward<K>(key), std::forward<Args>(args)...);
+        std::vector<Node*> nodes;
+        if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                      typename std::iterator_traits<It>::iterator_category>::value)
+        {
+            nodes.reserve(std::distance(first, last));
+        }
+
+        try
+        {
+            for (; last != first; ++first)
+            {
+                Node* const node = create_node(first->first, first->second);
+                nodes.push_back(node);
+            }
+        }
+        catch (...)
+        {
+            for (Node* const node : nodes)
+                destroy_node(node);
+            throw;
+        }
+
+        // duplicates linked by m_parent
+        Node* rejected = nullptr;
 
         // no guard
         // for simple remove of fake lock by optimizer
         m_lock.lock();
 
-        const auto res = m_tree.insert(node);
+        const size_t res = m_tree.insert_batch(nodes.begin(), nodes.end(),
+            [&rejected](Node* node) { node->m_parent = rejected; rejected = node; });
 
         m_lock.unlock();
 
-        return std::pair<iterator, bool>(iterator(res.first), res.second);
+        destroy_list(rejected);
+
+        return res;
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V, class L>
-    std::pair<typename RBTree<K, V, L>::iterator, bool> RBTree<K, V, L>::insert(K const key, V const value)
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::erase(K key)
     {
-        RBTree<K, V, L>::Node* node = new Node(key, value);
+        Node* const node = unlink(key);
+        if (nullptr == node)
+            return 0;
+
+        node->m_parent = nullptr;
+        retire(node);
+
+        return 1;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename RBTree<K, V, L, A>::iterator RBTree<K, V, L, A>::erase(iterator pos)
+    {
+        const auto iter = pos.m_it;
+        Node* const node = *iter;
 
         // no guard
         // for simple remove of fake lock by optimizer
         m_lock.lock();
 
-        const auto res = m_tree.insert(node);
+        const auto res = m_tree.erase(iter);
 
         m_lock.unlock();
 
-        return std::pair<iterator, bool>(iterator(res.first), res.second);
+        node->m_parent = nullptr;
+        retire(node);
+
+        return iterator(res);
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V, class L>
-    std::pair<typename RBTree<K, V, L>::iterator, bool> RBTree<K, V, L>::insert(const std::pair<K, V>& value)
+    template<class K, class V, class L, class A>
+    std::optional<std::pair<K, V>> RBTree<K, V, L, A>::pop_front()
     {
-        RBTree<K, V, L>::Node* node = new Node(std::pair<K, V>(value));
+        return pop(true);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::optional<std::pair<K, V>> RBTree<K, V, L, A>::pop_back()
+    {
+        return pop(false);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class It>
+    size_t RBTree<K, V, L, A>::erase_batch(It first, It last)
+    {
+        // erased nodes linked by m_parent
+        Node* erased = nullptr;
 
         // no guard
         // for simple remove of fake lock by optimizer
         m_lock.lock();
 
-        const auto res = m_tree.insert(node);
+        const size_t res = m_tree.erase_batch(first, last,
+            [&erased](Node* node) { node->m_parent = erased; erased = node; });
 
         m_lock.unlock();
 
-        return std::pair<iterator, bool>(iterator(res.first), res.second);
+        retire(erased);
+
+        return res;
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V, class L>
-    size_t RBTree<K, V, L>::erase(K key)
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::erase_range(const K& first, const K& last)
     {
+        // erased nodes linked by m_parent
+        Node* erased = nullptr;
+
         // no guard
         // for simple remove of fake lock by optimizer
         m_lock.lock();
 
-        const auto iter = m_tree.find(key);
+        const size_t res = m_tree.erase_range(first, last,
+            [&erased](Node* node) { node->m_parent = erased; erased = node; });
+
+        m_lock.unlock();
+
+        retire(erased);
+
+        return res;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::split(const K& key, RBTree& right)
+    {
+        assert(this != &right);
+        check_allocator(right);
+
+        lock_splice(right, *this);
+
+        assert(0 == right.m_tree.size());
+        m_tree.split(key, right.m_tree);
+
+        unlock_pair(right, false);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::join(RBTree& right)
+    {
+        assert(this != &right);
+        check_allocator(right);
+
+        lock_splice(right, right);
+
+        m_tree.join(right.m_tree);
+
+        unlock_pair(right, false);
+    }
 
-        if (m_tree.end() == iter)
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::unite(RBTree& other)
+    {
+        assert(this != &other);
+        check_allocator(other);
+
+        // duplicates linked by m_parent
+        Node* duplicates = nullptr;
+
+        lock_splice(other, other);
+
+        const size_t res = m_tree.unite(other.m_tree,
+            [&duplicates](Node* node) { node->m_parent = duplicates; duplicates = node; });
+
+        unlock_pair(other, false);
+
+        // optimistic readers of other may still stay on them
+        other.retire(duplicates);
+
+        return res;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::intersect(const RBTree& other)
+    {
+        assert(this != &other);
+
+        // erased nodes linked by m_parent
+        Node* erased = nullptr;
+
+        lock_pair(other, true);
+
+        const size_t res = m_tree.intersect(other.m_tree,
+            [&erased](Node* node) { node->m_parent = erased; erased = node; });
+
+        unlock_pair(other, true);
+
+        retire(erased);
+
+        return res;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::subtract(const RBTree& other)
+    {
+        assert(this != &other);
+
+        // erased nodes linked by m_parent
+        Node* erased = nullptr;
+
+        lock_pair(other, true);
+
+        const size_t res = m_tree.subtract(other.m_tree,
+            [&erased](Node* node) { node->m_parent = erased; erased = node; });
+
+        unlock_pair(other, true);
+
+        retire(erased);
+
+        return res;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename RBTree<K, V, L, A>::iterator RBTree<K, V, L, A>::find(const K& key) const
+    {
+        if constexpr (IsOptimisticLock<L>::value)
         {
-            m_lock.unlock();
+            // nodes erased meanwhile stay alive until the descent is over
+            const auto guard = m_reclaimer.pin();
+
+            auto res = m_tree.end();
+            while (true)
+            {
+                const uint64_t version = m_lock.read_begin();
+                racy_reads_begin();
+                const bool is_done = m_tree.find_optimistic(key, res);
+                racy_reads_end();
+                if (is_done && !m_lock.read_retry(version))
+                    return iterator(res);
+            }
+        }
 
-            return 0;
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const auto res = m_tree.find(key);
+
+        unlock_shared();
+
+        return iterator(res);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    bool RBTree<K, V, L, A>::contains(const K& key) const
+    {
+        if constexpr (IsOptimisticLock<L>::value)
+            return end() != find(key);
+
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const bool res = m_tree.contains(key);
+
+        unlock_shared();
+
+        return res;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::count(const K& key) const
+    {
+        return contains(key) ? 1 : 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename RBTree<K, V, L, A>::iterator RBTree<K, V, L, A>::lower_bound(const K& key) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const auto res = m_tree.lower_bound(key);
+
+        unlock_shared();
+
+        return iterator(res);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename RBTree<K, V, L, A>::iterator RBTree<K, V, L, A>::upper_bound(const K& key) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const auto res = m_tree.upper_bound(key);
+
+        unlock_shared();
+
+        return iterator(res);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::pair<typename RBTree<K, V, L, A>::iterator, typename RBTree<K, V, L, A>::iterator>
+    RBTree<K, V, L, A>::equal_range(const K& key) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        const auto res = m_tree.equal_range(key);
+
+        unlock_shared();
+
+        return std::pair<iterator, iterator>(iterator(res.first), iterator(res.second));
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class Visitor>
+    void RBTree<K, V, L, A>::for_each(Visitor visitor) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        m_tree.for_each([&visitor](const Node* node) { visitor(node->m_key, node->m_value); });
+
+        unlock_shared();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class Visitor>
+    void RBTree<K, V, L, A>::for_each_range(const K& first, const K& last, Visitor visitor) const
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        lock_shared();
+
+        m_tree.for_each_range(first, last, [&visitor](const Node* node) { visitor(node->m_key, node->m_value); });
+
+        unlock_shared();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class It>
+    void RBTree<K, V, L, A>::build_from_sorted(It first, It last)
+    {
+        std::vector<Node*> nodes;
+        if constexpr (std::is_base_of<std::forward_iterator_tag,
+                                      typename std::iterator_traits<It>::iterator_category>::value)
+        {
+            nodes.reserve(std::distance(first, last));
+        }
+
+        try
+        {
+            for (; last != first; ++first)
+            {
+                Node* const node = create_node(first->first, first->second);
+                nodes.push_back(node);
+            }
+        }
+        catch (...)
+        {
+            for (Node* const node : nodes)
+                destroy_node(node);
+            throw;
         }
 
-        const auto res = m_tree.erase(key);
+        // no guard
+        // for simple remove of fake lock by optimizer
+        m_lock.lock();
+
+        Node* const root = m_tree.root();
+        const size_t size = m_tree.size();
+
+        m_tree.build_from_sorted(nodes.begin(), nodes.end());
+
         m_lock.unlock();
 
-        Node* const node = *iter;
-        delete node;
+        dispose_detached(root, size);
+    }
 
-        assert(1 == res);
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    FrozenRBTree<K, V> RBTree<K, V, L, A>::freeze() const
+    {
+        std::vector<K> keys;
+        std::vector<V> values;
 
-        return 1;
+        // the size seen under the lock last time, the arrays are allocated out of it
+        size_t size = 0;
+        while (true)
+        {
+            keys.reserve(size);
+            values.reserve(size);
+
+            // no guard
+            // for simple remove of fake lock by optimizer
+            lock_shared();
+
+            // grown since the arrays were allocated
+            if (keys.capacity() < m_tree.size() || values.capacity() < m_tree.size())
+            {
+                size = m_tree.size();
+                unlock_shared();
+                continue;
+            }
+
+            // copies of K/V may still allocate (std::string)
+            try
+            {
+                m_tree.for_each([&keys, &values](const Node* node)
+                {
+                    keys.push_back(node->m_key);
+                    values.push_back(node->m_value);
+                });
+            }
+            catch (...)
+            {
+                unlock_shared();
+                throw;
+            }
+
+            unlock_shared();
+            break;
+        }
+
+        return FrozenRBTree<K, V>(std::move(keys), std::move(values));
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V, class L>
-    void RBTree<K, V, L>::clear() noexcept
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::clear() noexcept
     {
-        m_tree.clearWithDestruct();
+        clear_with([this]() { m_tree.clearWithDispose([this](Node* node) { destroy_node(node); }); });
     }
 
     //--------------------------------------------------------------//
-    template<class K, class V, class L>
-    size_t RBTree<K, V, L>::size() const noexcept
+    template<class K, class V, class L, class A>
+    template<class Dispose>
+    void RBTree<K, V, L, A>::clear_with(Dispose dispose) noexcept
+    {
+        if constexpr (IsReleasableAllocator<node_allocator_t>::value && std::is_trivially_destructible<Node>::value)
+        {
+            // false - pool is shared, nodes must be given back one by one
+            // blocks of compact() are given back by themselves
+            if (nullptr == m_blocks.load(std::memory_order_relaxed) && m_alloc.release())
+            {
+                m_tree.clear();
+                m_is_compacted = false;
+                if constexpr (IsOptimisticLock<L>::value)
+                    m_reclaimer.clear();
+
+                return;
+            }
+        }
+
+        dispose();
+        m_is_compacted = false;
+
+        reclaim();
+
+        // all their nodes are destroyed, so the blocks are freed
+        Block* block = m_blocks.exchange(nullptr, std::memory_order_acquire);
+        while (nullptr != block)
+        {
+            assert(nullptr == block->m_nodes.load(std::memory_order_relaxed));
+            Block* const next = block->m_next;
+            delete block;
+            block = next;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::reclaim() noexcept
+    {
+        if constexpr (IsOptimisticLock<L>::value)
+            m_reclaimer.reclaim([this](Node* node) { destroy_node(node); });
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::retired() const noexcept
+    {
+        if constexpr (IsOptimisticLock<L>::value)
+            return m_reclaimer.pending();
+        else
+            return 0;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::compact()
+    {
+        static_assert(std::is_nothrow_move_constructible<K>::value && std::is_nothrow_move_constructible<V>::value,
+                      "nodes are moved under the lock");
+
+        while (true)
+        {
+            // no guard
+            // for simple remove of fake lock by optimizer
+            lock_shared();
+
+            const size_t size = m_tree.size();
+
+            unlock_shared();
+
+            if (0 == size)
+                return;
+
+            Node* const slots = node_traits_t::allocate(m_alloc, size);
+            std::unique_ptr<Block> block;
+            std::vector<Node*> nodes;
+            try
+            {
+                block.reset(new Block(slots, size));
+                nodes.reserve(size);
+            }
+            catch (...)
+            {
+                node_traits_t::deallocate(m_alloc, slots, size);
+                throw;
+            }
+
+            // no guard
+            // for simple remove of fake lock by optimizer
+            m_lock.lock();
+
+            // changed since the block was allocated
+            if (size != m_tree.size())
+            {
+                m_lock.unlock();
+                node_traits_t::deallocate(m_alloc, slots, size);
+                continue;
+            }
+
+            m_tree.for_each_veb([&nodes](Node* node) { nodes.push_back(node); });
+            move_nodes(nodes, [slots](size_t i) { return slots + i; });
+            m_tree.relocate(slots, slots + size);
+
+            block->m_next = m_blocks.load(std::memory_order_relaxed);
+            m_blocks.store(block.release(), std::memory_order_release);
+            m_is_compacted = true;
+
+            m_lock.unlock();
+
+            retire_moved(nodes);
+            return;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    size_t RBTree<K, V, L, A>::size() const noexcept
     {
         return m_tree.size();
     }
 
     //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::lock_pair(const RBTree& other, bool is_shared)
+    {
+        // by address, so a.join(b) and b.join(a) can't deadlock
+        const auto lock_other = [&other, is_shared]()
+        {
+            if (is_shared)
+                other.lock_shared();
+            else
+                other.m_lock.lock();
+        };
+
+        if (this < &other)
+        {
+            m_lock.lock();
+            lock_other();
+        }
+        else
+        {
+            lock_other();
+            m_lock.lock();
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::unlock_pair(const RBTree& other, bool is_shared)
+    {
+        if (is_shared)
+            other.unlock_shared();
+        else
+            other.m_lock.unlock();
+
+        m_lock.unlock();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::check_allocator(const RBTree& other) const
+    {
+        if constexpr (!node_traits_t::is_always_equal::value)
+        {
+            if (!(m_alloc == other.m_alloc))
+                throw std::invalid_argument("RBTree: nodes of trees with unequal allocators can't be mixed");
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::lock_splice(RBTree& other, RBTree& donor)
+    {
+        while (true)
+        {
+            donor.detach_blocks();
+
+            lock_pair(other, false);
+
+            // compacted again meanwhile
+            if (!donor.m_is_compacted)
+                return;
+
+            unlock_pair(other, false);
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::detach_blocks()
+    {
+        static_assert(std::is_nothrow_move_constructible<K>::value && std::is_nothrow_move_constructible<V>::value,
+                      "nodes are moved under the lock");
+
+        while (true)
+        {
+            // no guard
+            // for simple remove of fake lock by optimizer
+            lock_shared();
+
+            const size_t size = m_tree.size();
+            const bool is_compacted = m_is_compacted;
+
+            unlock_shared();
+
+            if (!is_compacted)
+                return;
+
+            std::vector<Node*> copies;
+            std::vector<Node*> nodes;
+            try
+            {
+                nodes.reserve(size);
+                copies.reserve(size);
+                while (copies.size() < size)
+                    copies.push_back(node_traits_t::allocate(m_alloc, 1));
+            }
+            catch (...)
+            {
+                for (Node* const copy : copies)
+                    node_traits_t::deallocate(m_alloc, copy, 1);
+                throw;
+            }
+
+            // no guard
+            // for simple remove of fake lock by optimizer
+            m_lock.lock();
+
+            // changed since the nodes were allocated
+            if (size != m_tree.size() || !m_is_compacted)
+            {
+                m_lock.unlock();
+                for (Node* const copy : copies)
+                    node_traits_t::deallocate(m_alloc, copy, 1);
+                continue;
+            }
+
+            m_tree.for_each_veb([&nodes](Node* node) { nodes.push_back(node); });
+            move_nodes(nodes, [&copies](size_t i) { return copies[i]; });
+            m_tree.relocate(copies.begin(), copies.end());
+            m_is_compacted = false;
+
+            m_lock.unlock();
+
+            retire_moved(nodes);
+            return;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<class CopyOf>
+    void RBTree<K, V, L, A>::move_nodes(const std::vector<Node*>& nodes, CopyOf copy_of) noexcept
+    {
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            Node* const node = nodes[i];
+            Node* const copy = copy_of(i);
+            node_traits_t::construct(m_alloc, copy, std::move(node->m_key), std::move(node->m_value));
+            copy->m_parent = node->m_parent;
+            copy->m_left = node->m_left;
+            copy->m_right = node->m_right;
+            node->m_left = copy;
+        }
+    }
 
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::retire_moved(const std::vector<Node*>& nodes) noexcept
+    {
+        // optimistic readers may still stay on the old nodes
+        Node* list = nullptr;
+        for (Node* const node : nodes)
+        {
+            node->m_parent = list;
+            list = node;
+        }
+
+        retire(list);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::destroy_list(Node* node) noexcept
+    {
+        while (nullptr != node)
+        {
+            Node* const next = node->m_parent;
+            destroy_node(node);
+            node = next;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::dispose_detached(Node* root, size_t size) noexcept
+    {
+        // slabs of a releasable allocator may hold the new nodes as well
+        tree_t detached;
+        detached.adopt(root, size);
+
+        Node* list = nullptr;
+        detached.clearWithDispose([&list](Node* node)
+        {
+            node->m_parent = list;
+            list = node;
+        });
+
+        retire(list);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::retire(Node* node) noexcept
+    {
+        if constexpr (IsOptimisticLock<L>::value)
+            m_reclaimer.retire(node, [this](Node* node) { destroy_node(node); });
+        else
+            destroy_list(node);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    template<typename... Args>
+    typename RBTree<K, V, L, A>::Node* RBTree<K, V, L, A>::create_node(Args&&... args)
+    {
+        Node* const node = node_traits_t::allocate(m_alloc, 1);
+        try
+        {
+            node_traits_t::construct(m_alloc, node, std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            node_traits_t::deallocate(m_alloc, node, 1);
+            throw;
+        }
+
+        return node;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::destroy_node(Node* node) noexcept
+    {
+        node_traits_t::destroy(m_alloc, node);
+
+        for (Block* block = m_blocks.load(std::memory_order_acquire); nullptr != block; block = block->m_next)
+        {
+            Node* const nodes = block->m_nodes.load(std::memory_order_acquire);
+            const uintptr_t offset = (uintptr_t)node - (uintptr_t)nodes;
+            if (nullptr == nodes || block->m_size * sizeof(Node) <= offset)
+                continue;
+
+            // the memory may be given out again only after the block is marked freed
+            if (1 == block->m_live.fetch_sub(1, std::memory_order_acq_rel))
+            {
+                block->m_nodes.store(nullptr, std::memory_order_release);
+                node_traits_t::deallocate(m_alloc, nodes, block->m_size);
+            }
+
+            return;
+        }
+
+        node_traits_t::deallocate(m_alloc, node, 1);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::optional<std::pair<K, V>> RBTree<K, V, L, A>::pop(bool is_front)
+    {
+        // no guard
+        // for simple remove of fake lock by optimizer
+        m_lock.lock();
+
+        Node* const node = is_front ? m_tree.pop_front() : m_tree.pop_back();
+        if (nullptr == node)
+        {
+            m_lock.unlock();
+
+            return std::nullopt;
+        }
+
+        m_lock.unlock();
+
+        node->m_parent = nullptr;
+        if constexpr (IsOptimisticLock<L>::value)
+        {
+            // optimistic readers may still stay on the node, so it's copied
+            try
+            {
+                std::optional<std::pair<K, V>> res(std::in_place, node->m_key, node->m_value);
+                retire(node);
+
+                return res;
+            }
+            catch (...)
+            {
+                retire(node);
+                throw;
+            }
+        }
+        else
+        {
+            std::optional<std::pair<K, V>> res(std::in_place, std::move(node->m_key), std::move(node->m_value));
+            destroy_node(node);
+
+            return res;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::lock_shared() const
+    {
+        // exclusive for locks without shared mode (std::mutex)
+        if constexpr (IsSharedLock<L>::value)
+            m_lock.lock_shared();
+        else
+            m_lock.lock();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::unlock_shared() const
+    {
+        if constexpr (IsSharedLock<L>::value)
+            m_lock.unlock_shared();
+        else
+            m_lock.unlock();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    std::pair<typename RBTree<K, V, L, A>::tree_t::iterator, bool> RBTree<K, V, L, A>::insert_node(Node* node) noexcept
+    {
+        if constexpr (IsCombiningLock<L>::value)
+        {
+            Write write{{false}, node, &node->m_key, m_tree.end(), nullptr};
+            m_lock.execute(&write, [this](Write** writes, size_t count) { combine(writes, count); });
+
+            const auto& pos = write.m_pos;
+            return std::make_pair(pos, node == *pos);
+        }
+        else
+        {
+            // no guard
+            // for simple remove of fake lock by optimizer
+            m_lock.lock();
+
+            const auto res = m_tree.insert(node);
+
+            m_lock.unlock();
+
+            return res;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    typename RBTree<K, V, L, A>::Node* RBTree<K, V, L, A>::unlink(const K& key) noexcept
+    {
+        if constexpr (IsCombiningLock<L>::value)
+        {
+            Write write{{false}, nullptr, &key, m_tree.end(), nullptr};
+            m_lock.execute(&write, [this](Write** writes, size_t count) { combine(writes, count); });
+
+            return write.m_erased;
+        }
+        else
+        {
+            // no guard
+            // for simple remove of fake lock by optimizer
+            m_lock.lock();
+
+            const auto iter = m_tree.find(key);
+            Node* const node = (m_tree.end() == iter) ? nullptr : *iter;
+            if (nullptr != node)
+                m_tree.erase(iter);
+
+            m_lock.unlock();
+
+            return node;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, class A>
+    void RBTree<K, V, L, A>::combine(Write** writes, size_t count) noexcept
+    {
+        constexpr bool is_sorted = IsCombiningLock<L>::value && L::s_is_sorted;
+        if constexpr (is_sorted)
+        {
+            // writes of one pass are concurrent, any order of them is linearizable
+            std::sort(writes, writes + count, [](const Write* left, const Write* right)
+            {
+                return *left->m_key < *right->m_key;
+            });
+        }
+
+        // sorted: each descent starts from the previous position
+        auto hint = m_tree.end();
+        for (size_t i = 0; i < count; ++i)
+        {
+            Write* const write = writes[i];
+            if (nullptr != write->m_node)
+            {
+                hint = is_sorted ? m_tree.insert(hint, write->m_node) : m_tree.insert(write->m_node).first;
+                write->m_pos = hint;
+                continue;
+            }
+
+            const auto iter = is_sorted ? m_tree.find(hint, *write->m_key) : m_tree.find(*write->m_key);
+            if (m_tree.end() == iter)
+                continue;
+
+            write->m_erased = *iter;
+            hint = m_tree.erase(iter);
+        }
+    }
 }
@@ -0,0 +1,408 @@
+#pragma once
+
+#include "stdint.h"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <type_traits>
+#include <vector>
+#include "rbtree.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    template<class K>
+    struct HashPartition
+    {
+        static constexpr bool s_is_ordered = false;
+
+        inline size_t operator()(const K& key, size_t nshards) const noexcept
+        {
+            return std::hash<K>()(key) % nshards;
+        }
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // shard i holds keys in [bounds[i - 1], bounds[i])
+    template<class K>
+    struct RangePartition
+    {
+        static constexpr bool s_is_ordered = true;
+
+        RangePartition() = default;
+
+        explicit RangePartition(std::vector<K> bounds)
+          : m_bounds(std::move(bounds))
+        {
+            assert(std::is_sorted(m_bounds.begin(), m_bounds.end()));
+        }
+
+        // equal ranges for [min, max)
+        static RangePartition uniform(K min, K max, size_t nshards)
+        {
+            static_assert(std::is_arithmetic<K>(), "");
+
+            std::vector<K> bounds;
+            if constexpr (std::is_integral<K>::value)
+            {
+                // span * i overflows for wide ranges, max - min does too for signed keys
+                using U = std::make_unsigned_t<K>;
+                const U span = (U)max - (U)min;
+                const U step = span / nshards;
+                const U rest = span % nshards;
+                for (size_t i = 1; i < nshards; ++i)
+                    bounds.push_back((K)((U)min + step * i + (U)(rest * i / nshards)));
+            }
+            else
+            {
+                for (size_t i = 1; i < nshards; ++i)
+                    bounds.push_back(min + (K)((max - min) * i / nshards));
+            }
+
+            return RangePartition(std::move(bounds));
+        }
+
+        inline size_t operator()(const K& key, size_t nshards) const noexcept
+        {
+            const size_t shard = std::upper_bound(m_bounds.begin(), m_bounds.end(), key) - m_bounds.begin();
+            return std::min(shard, nshards - 1);
+        }
+
+        std::vector<K> m_bounds;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    // N independent trees, each with its own lock on its own cache lines.
+    // Iteration merges shards by key (concatenates them for ordered partition),
+    // it isn't locked as RBTree iteration isn't.
+    template<class K, class V, class Lock = FakeLock, size_t N = 16, class Partition = HashPartition<K>>
+    class ShardedRBTree
+    {
+        static_assert(0 < N, "");
+
+        using tree_t = RBTree<K, V, Lock>;
+
+        static constexpr size_t s_cache_line = 64;
+
+        struct alignas(s_cache_line) Shard
+        {
+            tree_t m_tree;
+        };
+
+    public:
+
+        class iterator;
+
+        explicit ShardedRBTree(const Partition& partition = Partition())
+          : m_partition(partition)
+        { }
+
+        ShardedRBTree(const ShardedRBTree& other) = delete;
+        ShardedRBTree(ShardedRBTree&& other) noexcept = delete;
+        ShardedRBTree& operator=(const ShardedRBTree& other) = delete;
+        ShardedRBTree& operator=(ShardedRBTree&& other) noexcept = delete;
+
+        template<typename... Args>
+        bool emplace(const K& key, Args&&... args);
+
+        bool insert(K const key, V const value);
+
+        bool insert(const std::pair<K, V>& value);
+
+        size_t erase(const K& key);
+
+        bool contains(const K& key) const;
+
+        size_t count(const K& key) const;
+
+        iterator find(const K& key) const;
+
+        iterator lower_bound(const K& key) const;
+
+        void clear() noexcept;
+
+        size_t size() const noexcept;
+
+    public:
+
+        class iterator : public std::iterator<std::input_iterator_tag, V> {
+            friend class ShardedRBTree<K, V, Lock, N, Partition>;
+
+            using shard_iterator = typename tree_t::iterator;
+
+            // one per shard, in place: no allocation per lookup
+            using shard_iterators = std::array<shard_iterator, N>;
+
+            iterator(const ShardedRBTree* tree, const shard_iterators& its, size_t current, bool is_lazy = false)
+              : m_tree(tree), m_its(its), m_current(current), m_is_lazy(is_lazy)
+            { }
+
+            // end()
+            explicit iterator(const ShardedRBTree* tree)
+              : m_tree(tree), m_its(), m_current(N), m_is_lazy(false)
+            { }
+
+        public:
+
+            iterator(const iterator& it) = default;
+            ~iterator() = default;
+
+            iterator& operator=(const iterator& it) = default;
+
+            const V& operator*() const noexcept { return *m_its[m_current]; }
+            std::pair<K, V> operator*() { return *m_its[m_current]; }
+
+            iterator& operator++()
+            {
+                if (m_is_lazy)
+                {
+                    m_tree->seek(m_its, m_its[m_current].key(), m_current);
+                    m_is_lazy = false;
+                }
+
+                ++m_its[m_current];
+                m_current = m_tree->next_shard(m_its, m_current);
+                return *this;
+            }
+            iterator operator++(int) { iterator it(*this); ++(*this); return it; }
+
+            bool operator==(const iterator& other) const { return m_current == other.m_current && (N == m_current || m_its[m_current] == other.m_its[m_current]); }
+            bool operator!=(const iterator& other) const { return !(*this == other); }
+
+        private:
+
+            const ShardedRBTree* m_tree;
+
+            shard_iterators m_its;
+
+            // N - end
+            size_t m_current;
+
+            // only m_its[m_current] is positioned (by find()), others are sought on ++
+            bool m_is_lazy;
+        };
+
+        iterator begin() const;
+        iterator end() const;
+
+    public:
+
+        bool checkRB();
+
+    private:
+
+        inline tree_t& shard(const K& key) noexcept;
+
+        inline const tree_t& shard(const K& key) const noexcept;
+
+        size_t next_shard(const typename iterator::shard_iterators& its, size_t current) const noexcept;
+
+        // positions its[i] of every shard but the skipped one at its first key not less than key
+        void seek(typename iterator::shard_iterators& its, const K& key, size_t skip) const;
+
+    private:
+
+        Shard m_shards[N];
+
+        Partition m_partition;
+    };
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    template<typename... Args>
+    bool ShardedRBTree<K, V, L, N, P>::emplace(const K& key, Args&&... args)
+    {
+        return shard(key).emplace(key, std::forward<Args>(args)...).second;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    bool ShardedRBTree<K, V, L, N, P>::insert(K const key, V const value)
+    {
+        return shard(key).insert(key, value).second;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    bool ShardedRBTree<K, V, L, N, P>::insert(const std::pair<K, V>& value)
+    {
+        return shard(value.first).insert(value).second;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    size_t ShardedRBTree<K, V, L, N, P>::erase(const K& key)
+    {
+        return shard(key).erase(key);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    bool ShardedRBTree<K, V, L, N, P>::contains(const K& key) const
+    {
+        return shard(key).contains(key);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    size_t ShardedRBTree<K, V, L, N, P>::count(const K& key) const
+    {
+        return shard(key).count(key);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    typename ShardedRBTree<K, V, L, N, P>::iterator ShardedRBTree<K, V, L, N, P>::find(const K& key) const
+    {
+        // one search, the key can only be in its own shard
+        const size_t current = m_partition(key, N);
+        const typename iterator::shard_iterator it = m_shards[current].m_tree.find(key);
+        if (m_shards[current].m_tree.end() == it)
+            return end();
+
+        typename iterator::shard_iterators its;
+        its[current] = it;
+        return iterator(this, its, current, true);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    typename ShardedRBTree<K, V, L, N, P>::iterator ShardedRBTree<K, V, L, N, P>::lower_bound(const K& key) const
+    {
+        const size_t first = m_partition(key, N);
+        typename iterator::shard_iterators its;
+        its[first] = m_shards[first].m_tree.lower_bound(key);
+        seek(its, key, first);
+
+        const size_t current = next_shard(its, 0);
+        return iterator(this, its, current);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    void ShardedRBTree<K, V, L, N, P>::clear() noexcept
+    {
+        for (Shard& shard : m_shards)
+            shard.m_tree.clear();
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    size_t ShardedRBTree<K, V, L, N, P>::size() const noexcept
+    {
+        size_t size = 0;
+        for (const Shard& shard : m_shards)
+            size += shard.m_tree.size();
+
+        return size;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    typename ShardedRBTree<K, V, L, N, P>::iterator ShardedRBTree<K, V, L, N, P>::begin() const
+    {
+        typename iterator::shard_iterators its;
+        for (size_t i = 0; i < N; ++i)
+            its[i] = m_shards[i].m_tree.begin();
+
+        const size_t current = next_shard(its, 0);
+        return iterator(this, its, current);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    typename ShardedRBTree<K, V, L, N, P>::iterator ShardedRBTree<K, V, L, N, P>::end() const
+    {
+        return iterator(this);
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    bool ShardedRBTree<K, V, L, N, P>::checkRB()
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            tree_t& tree = m_shards[i].m_tree;
+            if (!tree.checkRB())
+                return false;
+
+            for (auto it = tree.begin(); tree.end() != it; ++it)
+            {
+                if (i != m_partition(it.key(), N))
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    typename ShardedRBTree<K, V, L, N, P>::tree_t& ShardedRBTree<K, V, L, N, P>::shard(const K& key) noexcept
+    {
+        return m_shards[m_partition(key, N)].m_tree;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    const typename ShardedRBTree<K, V, L, N, P>::tree_t& ShardedRBTree<K, V, L, N, P>::shard(const K& key) const noexcept
+    {
+        return m_shards[m_partition(key, N)].m_tree;
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    size_t ShardedRBTree<K, V, L, N, P>::next_shard(
+        const typename iterator::shard_iterators& its, size_t current) const noexcept
+    {
+        if constexpr (P::s_is_ordered)
+        {
+            // shards are ordered, so just go on with the next non empty one
+            while (current < N && m_shards[current].m_tree.end() == its[current])
+                ++current;
+
+            return current;
+        }
+        else
+        {
+            // TODO: except
+            size_t min = N;
+            for (size_t i = 0; i < N; ++i)
+            {
+                if (m_shards[i].m_tree.end() == its[i])
+                    continue;
+
+                if (N == min || its[i].key() < its[min].key())
+                    min = i;
+            }
+
+            return min;
+        }
+    }
+
+    //--------------------------------------------------------------//
+    template<class K, class V, class L, size_t N, class P>
+    void ShardedRBTree<K, V, L, N, P>::seek(
+        typename iterator::shard_iterators& its, const K& key, size_t skip) const
+    {
+        for (size_t i = 0; i < N; ++i)
+        {
+            if (skip == i)
+                continue;
+
+            const tree_t& tree = m_shards[i].m_tree;
+            if constexpr (P::s_is_ordered)
+            {
+                // shards before the key's one are all less, after it - all greater
+                its[i] = (i < skip) ? tree.end() : tree.begin();
+            }
+            else
+            {
+                its[i] = tree.lower_bound(key);
+            }
+        }
+    }
+}
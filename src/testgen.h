@@ -150,6 +150,38 @@ namespace Test
 
     //////////////////////////////////////////////////////////////////
 
+    // increasing keys, as timestamps
+    inline void MonotonicTestGeneratorBucketed(std::vector<TestCommand>& sample, uint32_t sample_size, uint32_t nbuckets)
+    {
+        (void)nbuckets;
+        for (uint32_t i = 0; i < sample_size; ++i)
+        {
+            sample[i] = {i, true};
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////
+
+    // increasing keys, each one may be swapped with one of the next nbuckets
+    inline void NearSortedTestGeneratorBucketed(std::vector<TestCommand>& sample, uint32_t sample_size, uint32_t nbuckets)
+    {
+        for (uint32_t i = 0; i < sample_size; ++i)
+        {
+            sample[i] = {i, true};
+        }
+
+        Rand rand;
+
+        for (uint32_t i = 0; i < sample_size; ++i)
+        {
+            const uint32_t other = i + (rand.get() % (nbuckets + 1));
+            if (other < sample_size)
+                std::swap(sample[i], sample[other]);
+        }
+    }
+
+    //////////////////////////////////////////////////////////////////
+
     template<class T>
     inline std::vector<T*> GenValues(uint32_t size)
     {
@@ -0,0 +1,386 @@
+#pragma once
+
+#include "stdint.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // Fork-join pool for the parallel bulk operations of the trees.
+    // run(f) makes the calling thread a member of the pool for f(), invoke(left, right) inside it
+    // puts right to the thread's own queue, runs left and takes right back if nobody stole it.
+    // Idle members steal the oldest (biggest) tasks of the others, a waiting one helps them meanwhile.
+    // Queues are fixed rings: a fork past s_queue_size nested ones runs both tasks itself.
+    // An exception of a task leaves invoke() once the other task is done (right is skipped
+    // if left throws before it's stolen), then run(). Workers sleep between runs.
+    class ThreadPool
+    {
+        // forks of a thread not taken back yet, those of the tasks it helps with included
+        static constexpr uint32_t s_queue_size = 128;
+
+    public:
+
+        // nthreads with the calling one
+        explicit ThreadPool(uint32_t nthreads = std::thread::hardware_concurrency());
+
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool& other) = delete;
+        ThreadPool(ThreadPool&& other) noexcept = delete;
+        ThreadPool& operator=(const ThreadPool& other) = delete;
+        ThreadPool& operator=(ThreadPool&& other) noexcept = delete;
+
+        uint32_t size() const noexcept { return m_size; }
+
+        // levels of binary forks that leave enough tasks for balance, 0 for a single thread
+        uint32_t fork_depth() const noexcept;
+
+        // f() with the pool, one run at a time, nested runs just call f()
+        template<class F>
+        void run(F&& f);
+
+        // left() and right() in parallel inside run(), one after another outside of it
+        template<class Left, class Right>
+        void invoke(Left&& left, Right&& right);
+
+        // f(i) for i in [first, last), forks down to grain indexes
+        template<class F>
+        void for_range(size_t first, size_t last, size_t grain, F&& f);
+
+    private:
+
+        struct Task
+        {
+            void (*m_run)(Task* task);
+
+            std::atomic<bool> m_is_done;
+
+            // thrown by m_run in a stealing thread
+            std::exception_ptr m_error;
+        };
+
+        // lives on the stack of invoke(), which doesn't return until it's done
+        template<class F>
+        struct FunctionTask : Task
+        {
+            explicit FunctionTask(F& f) noexcept
+              : Task{&FunctionTask::call, {false}, nullptr},
+                m_f(f)
+            { }
+
+            static void call(Task* task) { static_cast<FunctionTask*>(task)->m_f(); }
+
+            F& m_f;
+        };
+
+        // the owner pushes and pops at the back, thieves take from the front
+        struct alignas(64) Queue
+        {
+            bool push_back(Task* task) noexcept;
+
+            // false if the task was stolen
+            bool pop_back(Task* task) noexcept;
+
+            Task* pop_front() noexcept;
+
+            std::mutex m_lock;
+
+            Task* m_tasks[s_queue_size] = {};
+
+            uint32_t m_first = 0;
+
+            uint32_t m_size = 0;
+        };
+
+    private:
+
+        void work(uint32_t index) noexcept;
+
+        // oldest task of other queues, nullptr if there is none
+        Task* steal(uint32_t index) noexcept;
+
+        static void execute(Task* task) noexcept;
+
+    private:
+
+        // pool and queue of the current thread while it's in the pool
+        static inline thread_local ThreadPool* s_pool = nullptr;
+
+        static inline thread_local uint32_t s_index = 0;
+
+        uint32_t m_size;
+
+        // 0 - the thread of run()
+        std::unique_ptr<Queue[]> m_queues;
+
+        std::vector<std::thread> m_threads;
+
+        std::mutex m_run_lock;
+
+        std::mutex m_lock;
+
+        std::condition_variable m_wake;
+
+        std::atomic<bool> m_is_active;
+
+        bool m_is_stopped;
+    };
+
+    //--------------------------------------------------------------//
+    inline ThreadPool::ThreadPool(uint32_t nthreads)
+      : m_size((0 == nthreads) ? 1 : nthreads),
+        m_queues(new Queue[m_size]),
+        m_threads(),
+        m_run_lock(),
+        m_lock(),
+        m_wake(),
+        m_is_active(false),
+        m_is_stopped(false)
+    {
+        m_threads.reserve(m_size - 1);
+        for (uint32_t index = 1; index < m_size; ++index)
+            m_threads.emplace_back([this, index]() { work(index); });
+    }
+
+    //--------------------------------------------------------------//
+    inline ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_is_stopped = true;
+        }
+        m_wake.notify_all();
+
+        for (std::thread& thread : m_threads)
+            thread.join();
+    }
+
+    //--------------------------------------------------------------//
+    inline uint32_t ThreadPool::fork_depth() const noexcept
+    {
+        if (1 == m_size)
+            return 0;
+
+        // 8 tasks per thread
+        uint32_t depth = 3;
+        for (uint32_t n = 1; n < m_size; n <<= 1)
+            ++depth;
+
+        return depth;
+    }
+
+    //--------------------------------------------------------------//
+    template<class F>
+    void ThreadPool::run(F&& f)
+    {
+        if (this == s_pool)
+        {
+            f();
+            return;
+        }
+
+        std::lock_guard<std::mutex> run_guard(m_run_lock);
+
+        {
+            std::lock_guard<std::mutex> guard(m_lock);
+            m_is_active.store(true, std::memory_order_relaxed);
+        }
+        m_wake.notify_all();
+
+        ThreadPool* const pool = s_pool;
+        const uint32_t index = s_index;
+        s_pool = this;
+        s_index = 0;
+
+        const auto finish = [this, pool, index]()
+        {
+            s_pool = pool;
+            s_index = index;
+            m_is_active.store(false, std::memory_order_relaxed);
+        };
+
+        try
+        {
+            f();
+        }
+        catch (...)
+        {
+            finish();
+            throw;
+        }
+
+        finish();
+    }
+
+    //--------------------------------------------------------------//
+    template<class Left, class Right>
+    void ThreadPool::invoke(Left&& left, Right&& right)
+    {
+        if (this != s_pool || 1 == m_size)
+        {
+            left();
+            right();
+            return;
+        }
+
+        FunctionTask<Right> task(right);
+        Queue& queue = m_queues[s_index];
+        if (!queue.push_back(&task))
+        {
+            left();
+            right();
+            return;
+        }
+
+        // right stays on the stack until a thief is done with it
+        std::exception_ptr error;
+        try
+        {
+            left();
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+
+        if (queue.pop_back(&task))
+        {
+            if (nullptr != error)
+                std::rethrow_exception(error);
+
+            right();
+            return;
+        }
+
+        while (!task.m_is_done.load(std::memory_order_acquire))
+        {
+            Task* const other = steal(s_index);
+            if (nullptr != other)
+                execute(other);
+            else
+                std::this_thread::yield();
+        }
+
+        if (nullptr != error)
+            std::rethrow_exception(error);
+
+        if (nullptr != task.m_error)
+            std::rethrow_exception(task.m_error);
+    }
+
+    //--------------------------------------------------------------//
+    template<class F>
+    void ThreadPool::for_range(size_t first, size_t last, size_t grain, F&& f)
+    {
+        if (last - first <= grain || 0 == grain)
+        {
+            for (; first < last; ++first)
+                f(first);
+
+            return;
+        }
+
+        const size_t middle = first + (last - first) / 2;
+        invoke([this, first, middle, grain, &f]() { for_range(first, middle, grain, f); },
+               [this, middle, last, grain, &f]() { for_range(middle, last, grain, f); });
+    }
+
+    //--------------------------------------------------------------//
+    inline void ThreadPool::work(uint32_t index) noexcept
+    {
+        s_pool = this;
+        s_index = index;
+
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> guard(m_lock);
+                m_wake.wait(guard, [this]() { return m_is_stopped || m_is_active.load(std::memory_order_relaxed); });
+                if (m_is_stopped)
+                    return;
+            }
+
+            while (m_is_active.load(std::memory_order_relaxed))
+            {
+                Task* const task = steal(index);
+                if (nullptr != task)
+                    execute(task);
+                else
+                    std::this_thread::yield();
+            }
+        }
+    }
+
+    //--------------------------------------------------------------//
+    inline ThreadPool::Task* ThreadPool::steal(uint32_t index) noexcept
+    {
+        for (uint32_t i = 1; i < m_size; ++i)
+        {
+            Task* const task = m_queues[(index + i) % m_size].pop_front();
+            if (nullptr != task)
+                return task;
+        }
+
+        return nullptr;
+    }
+
+    //--------------------------------------------------------------//
+    inline void ThreadPool::execute(Task* task) noexcept
+    {
+        try
+        {
+            task->m_run(task);
+        }
+        catch (...)
+        {
+            task->m_error = std::current_exception();
+        }
+
+        // the owner may leave invoke() at once
+        task->m_is_done.store(true, std::memory_order_release);
+    }
+
+    //--------------------------------------------------------------//
+    inline bool ThreadPool::Queue::push_back(Task* task) noexcept
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (s_queue_size == m_size)
+            return false;
+
+        m_tasks[(m_first + m_size) % s_queue_size] = task;
+        ++m_size;
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+    inline bool ThreadPool::Queue::pop_back(Task* task) noexcept
+    {
+        // nested forks are taken back first, so the task is the last one unless stolen
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (0 == m_size || task != m_tasks[(m_first + m_size - 1) % s_queue_size])
+            return false;
+
+        --m_size;
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+    inline ThreadPool::Task* ThreadPool::Queue::pop_front() noexcept
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        if (0 == m_size)
+            return nullptr;
+
+        Task* const task = m_tasks[m_first];
+        m_first = (m_first + 1) % s_queue_size;
+        --m_size;
+        return task;
+    }
+}
@@ -0,0 +1,193 @@
+#pragma once
+
+#include "stdint.h"
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "nonoderbtree.h"
+#include "indexptr.h"
+
+namespace RBTree
+{
+    //////////////////////////////////////////////////////////////////
+
+    // Flat file of an IndexPtr linked tree (POSIX mmap):
+    //     header (s_header bytes) | slot 0 (nullptr) | values 1..size
+    // Values are written level by level, root is 1, so the top of the tree is on the first pages.
+    // Loaded image is mapped copy-on-write and queried in place: no deserialization,
+    // only touched pages are read. Changes of the loaded tree aren't written back.
+    template<class T, class Tag = void>
+    class TreeImage
+    {
+        static_assert(std::is_trivially_copyable<T>(), "value is copied as bytes");
+
+        struct Header
+        {
+            char m_magic[8];
+
+            uint64_t m_value_size;
+
+            uint64_t m_size;
+        };
+
+        static constexpr size_t s_header = 64;
+
+        static_assert(sizeof(Header) <= s_header && 0 == s_header % alignof(T), "");
+
+    public:
+
+        using pointer = IndexPtr<T, Tag>;
+
+        // maps the file and attaches IndexPtr<T, Tag> to it
+        explicit TreeImage(const char* path);
+
+        ~TreeImage();
+
+        TreeImage(const TreeImage& other) = delete;
+        TreeImage(TreeImage&& other) noexcept = delete;
+        TreeImage& operator=(const TreeImage& other) = delete;
+        TreeImage& operator=(TreeImage&& other) noexcept = delete;
+
+        // tree over the mapped values, O(log n) pages touched
+        template<class K, class A>
+        void adopt(NoNodeRBTree<K, pointer, A>& tree) const noexcept;
+
+        size_t size() const noexcept { return m_size; }
+
+        // writes the tree, its values are read through the attached base
+        template<class K, class A>
+        static void save(const char* path, const NoNodeRBTree<K, pointer, A>& tree);
+
+    private:
+
+        static void check(bool is_ok, const char* what, const char* path);
+
+    private:
+
+        void* m_map;
+
+        size_t m_length;
+
+        size_t m_size;
+    };
+
+    //--------------------------------------------------------------//
+    template<class T, class Tag>
+    TreeImage<T, Tag>::TreeImage(const char* path)
+      : m_map(MAP_FAILED),
+        m_length(0),
+        m_size(0)
+    {
+        const int fd = ::open(path, O_RDONLY);
+        check(0 <= fd, "open", path);
+
+        struct stat st;
+        const bool is_stat = (0 == ::fstat(fd, &st));
+        m_length = is_stat ? (size_t)st.st_size : 0;
+        if (is_stat && s_header <= m_length)
+            m_map = ::mmap(nullptr, m_length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+        ::close(fd);
+        check(MAP_FAILED != m_map, "mmap", path);
+
+        const Header* const header = static_cast<const Header*>(m_map);
+        m_size = header->m_size;
+        if (0 != std::memcmp(header->m_magic, "RBTIMG1", 8) || sizeof(T) != header->m_value_size ||
+            pointer::max_index() < m_size || s_header + (m_size + 1) * sizeof(T) != m_length)
+        {
+            ::munmap(m_map, m_length);
+            check(false, "bad image", path);
+        }
+
+        pointer::attach(reinterpret_cast<T*>(static_cast<char*>(m_map) + s_header));
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, class Tag>
+    TreeImage<T, Tag>::~TreeImage()
+    {
+        T* const base = reinterpret_cast<T*>(static_cast<char*>(m_map) + s_header);
+        if (pointer::base() == base)
+            pointer::attach(nullptr);
+
+        ::munmap(m_map, m_length);
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, class Tag>
+    template<class K, class A>
+    void TreeImage<T, Tag>::adopt(NoNodeRBTree<K, pointer, A>& tree) const noexcept
+    {
+        tree.adopt((0 == m_size) ? pointer() : pointer::from_index(1), m_size);
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, class Tag>
+    template<class K, class A>
+    void TreeImage<T, Tag>::save(const char* path, const NoNodeRBTree<K, pointer, A>& tree)
+    {
+        const size_t size = tree.size();
+        const size_t length = s_header + (size + 1) * sizeof(T);
+
+        const int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        check(0 <= fd, "open", path);
+
+        void* map = MAP_FAILED;
+        if (0 == ::ftruncate(fd, (off_t)length))
+            map = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        ::close(fd);
+        check(MAP_FAILED != map, "mmap", path);
+
+        Header* const header = static_cast<Header*>(map);
+        std::memcpy(header->m_magic, "RBTIMG1", 8);
+        header->m_value_size = sizeof(T);
+        header->m_size = size;
+
+        // The output is the queue of the breadth-first walk: a copied value keeps old links
+        // until its turn comes, then its children are appended and links are renumbered.
+        T* const out = reinterpret_cast<T*>(static_cast<char*>(map) + s_header);
+        size_t count = 0;
+        if (0 != size)
+        {
+            out[++count] = *tree.root();
+
+            for (size_t i = 1; i <= count; ++i)
+            {
+                T& value = out[i];
+                for (pointer* link : {&value.m_left, &value.m_right})
+                {
+                    if (nullptr == *link)
+                        continue;
+
+                    T& child = out[++count];
+                    child = **link;
+
+                    // keeps the color bits
+                    const size_t color = (size_t)child.m_parent & (size_t)0b111;
+                    child.m_parent = pointer((size_t)pointer::from_index((uint32_t)i) | color);
+                    *link = pointer::from_index((uint32_t)count);
+                }
+            }
+        }
+        assert(size == count);
+
+        const bool is_synced = (0 == ::msync(map, length, MS_SYNC));
+        ::munmap(map, length);
+        check(is_synced, "msync", path);
+    }
+
+    //--------------------------------------------------------------//
+    template<class T, class Tag>
+    void TreeImage<T, Tag>::check(bool is_ok, const char* what, const char* path)
+    {
+        if (!is_ok)
+            throw std::runtime_error(std::string("TreeImage: ") + what + " " + path);
+    }
+}
@@ -1,14 +1,32 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 #include <map>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
 #include <thread>
+#include <limits>
 #include <list>
 #include <fstream>
+#include <string>
 
 #include <gtest/gtest.h>
 
 #include "common.h"
 #include "testgen.h"
 #include "rbtree.h"
+#include "concurrentrbtree.h"
+#include "poolallocator.h"
+#include "shardedrbtree.h"
+#include "augment.h"
+#include "btree.h"
+#include "indexptr.h"
+#include "treeimage.h"
+#include "parallel.h"
 
 namespace Test
 {
@@ -26,6 +44,25 @@ namespace Test
 
     //////////////////////////////////////////////////////////////////
 
+    // operation of a concurrent run, called and returned at ticks of one clock
+    struct HistoryOp
+    {
+        enum Type : uint8_t { Add, Remove, Find };
+
+        key_t m_key;
+
+        Type m_type;
+
+        bool m_result;
+
+        uint64_t m_call;
+
+        uint64_t m_return;
+    };
+
+    //////////////////////////////////////////////////////////////////
+
+    template<class Tested = testedmap_t<key_t, value_t>>
     class TestBox
     {
     public:
@@ -45,14 +82,37 @@ namespace Test
 
         bool run_custom(const std::vector<TestCommand>& sample);
 
+        // nthreads add/remove/find random keys of one shared tree,
+        // the history of results must be linearizable
+        bool run_concurrent(uint32_t nthreads, uint32_t nkeys, uint32_t nops);
+
+        // key by key (linearizability is local), search of Wing & Gong with the cache of Lowe
+        static bool isLinearizable(const std::vector<HistoryOp>& history);
+
     private:
 
+        static bool isLinearizableKey(const std::vector<HistoryOp>& ops);
+
+        static bool isAdded(bool result) noexcept { return result; }
+
+        template<class It>
+        static bool isAdded(const std::pair<It, bool>& result) noexcept { return result.second; }
+
         static bool check(
             std::map<key_t, value_t>& origin,
-            testedmap_t<key_t, value_t>& tested,
+            Tested& tested,
             std::vector<std::pair<bool,bool>>* vreturns,
             uint32_t vreturns_size);
 
+        static bool checkLookup(
+            std::map<key_t, value_t>& origin,
+            Tested& tested);
+
+        template<class OriginIt, class TestedIt>
+        static bool isSamePosition(
+            std::map<key_t, value_t>& origin, OriginIt origin_it,
+            Tested& tested, TestedIt tested_it);
+
         static void dump(
             uint32_t id,
             const std::vector<TestCommand>* vsamples,
@@ -64,12 +124,13 @@ namespace Test
             std::map<key_t, value_t>& map, const TestCommand& cmd, std::vector<value_t>& values) noexcept;
 
         static inline bool execTestedFn(
-            testedmap_t<key_t, value_t>& map, const TestCommand& cmd, std::vector<value_t>& values) noexcept;
+            Tested& map, const TestCommand& cmd, std::vector<value_t>& values) noexcept;
     };
 
     //--------------------------------------------------------------//
 
-    bool TestBox::run(TestGenerator generator, uint32_t sample_size,
+    template<class Tested>
+    bool TestBox<Tested>::run(TestGenerator generator, uint32_t sample_size,
                  uint32_t niterations, uint32_t ntreads)
     {
         std::list<std::thread> treads;
@@ -83,7 +144,7 @@ namespace Test
                     std::vector<TestCommand> sample(size, {0, 0});
                     std::vector<std::pair<bool,bool>> returns(size, {0, 0});
 
-                    testedmap_t<key_t, value_t> tested;
+                    Tested tested;
                     std::map<key_t, value_t> standard;
 
                     for (uint32_t iteration = 0; iteration < niterations; ++iteration)
@@ -145,13 +206,14 @@ namespace Test
 
     //--------------------------------------------------------------//
 
-    bool TestBox::run_custom(const std::vector<TestCommand>& sample)
+    template<class Tested>
+    bool TestBox<Tested>::run_custom(const std::vector<TestCommand>& sample)
     {
         const size_t size = sample.size();
         std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
         std::vector<std::pair<bool,bool>> returns(size, {0, 0});
 
-        testedmap_t<key_t, value_t> tested;
+        Tested tested;
         std::map<key_t, value_t> standard;
 
 #if CHECK_ALWAYS
@@ -198,9 +260,222 @@ namespace Test
 
     //--------------------------------------------------------------//
 
-    bool TestBox::check(
+    template<class Tested>
+    bool TestBox<Tested>::run_concurrent(uint32_t nthreads, uint32_t nkeys, uint32_t nops)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        std::vector<std::vector<HistoryOp>> histories(nthreads);
+        std::atomic<uint64_t> clock(0);
+
+        Tested tested;
+
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nthreads; ++i)
+        {
+            treads.emplace_back([&tested, &values, &histories, &clock, nkeys, nops](uint32_t id)
+            {
+                Rand rand;
+                std::vector<HistoryOp>& history = histories[id];
+                history.reserve(nops);
+
+                for (uint32_t iteration = 0; iteration < nops; ++iteration)
+                {
+                    const uint64_t random = rand.get();
+
+                    HistoryOp op;
+                    op.m_key = High(random) % nkeys;
+                    op.m_type = (HistoryOp::Type)(Low(random) % 3);
+
+                    op.m_call = clock.fetch_add(1);
+                    switch (op.m_type)
+                    {
+                    case HistoryOp::Add:
+                        op.m_result = isAdded(tested.emplace(op.m_key, values[op.m_key % NVALUES]));
+                        break;
+                    case HistoryOp::Remove:
+                        op.m_result = (0 != tested.erase(op.m_key));
+                        break;
+                    case HistoryOp::Find:
+                        op.m_result = tested.contains(op.m_key);
+                        break;
+                    }
+                    op.m_return = clock.fetch_add(1);
+
+                    history.push_back(op);
+
+                    // histories interleave on few cores too
+                    if (0 == rand.get() % 16)
+                        std::this_thread::yield();
+                }
+            }, i);
+        }
+
+        for (auto& tread : treads)
+            tread.join();
+
+        std::vector<HistoryOp> history;
+        for (const std::vector<HistoryOp>& thread_history : histories)
+            history.insert(history.end(), thread_history.begin(), thread_history.end());
+
+        // the final content ends every history
+        for (key_t key = 0; key < nkeys; ++key)
+        {
+            const uint64_t tick = clock.fetch_add(2);
+            history.push_back({key, HistoryOp::Find, tested.contains(key), tick, tick + 1});
+        }
+
+        const bool res = tested.checkRB() && isLinearizable(history);
+
+        tested.clear();
+        KillValues(values);
+
+        return res;
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Tested>
+    bool TestBox<Tested>::isLinearizable(const std::vector<HistoryOp>& history)
+    {
+        std::map<key_t, std::vector<HistoryOp>> by_key;
+        for (const HistoryOp& op : history)
+            by_key[op.m_key].push_back(op);
+
+        for (const auto& key_ops : by_key)
+        {
+            if (!isLinearizableKey(key_ops.second))
+                return false;
+        }
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Tested>
+    bool TestBox<Tested>::isLinearizableKey(const std::vector<HistoryOp>& ops)
+    {
+        const uint32_t nops = (uint32_t)ops.size();
+
+        // events by time in the list headed by 2 * nops: 2 * i - call of ops[i], 2 * i + 1 - return
+        std::vector<std::pair<uint64_t, uint32_t>> events;
+        for (uint32_t i = 0; i < nops; ++i)
+        {
+            events.emplace_back(ops[i].m_call, 2 * i);
+            events.emplace_back(ops[i].m_return, 2 * i + 1);
+        }
+        std::sort(events.begin(), events.end());
+
+        const uint32_t head = 2 * nops;
+        std::vector<uint32_t> prev(head + 1);
+        std::vector<uint32_t> next(head + 1);
+
+        uint32_t last = head;
+        for (const auto& event : events)
+        {
+            next[last] = event.second;
+            prev[event.second] = last;
+            last = event.second;
+        }
+        next[last] = head;
+        prev[head] = last;
+
+        // linearized op leaves the list with its return, backtracking puts it back
+        const auto lift = [&prev, &next](uint32_t call)
+        {
+            for (const uint32_t event : {call, call + 1})
+            {
+                next[prev[event]] = next[event];
+                prev[next[event]] = prev[event];
+            }
+        };
+
+        const auto unlift = [&prev, &next](uint32_t call)
+        {
+            for (const uint32_t event : {call + 1, call})
+            {
+                next[prev[event]] = event;
+                prev[next[event]] = event;
+            }
+        };
+
+        // bits of linearized ops and the key state after them, seen ones are dead ends
+        std::vector<uint64_t> linearized(nops / 64 + 2, 0);
+        uint64_t& state = linearized.back();
+        std::set<std::vector<uint64_t>> seen;
+
+        // calls of linearized ops with the key state before them
+        std::vector<std::pair<uint32_t, bool>> stack;
+
+        bool is_present = false;
+        uint32_t event = next[head];
+        while (head != next[head])
+        {
+            if (0 == (event & 1))
+            {
+                const uint32_t i = event / 2;
+                const HistoryOp& op = ops[i];
+
+                bool is_legal = false;
+                bool is_present_after = is_present;
+                switch (op.m_type)
+                {
+                case HistoryOp::Add:
+                    is_legal = (op.m_result != is_present);
+                    is_present_after = true;
+                    break;
+                case HistoryOp::Remove:
+                    is_legal = (op.m_result == is_present);
+                    is_present_after = false;
+                    break;
+                case HistoryOp::Find:
+                    is_legal = (op.m_result == is_present);
+                    break;
+                }
+
+                if (is_legal)
+                {
+                    linearized[i / 64] |= (uint64_t)1 << (i % 64);
+                    state = is_present_after;
+                    if (seen.insert(linearized).second)
+                    {
+                        stack.emplace_back(event, is_present);
+                        is_present = is_present_after;
+                        lift(event);
+                        event = next[head];
+                        continue;
+                    }
+                    linearized[i / 64] &= ~((uint64_t)1 << (i % 64));
+                }
+
+                event = next[event];
+            }
+            else
+            {
+                // the op returned before any order of the pending ones could take it
+                if (stack.empty())
+                    return false;
+
+                const uint32_t call = stack.back().first;
+                is_present = stack.back().second;
+                stack.pop_back();
+
+                const uint32_t i = call / 2;
+                linearized[i / 64] &= ~((uint64_t)1 << (i % 64));
+                unlift(call);
+                event = next[call];
+            }
+        }
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Tested>
+    bool TestBox<Tested>::check(
         std::map<key_t, value_t>& origin,
-        testedmap_t<key_t, value_t>& tested,
+        Tested& tested,
         std::vector<std::pair<bool,bool>>* vreturns,
         uint32_t vreturns_size)
     {
@@ -242,12 +517,79 @@ namespace Test
             flag &= (origin_v[i] == tested_v[i]);
         }
 
-        return flag && tested.checkRB();
+        std::vector<std::pair<key_t, value_t>> visited_v;
+        tested.for_each([&visited_v](const auto& key, const auto& value)
+        {
+            visited_v.emplace_back(key, value);
+        });
+        flag &= (visited_v == tested_v);
+
+        return flag && checkLookup(origin, tested) && tested.checkRB();
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Tested>
+    bool TestBox<Tested>::checkLookup(
+        std::map<key_t, value_t>& origin,
+        Tested& tested)
+    {
+        if (!isSamePosition(origin, origin.begin(), tested, tested.front()))
+            return false;
+
+        if (!isSamePosition(origin, origin.empty() ? origin.end() : std::prev(origin.end()), tested, tested.back()))
+            return false;
+
+        for (key_t key = 0; key <= MAX_KEY; ++key)
+        {
+            if (origin.count(key) != tested.count(key))
+                return false;
+
+            if ((0 != origin.count(key)) != tested.contains(key))
+                return false;
+
+            if (!isSamePosition(origin, origin.find(key), tested, tested.find(key)))
+                return false;
+
+            if (!isSamePosition(origin, origin.lower_bound(key), tested, tested.lower_bound(key)))
+                return false;
+
+            if (!isSamePosition(origin, origin.upper_bound(key), tested, tested.upper_bound(key)))
+                return false;
+
+            const auto origin_range = origin.equal_range(key);
+            const auto tested_range = tested.equal_range(key);
+            if (!isSamePosition(origin, origin_range.first, tested, tested_range.first) ||
+                !isSamePosition(origin, origin_range.second, tested, tested_range.second))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Tested>
+    template<class OriginIt, class TestedIt>
+    bool TestBox<Tested>::isSamePosition(
+        std::map<key_t, value_t>& origin, OriginIt origin_it,
+        Tested& tested, TestedIt tested_it)
+    {
+        const bool is_origin_end = (origin.end() == origin_it);
+        const bool is_tested_end = (tested.end() == tested_it);
+        if (is_origin_end || is_tested_end)
+            return is_origin_end == is_tested_end;
+
+        const std::pair<key_t, value_t> tested_pair = *tested_it;
+        return (origin_it->first == tested_pair.first) && (origin_it->second == tested_pair.second);
     }
 
     //--------------------------------------------------------------//
 
-    void TestBox::dump(
+    template<class Tested>
+    void TestBox<Tested>::dump(
         uint32_t id,
         const std::vector<TestCommand>* vsamples,
         uint32_t vsamples_size)
@@ -270,7 +612,8 @@ namespace Test
 
     //--------------------------------------------------------------//
 
-    bool TestBox::execOriginFn(
+    template<class Tested>
+    bool TestBox<Tested>::execOriginFn(
         std::map<key_t, value_t>& map, const TestCommand& cmd, std::vector<value_t>& values) noexcept
     {
         if (cmd.m_is_add)
@@ -285,8 +628,9 @@ namespace Test
 
     //--------------------------------------------------------------//
 
-    bool TestBox::execTestedFn(
-        testedmap_t<key_t, value_t>& map, const TestCommand& cmd, std::vector<value_t>& values) noexcept
+    template<class Tested>
+    bool TestBox<Tested>::execTestedFn(
+        Tested& map, const TestCommand& cmd, std::vector<value_t>& values) noexcept
     {
         if (cmd.m_is_add)
         {
@@ -348,6 +692,33 @@ namespace Test
 
     //--------------------------------------------------------------//
 
+    using pool_allocator_t = RBTree::PoolAllocator<std::pair<const key_t, value_t>>;
+    using pool_testedmap_t = testedmap_t<key_t, value_t, RBTree::FakeLock, pool_allocator_t>;
+
+    TEST(TreeTest, brut_pool_add_remove_small_sample)
+    {
+        constexpr uint32_t sample_size = 20;
+        constexpr uint32_t niterations = 30000;
+        constexpr uint32_t nthreads = 12;
+
+        TestBox<pool_testedmap_t> tb;
+        tb.run(AddRemoveTestGenerator, sample_size, niterations, nthreads);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, brut_pool_add_remove_big_sample)
+    {
+        constexpr uint32_t sample_size = 10000;
+        constexpr uint32_t niterations = 100;
+        constexpr uint32_t nthreads = 12;
+
+        TestBox<pool_testedmap_t> tb;
+        tb.run(AddRemoveTestGenerator, sample_size, niterations, nthreads);
+    }
+
+    //--------------------------------------------------------------//
+
     TEST(TreeTest, brut_add_remove_manual)
     {
         GTEST_SKIP();
@@ -359,6 +730,2243 @@ namespace Test
         tb.run(AddRemoveTestGenerator, sample_size, niterations, nthreads);
     }
 
+    //--------------------------------------------------------------//
+
+    template<class Lock, class Allocator = std::allocator<std::pair<const key_t, value_t>>>
+    void MTReadWriteTest(uint32_t nreaders, uint32_t nwriters, uint32_t niterations)
+    {
+        // keys % 4 == 0 are always present, writers insert and erase the rest
+        // in different orders, so inner nodes are erased too
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        testedmap_t<key_t, value_t, Lock, Allocator> tested;
+        for (key_t key = 0; key < NVALUES; key += 4)
+            tested.emplace(key, values[key]);
+
+        std::atomic<bool> failed(false);
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nwriters; ++i)
+        {
+            treads.emplace_back([&tested, &values, nwriters, niterations](uint32_t id)
+            {
+                std::vector<key_t> keys;
+                for (key_t key = 0; key < NVALUES; ++key)
+                {
+                    if ((0 != key % 4) && (id == (key / 4) % nwriters))
+                        keys.push_back(key);
+                }
+
+                for (uint32_t iteration = 0; iteration < niterations / keys.size(); ++iteration)
+                {
+                    for (const key_t key : keys)
+                        tested.emplace(key, values[key]);
+
+                    std::rotate(keys.begin(), keys.begin() + 1 + iteration % (keys.size() - 1), keys.end());
+
+                    for (const key_t key : keys)
+                        tested.erase(key);
+                }
+            }, i);
+        }
+
+        for (uint32_t i = 0; i < nreaders; ++i)
+        {
+            treads.emplace_back([&tested, &failed, niterations]()
+            {
+                for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+                {
+                    const key_t key = (iteration * 4) % NVALUES;
+
+                    if (!tested.contains(key) || (key != (*tested.find(key)).first))
+                        failed = true;
+
+                    if (key != (*tested.lower_bound(key)).first)
+                        failed = true;
+
+                    if (tested.end() != tested.find(key + NVALUES))
+                        failed = true;
+                }
+            });
+        }
+
+        for (auto& tread : treads)
+            tread.join();
+
+        ASSERT_FALSE(failed);
+        ASSERT_EQ(NVALUES / 4, tested.size());
+        ASSERT_TRUE(tested.checkRB());
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_shared_mutex)
+    {
+        MTReadWriteTest<std::shared_mutex>(6, 2, 100000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_spin_rw_lock)
+    {
+        MTReadWriteTest<RBTree::SpinRWLock>(6, 2, 100000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_seqlock_stress)
+    {
+        MTReadWriteTest<RBTree::SeqLock>(8, 4, 200000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_pool_allocator)
+    {
+        MTReadWriteTest<RBTree::SpinRWLock, pool_allocator_t>(4, 4, 100000);
+    }
+
+    //--------------------------------------------------------------//
+
+    void PoolRebindTest()
+    {
+        // rebinds share the pools of all sizes
+        const pool_allocator_t alloc;
+        const RBTree::PoolAllocator<uint64_t> rebound(alloc);
+        const pool_allocator_t back(rebound);
+        ASSERT_TRUE(alloc == rebound);
+        ASSERT_TRUE(alloc == back);
+        ASSERT_FALSE(alloc == pool_allocator_t());
+
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        {
+            // trees of one allocator share its slabs, none of them may drop them
+            pool_testedmap_t one(alloc);
+            pool_testedmap_t other(alloc);
+            for (key_t key = 0; key < 10000; ++key)
+            {
+                one.emplace(key, values[key % NVALUES]);
+                other.emplace(key + 1, values[key % NVALUES]);
+            }
+
+            one.clear();
+            ASSERT_EQ(0u, one.size());
+            ASSERT_EQ(10000u, other.size());
+            for (key_t key = 0; key < 10000; ++key)
+                ASSERT_EQ(1u, other.count(key + 1));
+            ASSERT_TRUE(other.checkRB());
+        }
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, pool_allocator_rebind)
+    {
+        PoolRebindTest();
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_flat_combining)
+    {
+        MTReadWriteTest<RBTree::FlatCombiningLock<>>(4, 8, 100000);
+        MTReadWriteTest<RBTree::FlatCombiningLock<false>>(2, 4, 50000);
+    }
+
+    //--------------------------------------------------------------//
+
+    struct EpochValue
+    {
+        EpochValue* m_next = nullptr;
+
+        uint32_t m_magic = s_magic;
+
+        static constexpr uint32_t s_magic = 0x600dda7a;
+    };
+
+    using epoch_reclaimer_t = RBTree::EpochReclaimer<EpochValue, &EpochValue::m_next>;
+
+    TEST(TreeTest, epoch_reclaimer)
+    {
+        epoch_reclaimer_t reclaimer;
+        size_t ndisposed = 0;
+        const auto dispose = [&ndisposed](EpochValue* value) { ++ndisposed; delete value; };
+
+        // nothing retired under a pin is disposed before it's gone
+        constexpr size_t nvalues = 10000;
+        {
+            const auto guard = reclaimer.pin();
+            const auto nested = reclaimer.pin();
+            for (size_t i = 0; i < nvalues; ++i)
+                reclaimer.retire(new EpochValue(), dispose);
+
+            ASSERT_EQ(0u, ndisposed);
+            ASSERT_EQ(nvalues, reclaimer.pending());
+        }
+
+        // without readers retired values don't pile up
+        for (size_t i = 0; i < nvalues; ++i)
+        {
+            EpochValue* const list = new EpochValue();
+            list->m_next = new EpochValue();
+            reclaimer.retire(list, dispose);
+        }
+        ASSERT_LT(3 * nvalues - 1000, ndisposed);
+        ASSERT_EQ(3 * nvalues, ndisposed + reclaimer.pending());
+
+        reclaimer.reclaim(dispose);
+        ASSERT_EQ(3 * nvalues, ndisposed);
+        ASSERT_EQ(0u, reclaimer.pending());
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_epoch_reclaimer)
+    {
+        // writers replace the shared values, readers check them under pins (and ASan/TSan)
+        constexpr uint32_t nreaders = 4;
+        constexpr uint32_t nwriters = 2;
+        constexpr uint32_t niterations = 100000;
+
+        epoch_reclaimer_t reclaimer;
+        std::atomic<EpochValue*> shared[NVALUES];
+        for (auto& value : shared)
+            value.store(new EpochValue(), std::memory_order_relaxed);
+
+        std::atomic<bool> failed(false);
+        std::atomic<size_t> ndisposed(0);
+        const auto dispose = [&ndisposed](EpochValue* value)
+        {
+            value->m_magic = 0;
+            delete value;
+            ndisposed.fetch_add(1, std::memory_order_relaxed);
+        };
+
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nwriters; ++i)
+        {
+            treads.emplace_back([&reclaimer, &shared, &dispose](uint32_t id)
+            {
+                for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+                {
+                    auto& slot = shared[(iteration * nwriters + id) % NVALUES];
+                    EpochValue* const old = slot.exchange(new EpochValue(), std::memory_order_acq_rel);
+                    reclaimer.retire(old, dispose);
+                }
+            }, i);
+        }
+
+        for (uint32_t i = 0; i < nreaders; ++i)
+        {
+            treads.emplace_back([&reclaimer, &shared, &failed](uint32_t id)
+            {
+                for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+                {
+                    const auto guard = reclaimer.pin();
+                    const EpochValue* const value = shared[(iteration + id) % NVALUES].load(std::memory_order_acquire);
+                    if (EpochValue::s_magic != value->m_magic)
+                        failed = true;
+                }
+            }, i);
+        }
+
+        for (auto& tread : treads)
+            tread.join();
+
+        ASSERT_FALSE(failed);
+        ASSERT_EQ(nwriters * niterations, ndisposed + reclaimer.pending());
+
+        reclaimer.reclaim(dispose);
+        ASSERT_EQ(nwriters * niterations, ndisposed);
+        for (auto& value : shared)
+            delete value.load(std::memory_order_relaxed);
+    }
+
+    //--------------------------------------------------------------//
+
+    void SeqLockReclaimTest(uint32_t nreaders, uint32_t nwriters, uint32_t niterations)
+    {
+        // optimistic readers descend through nodes erased meanwhile,
+        // erased nodes are destroyed by epochs without reclaim()
+        constexpr key_t nkeys = 1024;
+
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        testedmap_t<key_t, value_t, RBTree::SeqLock> tested;
+        for (key_t key = 0; key < nkeys; key += 2)
+            tested.emplace(key, values[key % NVALUES]);
+
+        std::atomic<bool> is_done(false);
+        std::atomic<bool> failed(false);
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nreaders; ++i)
+        {
+            treads.emplace_back([&tested, &is_done, &failed](uint32_t id)
+            {
+                for (key_t key = id; !is_done.load(std::memory_order_relaxed); key = (key + 7) % nkeys)
+                {
+                    // even keys are always present
+                    if (0 == key % 2 && !tested.contains(key))
+                        failed = true;
+                }
+            }, i);
+        }
+
+        std::list<std::thread> writers;
+        for (uint32_t i = 0; i < nwriters; ++i)
+        {
+            writers.emplace_back([&tested, &values, nwriters, niterations](uint32_t id)
+            {
+                std::vector<key_t> keys;
+                for (key_t key = 2 * id + 1; key < nkeys; key += 2 * nwriters)
+                    keys.push_back(key);
+
+                for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+                {
+                    for (const key_t key : keys)
+                        tested.emplace(key, values[key % NVALUES]);
+
+                    // single erases and batches
+                    if (0 == iteration % 2)
+                    {
+                        for (const key_t key : keys)
+                            tested.erase(key);
+                    }
+                    else
+                    {
+                        tested.erase_batch(keys.begin(), keys.end());
+                    }
+                }
+            }, i);
+        }
+
+        for (auto& writer : writers)
+            writer.join();
+
+        is_done = true;
+        for (auto& tread : treads)
+            tread.join();
+
+        ASSERT_FALSE(failed);
+        ASSERT_EQ(nkeys / 2, tested.size());
+        ASSERT_TRUE(tested.checkRB());
+
+        // without readers erases of one thread drain the lists of the gone ones too
+        for (uint32_t iteration = 0; iteration < 64; ++iteration)
+        {
+            for (key_t key = 1; key < nkeys; key += 2)
+                tested.emplace(key, values[key % NVALUES]);
+            for (key_t key = 1; key < nkeys; key += 2)
+                tested.erase(key);
+        }
+        ASSERT_GT(nkeys, tested.retired());
+
+        tested.reclaim();
+        ASSERT_EQ(0u, tested.retired());
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_seqlock_reclaim)
+    {
+        SeqLockReclaimTest(4, 2, 2000);
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Allocator = std::allocator<std::pair<const key_t, value_t>>>
+    void BuildFromSortedTest(uint32_t max_size)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        for (uint32_t size = 0; size <= max_size; size = (size < 300) ? size + 1 : size * 3 / 2)
+        {
+            std::vector<std::pair<key_t, value_t>> sorted;
+            for (key_t key = 0; key < size; ++key)
+                sorted.emplace_back(2 * key, values[key % NVALUES]);
+
+            testedmap_t<key_t, value_t, RBTree::FakeLock, Allocator> tested;
+            tested.emplace(1, values[1]);
+            tested.build_from_sorted(sorted.begin(), sorted.end());
+
+            ASSERT_EQ(size, tested.size());
+            ASSERT_TRUE(tested.checkRB());
+            const std::vector<std::pair<key_t, value_t>> tested_v(tested.begin(), tested.end());
+            ASSERT_EQ(sorted, tested_v);
+
+            // usual rebalancing on top of the built tree
+            for (key_t key = 0; key < size; key += 2)
+                ASSERT_EQ(1, tested.erase(2 * key));
+            for (key_t key = 0; key < size; ++key)
+                ASSERT_TRUE(tested.emplace(2 * key + 1, values[key % NVALUES]).second);
+
+            ASSERT_EQ(size / 2 + size, tested.size());
+            ASSERT_TRUE(tested.checkRB());
+
+            // the built tree is replaced in turn
+            tested.build_from_sorted(sorted.begin(), sorted.end());
+            ASSERT_EQ(size, tested.size());
+            ASSERT_TRUE(tested.checkRB());
+            const std::vector<std::pair<key_t, value_t>> rebuilt_v(tested.begin(), tested.end());
+            ASSERT_EQ(sorted, rebuilt_v);
+        }
+
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, build_from_sorted)
+    {
+        BuildFromSortedTest(200000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, build_from_sorted_pool)
+    {
+        BuildFromSortedTest<pool_allocator_t>(20000);
+    }
+    //--------------------------------------------------------------//
+
+    template<class Lock>
+    void BatchTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        testedmap_t<key_t, value_t, Lock> tested;
+        std::map<key_t, value_t> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            // sorted run with gaps, sometimes reversed or shuffled
+            const key_t step = 1 + rand.get() % 4;
+            const size_t length = 1 + rand.get() % 64;
+            std::vector<key_t> keys;
+            for (key_t key = rand.get() % nkeys; key < nkeys && keys.size() < length; key += step)
+                keys.push_back(key);
+
+            const uint32_t order = rand.get() % 8;
+            if (0 == order)
+                std::reverse(keys.begin(), keys.end());
+            else if (1 == order)
+                std::shuffle(keys.begin(), keys.end(), std::mt19937(iteration));
+
+            size_t expected = 0;
+            if (0 == rand.get() % 2)
+            {
+                std::vector<std::pair<key_t, value_t>> batch;
+                for (const key_t key : keys)
+                {
+                    batch.emplace_back(key, values[key % NVALUES]);
+                    expected += standard.emplace(key, values[key % NVALUES]).second ? 1 : 0;
+                }
+
+                ASSERT_EQ(expected, tested.insert_batch(batch.begin(), batch.end()));
+            }
+            else
+            {
+                for (const key_t key : keys)
+                    expected += standard.erase(key);
+
+                ASSERT_EQ(expected, tested.erase_batch(keys.begin(), keys.end()));
+            }
+
+            ASSERT_TRUE(tested.checkRB());
+
+            const std::vector<std::pair<key_t, value_t>> origin_v(standard.begin(), standard.end());
+            const std::vector<std::pair<key_t, value_t>> tested_v(tested.begin(), tested.end());
+            ASSERT_EQ(origin_v, tested_v);
+        }
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, batch_insert_erase)
+    {
+        BatchTest<RBTree::FakeLock>(1024, 20000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, batch_seqlock)
+    {
+        BatchTest<RBTree::SeqLock>(1024, 5000);
+    }
+    //--------------------------------------------------------------//
+
+    void HintTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        testedmap_t<key_t, value_t> tested;
+        std::map<key_t, value_t> standard;
+
+        auto hint = tested.end();
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            // right hints (end, previous result) and random ones
+            const uint32_t hint_kind = rand.get() % 4;
+            if (0 == hint_kind)
+                hint = tested.end();
+            else if (1 == hint_kind)
+                hint = tested.lower_bound(rand.get() % nkeys);
+
+            if (0 == rand.get() % 3 && tested.end() != hint)
+            {
+                const key_t key = hint.key();
+                hint = tested.erase(hint);
+                const auto next = standard.upper_bound(key);
+                ASSERT_EQ(1, standard.erase(key));
+                ASSERT_EQ(standard.end() == next, tested.end() == hint);
+                ASSERT_TRUE(standard.end() == next || next->first == hint.key());
+            }
+            else
+            {
+                const key_t key = (1 == iteration % 2) ? rand.get() % nkeys :
+                    (tested.end() == hint) ? nkeys : hint.key() + 1;
+                const size_t size = tested.size();
+                const bool is_new = standard.emplace(key, values[key % NVALUES]).second;
+
+                hint = (0 == iteration % 4) ?
+                    tested.insert(hint, std::pair<key_t, value_t>(key, values[key % NVALUES])) :
+                    tested.emplace_hint(hint, key, values[key % NVALUES]);
+
+                ASSERT_EQ(key, hint.key());
+                ASSERT_EQ(size + (is_new ? 1 : 0), tested.size());
+            }
+
+            if (0 == iteration % 64)
+            {
+                ASSERT_TRUE(tested.checkRB());
+
+                const std::vector<std::pair<key_t, value_t>> origin_v(standard.begin(), standard.end());
+                const std::vector<std::pair<key_t, value_t>> tested_v(tested.begin(), tested.end());
+                ASSERT_EQ(origin_v, tested_v);
+            }
+        }
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, insert_hint)
+    {
+        HintTest(512, 200000);
+    }
+    //--------------------------------------------------------------//
+
+    template<class Lock>
+    void PopTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        testedmap_t<key_t, value_t, Lock> tested;
+        std::map<key_t, value_t> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            const uint32_t op = rand.get() % 4;
+            if (0 == op || 1 == op)
+            {
+                const key_t key = rand.get() % nkeys;
+                standard.emplace(key, values[key % NVALUES]);
+                tested.emplace(key, values[key % NVALUES]);
+            }
+            else
+            {
+                const bool is_front = (2 == op);
+                const auto res = is_front ? tested.pop_front() : tested.pop_back();
+                ASSERT_EQ(standard.empty(), !res.has_value());
+                if (!standard.empty())
+                {
+                    const auto it = is_front ? standard.begin() : std::prev(standard.end());
+                    ASSERT_EQ(it->first, res->first);
+                    ASSERT_EQ(it->second, res->second);
+                    standard.erase(it);
+                }
+            }
+
+            ASSERT_EQ(standard.size(), tested.size());
+            ASSERT_EQ(standard.empty(), tested.end() == tested.front());
+            ASSERT_EQ(standard.empty(), tested.end() == tested.back());
+            if (!standard.empty())
+            {
+                ASSERT_EQ(standard.begin()->first, tested.front().key());
+                ASSERT_EQ(standard.rbegin()->first, tested.back().key());
+            }
+
+            if (0 == iteration % 64)
+            {
+                ASSERT_TRUE(tested.checkRB());
+            }
+        }
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, pop_front_back)
+    {
+        PopTest<RBTree::FakeLock>(256, 200000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, pop_front_back_seqlock)
+    {
+        PopTest<RBTree::SeqLock>(256, 50000);
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Lock, class Allocator = std::allocator<std::pair<const key_t, value_t>>>
+    void CompactTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        testedmap_t<key_t, value_t, Lock, Allocator> tested;
+        std::map<key_t, value_t> standard;
+
+        // empty and single node trees
+        tested.compact();
+        tested.emplace(1, values[1]);
+        standard.emplace(1, values[1]);
+        tested.compact();
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            // growing, then mostly erasing over the compacted nodes
+            const key_t key = rand.get() % nkeys;
+            if (rand.get() % 8 < ((iteration < niterations / 2) ? 6u : 2u))
+            {
+                standard.emplace(key, values[key % NVALUES]);
+                tested.emplace(key, values[key % NVALUES]);
+            }
+            else
+            {
+                ASSERT_EQ(standard.erase(key), tested.erase(key));
+            }
+
+            if (0 == iteration % (niterations / 16))
+            {
+                tested.compact();
+                ASSERT_EQ(standard.size(), tested.size());
+                ASSERT_TRUE(tested.checkRB());
+                const std::vector<std::pair<key_t, value_t>> standard_v(standard.begin(), standard.end());
+                const std::vector<std::pair<key_t, value_t>> tested_v(tested.begin(), tested.end());
+                ASSERT_EQ(standard_v, tested_v);
+                ASSERT_EQ(standard.rbegin()->first, tested.back().key());
+
+                for (key_t probe = 0; probe < nkeys; probe += 7)
+                    ASSERT_EQ(standard.count(probe), tested.count(probe));
+            }
+        }
+
+        ASSERT_EQ(standard.size(), tested.size());
+        ASSERT_TRUE(tested.checkRB());
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, compact)
+    {
+        CompactTest<RBTree::FakeLock>(4096, 200000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, compact_seqlock_pool)
+    {
+        CompactTest<RBTree::SeqLock, pool_allocator_t>(4096, 100000);
+    }
+
+    //--------------------------------------------------------------//
+
+    // compact() over and over while readers find even keys and a writer inserts/erases odd ones
+    template<class Lock, class Allocator = std::allocator<std::pair<const key_t, value_t>>>
+    void MTCompactTest(uint32_t nreaders, uint32_t ncompacts)
+    {
+        constexpr key_t nkeys = 4096;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        testedmap_t<key_t, value_t, Lock, Allocator> tested;
+        for (key_t key = 0; key < nkeys; key += 2)
+            tested.emplace(key, values[key % NVALUES]);
+
+        std::atomic<bool> is_done(false);
+        std::atomic<bool> failed(false);
+
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nreaders; ++i)
+        {
+            // compact() invalidates iterators, so only the lookup itself is checked
+            treads.emplace_back([&tested, &is_done, &failed](uint32_t id)
+            {
+                for (key_t key = 2 * id; !is_done.load(std::memory_order_relaxed); key = (key + 14) % nkeys)
+                {
+                    if (!tested.contains(key))
+                        failed = true;
+                }
+            }, i);
+        }
+
+        std::thread writer([&tested, &values, &is_done]()
+        {
+            for (key_t key = 1; !is_done.load(std::memory_order_relaxed); key = (key + 2) % nkeys)
+            {
+                if (tested.end() == tested.find(key))
+                    tested.emplace(key, values[key % NVALUES]);
+                else
+                    tested.erase(key);
+            }
+        });
+
+        for (uint32_t i = 0; i < ncompacts; ++i)
+            tested.compact();
+
+        is_done = true;
+        writer.join();
+        for (auto& tread : treads)
+            tread.join();
+
+        ASSERT_FALSE(failed);
+        ASSERT_TRUE(tested.checkRB());
+        for (key_t key = 0; key < nkeys; key += 2)
+            ASSERT_EQ(1u, tested.count(key));
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_compact_seqlock)
+    {
+        MTCompactTest<RBTree::SeqLock>(4, 200);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_compact_seqlock_pool)
+    {
+        MTCompactTest<RBTree::SeqLock, pool_allocator_t>(4, 200);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_compact_rwlock)
+    {
+        MTCompactTest<RBTree::SpinRWLock>(4, 200);
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Lock>
+    void FreezeTest(uint32_t max_size)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        for (uint32_t size = 0; size <= max_size; size = (size < 100) ? size + 1 : size * 2)
+        {
+            testedmap_t<key_t, value_t, Lock> tested;
+            std::map<key_t, value_t> standard;
+            const key_t max_key = 3 * size + 1;
+            while (standard.size() < size)
+            {
+                const key_t key = rand.get() % max_key;
+                standard.emplace(key, values[key % NVALUES]);
+                tested.emplace(key, values[key % NVALUES]);
+            }
+
+            const RBTree::FrozenRBTree<key_t, value_t> frozen = tested.freeze();
+
+            // the snapshot doesn't see later changes
+            tested.clear();
+            tested.emplace(max_key, values[0]);
+
+            ASSERT_EQ(standard.size(), frozen.size());
+            std::vector<std::pair<key_t, value_t>> frozen_v;
+            frozen.for_each([&frozen_v](const auto& key, const auto& value) { frozen_v.emplace_back(key, value); });
+            const std::vector<std::pair<key_t, value_t>> standard_v(standard.begin(), standard.end());
+            ASSERT_EQ(standard_v, frozen_v);
+
+            for (key_t key = 0; key <= max_key; ++key)
+            {
+                const auto it = standard.find(key);
+                const auto* const value = frozen.find(key);
+                ASSERT_EQ(standard.end() == it, nullptr == value);
+                if (nullptr != value)
+                {
+                    ASSERT_EQ(it->second, *value);
+                }
+                ASSERT_EQ(standard.count(key), frozen.count(key));
+
+                const size_t lower = std::distance(standard.begin(), standard.lower_bound(key));
+                const size_t upper = std::distance(standard.begin(), standard.upper_bound(key));
+                ASSERT_EQ(lower, frozen.lower_bound(key));
+                ASSERT_EQ(upper, frozen.upper_bound(key));
+                if (lower < standard.size())
+                {
+                    ASSERT_EQ(standard.lower_bound(key)->first, frozen.key(lower));
+                    ASSERT_EQ(standard.lower_bound(key)->second, frozen.value(lower));
+                }
+            }
+
+            for (uint32_t i = 0; i < 20; ++i)
+            {
+                const key_t first = rand.get() % max_key;
+                const key_t last = first + rand.get() % (max_key / 4 + 1);
+                std::vector<key_t> origin;
+                for (auto it = standard.lower_bound(first); standard.end() != it && it->first < last; ++it)
+                    origin.push_back(it->first);
+
+                std::vector<key_t> range;
+                frozen.for_each_range(first, last, [&range](const auto& key, const auto&) { range.push_back(key); });
+                ASSERT_EQ(origin, range);
+            }
+
+            tested.clear();
+        }
+
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, freeze)
+    {
+        FreezeTest<RBTree::FakeLock>(20000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, freeze_shared_mutex)
+    {
+        FreezeTest<std::shared_mutex>(2000);
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class Tested>
+    void CheckContent(Tested& tested, const std::map<key_t, value_t>& standard)
+    {
+        ASSERT_EQ(standard.size(), tested.size());
+        ASSERT_TRUE(tested.checkRB());
+        const std::vector<std::pair<key_t, value_t>> standard_v(standard.begin(), standard.end());
+        const std::vector<std::pair<key_t, value_t>> tested_v(tested.begin(), tested.end());
+        ASSERT_EQ(standard_v, tested_v);
+    }
+
+    //--------------------------------------------------------------//
+
+    // erase_range, split and join mixed with single inserts/erases, std::map as the reference
+    template<class Lock, class Allocator = std::allocator<std::pair<const key_t, value_t>>>
+    void RangeTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        const Allocator alloc;
+        testedmap_t<key_t, value_t, Lock, Allocator> tested(alloc);
+        testedmap_t<key_t, value_t, Lock, Allocator> right(alloc);
+        std::map<key_t, value_t> standard;
+
+        // nodes of a default allocator can't go to trees of another one
+        if constexpr (!std::allocator_traits<Allocator>::is_always_equal::value)
+        {
+            testedmap_t<key_t, value_t, Lock, Allocator> stranger;
+            stranger.emplace(nkeys, values[0]);
+            ASSERT_THROW(tested.join(stranger), std::invalid_argument);
+            ASSERT_THROW(tested.split(0, stranger), std::invalid_argument);
+            ASSERT_EQ(1u, stranger.size());
+        }
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            const key_t key = rand.get() % nkeys;
+            const uint32_t op = rand.get() % 16;
+            if (0 == op)
+            {
+                // ranges up to the whole tree and empty ones
+                const key_t last = key + rand.get() % ((0 == rand.get() % 4) ? nkeys + 1 : 64);
+                const size_t size = standard.size();
+                standard.erase(standard.lower_bound(key), standard.lower_bound(last));
+                ASSERT_EQ(size - standard.size(), tested.erase_range(key, last));
+            }
+            else if (1 == op)
+            {
+                // nodes of the donor are moved out of the block first
+                if (0 == rand.get() % 4)
+                    tested.compact();
+
+                std::map<key_t, value_t> standard_right(standard.lower_bound(key), standard.end());
+                standard.erase(standard.lower_bound(key), standard.end());
+                tested.split(key, right);
+                CheckContent(tested, standard);
+                CheckContent(right, standard_right);
+                if (::testing::Test::HasFatalFailure())
+                    return;
+
+                // join back, or over a new key between the trees
+                right.emplace(key, values[key % NVALUES]);
+                standard_right.emplace(key, values[key % NVALUES]);
+                if (0 == rand.get() % 4)
+                    right.compact();
+                tested.join(right);
+                ASSERT_EQ(0u, right.size());
+                standard.insert(standard_right.begin(), standard_right.end());
+            }
+            else if (op < 10)
+            {
+                standard.emplace(key, values[key % NVALUES]);
+                tested.emplace(key, values[key % NVALUES]);
+            }
+            else
+            {
+                ASSERT_EQ(standard.erase(key), tested.erase(key));
+            }
+
+            if (0 == iteration % 64 || op < 2)
+            {
+                CheckContent(tested, standard);
+                if (::testing::Test::HasFatalFailure())
+                    return;
+            }
+        }
+
+        // join of trees of every height difference
+        for (uint32_t size = 0; size < 2000; size = size * 2 + 1)
+        {
+            tested.clear();
+            standard.clear();
+            for (key_t key = 0; key < size; ++key)
+            {
+                tested.emplace(key, values[key % NVALUES]);
+                standard.emplace(key, values[key % NVALUES]);
+            }
+
+            for (uint32_t other = 0; other < 2000; other = other * 3 + 1)
+            {
+                for (key_t key = nkeys; key < nkeys + other; ++key)
+                {
+                    right.emplace(key, values[key % NVALUES]);
+                    standard.emplace(key, values[key % NVALUES]);
+                }
+
+                tested.join(right);
+                CheckContent(tested, standard);
+                if (::testing::Test::HasFatalFailure())
+                    return;
+
+                // and back
+                tested.split(nkeys, right);
+                standard.erase(standard.lower_bound(nkeys), standard.end());
+                CheckContent(tested, standard);
+                if (::testing::Test::HasFatalFailure())
+                    return;
+
+                right.clear();
+            }
+        }
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, range_split_join)
+    {
+        RangeTest<RBTree::FakeLock>(4096, 200000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, range_split_join_seqlock)
+    {
+        RangeTest<RBTree::SeqLock>(512, 50000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, range_split_join_pool)
+    {
+        RangeTest<RBTree::FakeLock, pool_allocator_t>(1024, 50000);
+    }
+
+    //--------------------------------------------------------------//
+
+    // random pairs of sets from empty to a few thousand keys, std::set_* as the reference
+    template<class Lock>
+    void SetAlgebraTest(uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        const auto key_less = [](const auto& one, const auto& other) { return one.first < other.first; };
+        RBTree::ThreadPool pool(4);
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            testedmap_t<key_t, value_t, Lock> tested;
+            testedmap_t<key_t, value_t, Lock> other;
+            std::map<key_t, value_t> standard;
+            std::map<key_t, value_t> standard_other;
+
+            // values differ, so it's seen whose node is kept
+            const key_t max_key = 1 + rand.get() % 4096;
+            for (uint32_t size = rand.get() % (1u << (rand.get() % 12)); standard.size() < std::min<size_t>(size, max_key);)
+            {
+                const key_t key = rand.get() % max_key;
+                standard.emplace(key, values[key % NVALUES]);
+                tested.emplace(key, values[key % NVALUES]);
+            }
+            for (uint32_t size = rand.get() % (1u << (rand.get() % 12)); standard_other.size() < std::min<size_t>(size, max_key);)
+            {
+                const key_t key = rand.get() % max_key;
+                standard_other.emplace(key, values[(key + 1) % NVALUES]);
+                other.emplace(key, values[(key + 1) % NVALUES]);
+            }
+
+            std::map<key_t, value_t> expected;
+            const auto out = std::inserter(expected, expected.end());
+            if (0 == iteration % 3)
+            {
+                std::set_union(standard.begin(), standard.end(), standard_other.begin(), standard_other.end(), out, key_less);
+
+                // nodes of other are moved out of its block first
+                if (0 == iteration % 2)
+                    other.compact();
+                const size_t moved = (0 == iteration % 4) ? tested.unite(other) : tested.unite(pool, other);
+                ASSERT_EQ(expected.size() - standard.size(), moved);
+                standard_other.clear();
+            }
+            else if (1 == iteration % 3)
+            {
+                std::set_intersection(standard.begin(), standard.end(), standard_other.begin(), standard_other.end(), out, key_less);
+                ASSERT_EQ(standard.size() - expected.size(), tested.intersect(other));
+            }
+            else
+            {
+                std::set_difference(standard.begin(), standard.end(), standard_other.begin(), standard_other.end(), out, key_less);
+                ASSERT_EQ(standard.size() - expected.size(), tested.subtract(other));
+            }
+
+            CheckContent(tested, expected);
+            CheckContent(other, standard_other);
+            if (::testing::Test::HasFatalFailure())
+                return;
+        }
+
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, set_algebra)
+    {
+        SetAlgebraTest<RBTree::FakeLock>(3000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, set_algebra_seqlock)
+    {
+        SetAlgebraTest<RBTree::SeqLock>(300);
+    }
+
+    //--------------------------------------------------------------//
+
+    using btree_t = RBTree::BTree<key_t, value_t>;
+
+    TEST(TreeTest, brut_btree_add_remove_small_sample)
+    {
+        constexpr uint32_t sample_size = 20;
+        constexpr uint32_t niterations = 10000;
+        constexpr uint32_t nthreads = 12;
+
+        TestBox<btree_t> tb;
+        tb.run(AddRemoveTestGenerator, sample_size, niterations, nthreads);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, brut_btree_add_remove_big_sample)
+    {
+        constexpr uint32_t sample_size = 10000;
+        constexpr uint32_t niterations = 100;
+        constexpr uint32_t nthreads = 12;
+
+        TestBox<btree_t> tb;
+        tb.run(AddRemoveTestGenerator, sample_size, niterations, nthreads);
+    }
+
+    //--------------------------------------------------------------//
+
+    // deep trees: growing, then shrinking to empty, std::map as the reference
+    template<class Tree, class MakeKey>
+    void BTreeTest(uint32_t nkeys, uint32_t niterations, MakeKey make_key)
+    {
+        using K = decltype(make_key(0));
+        Rand rand;
+        Tree tested;
+        std::map<K, uint32_t> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            const uint32_t index = rand.get() % nkeys;
+            const K key = make_key(index);
+            if (rand.get() % 8 < ((iteration < niterations / 2) ? 6u : 1u))
+            {
+                const bool is_inserted = standard.emplace(key, index).second;
+                const auto res = tested.emplace(key, index);
+                ASSERT_EQ(is_inserted, res.second);
+                ASSERT_EQ(key, res.first.key());
+            }
+            else
+            {
+                ASSERT_EQ(standard.erase(key), tested.erase(key));
+            }
+
+            ASSERT_EQ(standard.size(), tested.size());
+            if (0 == iteration % (niterations / 32))
+            {
+                ASSERT_TRUE(tested.checkRB());
+                const std::vector<std::pair<K, uint32_t>> standard_v(standard.begin(), standard.end());
+                const std::vector<std::pair<K, uint32_t>> tested_v(tested.begin(), tested.end());
+                ASSERT_EQ(standard_v, tested_v);
+
+                std::vector<std::pair<K, uint32_t>> reversed_v;
+                for (auto it = tested.end(); tested.begin() != it;)
+                {
+                    --it;
+                    reversed_v.emplace_back(it.key(), it.value());
+                }
+                ASSERT_TRUE(std::equal(standard_v.rbegin(), standard_v.rend(), reversed_v.begin(), reversed_v.end()));
+
+                for (uint32_t i = 0; i < 64; ++i)
+                {
+                    const K probe = make_key(rand.get() % nkeys);
+                    const auto lower = standard.lower_bound(probe);
+                    const auto upper = standard.upper_bound(probe);
+                    ASSERT_EQ(standard.count(probe), tested.count(probe));
+                    ASSERT_EQ(standard.end() == lower, tested.end() == tested.lower_bound(probe));
+                    ASSERT_EQ(standard.end() == upper, tested.end() == tested.upper_bound(probe));
+                    if (standard.end() != lower)
+                    {
+                        ASSERT_EQ(lower->first, tested.lower_bound(probe).key());
+                    }
+                    if (standard.end() != upper)
+                    {
+                        ASSERT_EQ(upper->first, tested.upper_bound(probe).key());
+                    }
+
+                    std::vector<K> origin;
+                    for (auto it = lower; standard.end() != it && origin.size() < 40; ++it)
+                        origin.push_back(it->first);
+                    const K last = origin.empty() ? probe : origin.back();
+                    if (!origin.empty())
+                        origin.pop_back();
+
+                    std::vector<K> range;
+                    tested.for_each_range(probe, last, [&range](const auto& key, const auto&) { range.push_back(key); });
+                    ASSERT_EQ(origin, range);
+                }
+            }
+        }
+
+        while (!standard.empty())
+        {
+            ASSERT_EQ(1u, tested.erase(standard.begin()->first));
+            standard.erase(standard.begin());
+        }
+        ASSERT_EQ(0u, tested.size());
+        ASSERT_TRUE(tested.checkRB());
+        ASSERT_TRUE(tested.end() == tested.begin());
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, btree)
+    {
+        // extremes of the unsigned compare
+        BTreeTest<RBTree::BTree<uint32_t, uint32_t>>(1 << 16, 400000,
+            [](uint32_t index) { return (index & 1) ? UINT32_MAX - index : index; });
+
+        BTreeTest<RBTree::BTree<uint32_t, uint32_t, std::shared_mutex>>(300, 100000, [](uint32_t index) { return index; });
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, btree_generic_keys)
+    {
+        BTreeTest<RBTree::BTree<int64_t, uint32_t>>(1 << 12, 100000, [](uint32_t index) { return (int64_t)index - 2000; });
+
+        // not arithmetic: binary search in nodes
+        BTreeTest<RBTree::BTree<std::array<char, 48>, uint32_t>>(1 << 12, 100000, [](uint32_t index)
+        {
+            std::array<char, 48> key{};
+            snprintf(key.data(), key.size(), "key with a long common prefix %u", index);
+            return key;
+        });
+    }
+    //--------------------------------------------------------------//
+
+    struct CountedValue
+    {
+        CountedValue* m_left;
+
+        CountedValue* m_right;
+
+        CountedValue* m_parent;
+
+        key_t m_key;
+
+        size_t m_count;
+    };
+
+    struct IntervalValue
+    {
+        IntervalValue* m_left;
+
+        IntervalValue* m_right;
+
+        IntervalValue* m_parent;
+
+        key_t m_key;
+
+        key_t m_high;
+
+        key_t m_max;
+    };
+
+    struct WeightedValue
+    {
+        WeightedValue* m_left;
+
+        WeightedValue* m_right;
+
+        WeightedValue* m_parent;
+
+        key_t m_key;
+
+        uint64_t m_weight;
+
+        uint64_t m_sum;
+    };
+
+    //--------------------------------------------------------------//
+
+    // one random modification through every path that relinks nodes
+    // storage[key] has m_key == key
+    template<class Tree, class Value>
+    void MutateAugmented(Rand& rand, Tree& tested, std::vector<Value>& storage, std::map<key_t, Value*>& standard)
+    {
+        const key_t nkeys = (key_t)storage.size();
+        const key_t key = rand.get() % nkeys;
+        const uint32_t op = rand.get() % 16;
+        if (0 == op)
+        {
+            // rebuild from every third key
+            std::vector<Value*> sorted;
+            standard.clear();
+            for (key_t k = key % 3; k < nkeys; k += 3)
+            {
+                sorted.push_back(&storage[k]);
+                standard.emplace(k, &storage[k]);
+            }
+
+            tested.build_from_sorted(sorted.begin(), sorted.end());
+        }
+        else if (1 == op)
+        {
+            Value* const value = tested.pop_front();
+            ASSERT_EQ(standard.empty(), nullptr == value);
+            if (nullptr != value)
+                standard.erase(standard.begin());
+        }
+        else if (5 == op)
+        {
+            // parts have no common keys, so nothing is disposed
+            Tree right;
+            tested.split(key, right);
+            const size_t size = right.size();
+            ASSERT_EQ(size, tested.unite(right, [](Value*) { ADD_FAILURE(); }));
+        }
+        else if (6 == op || 7 == op)
+        {
+            // other tree of its own values: keys [key, key + 8) or all keys but them
+            std::vector<Value> other_storage(nkeys);
+            std::vector<Value*> sorted;
+            for (key_t k = 0; k < nkeys; ++k)
+            {
+                other_storage[k].m_key = k;
+                if ((key <= k && k < key + 8) == (6 == op))
+                    sorted.push_back(&other_storage[k]);
+            }
+
+            Tree other;
+            other.build_from_sorted(sorted.begin(), sorted.end());
+
+            const size_t size = standard.size();
+            standard.erase(standard.lower_bound(key), standard.lower_bound(key + 8));
+            const size_t erased = (6 == op) ? tested.subtract(other, [](Value*) { }) :
+                                              tested.intersect(other, [](Value*) { });
+            ASSERT_EQ(size - standard.size(), erased);
+            ASSERT_TRUE(other.checkRB());
+        }
+        else if (2 == op && !standard.count(key))
+        {
+            tested.insert(tested.lower_bound(key), &storage[key]);
+            standard.emplace(key, &storage[key]);
+        }
+        else if (3 == op)
+        {
+            const key_t last = key + rand.get() % 32;
+            const size_t size = standard.size();
+            standard.erase(standard.lower_bound(key), standard.lower_bound(last));
+            ASSERT_EQ(size - standard.size(), tested.erase_range(key, last, [](Value*) { }));
+        }
+        else if (4 == op)
+        {
+            // both parts must be valid, then the whole
+            Tree right;
+            tested.split(key, right);
+            ASSERT_TRUE(tested.checkRB());
+            ASSERT_TRUE(right.checkRB());
+            ASSERT_EQ((size_t)std::distance(standard.lower_bound(key), standard.end()), right.size());
+            tested.join(right);
+        }
+        else if (op < 9)
+        {
+            if (standard.emplace(key, &storage[key]).second)
+            {
+                ASSERT_TRUE(tested.insert(&storage[key]).second);
+            }
+        }
+        else
+        {
+            ASSERT_EQ(standard.erase(key), tested.erase(key));
+        }
+
+        ASSERT_TRUE(tested.checkRB());
+    }
+
+    //--------------------------------------------------------------//
+
+    void OrderStatisticsTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<CountedValue> storage(nkeys);
+        for (key_t key = 0; key < nkeys; ++key)
+            storage[key].m_key = key;
+
+        RBTree::NoNodeRBTree<key_t, CountedValue*> tested;
+        std::map<key_t, CountedValue*> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            MutateAugmented(rand, tested, storage, standard);
+            if (::testing::Test::HasFatalFailure())
+                return;
+
+            const key_t first = rand.get() % (nkeys + 1);
+            const key_t last = rand.get() % (nkeys + 1);
+            const size_t first_rank = std::distance(standard.begin(), standard.lower_bound(first));
+            const size_t last_rank = std::distance(standard.begin(), standard.lower_bound(last));
+            ASSERT_EQ(first_rank, tested.rank(first));
+            ASSERT_EQ((first_rank < last_rank) ? last_rank - first_rank : 0, tested.count_range(first, last));
+
+            if (first_rank < standard.size())
+            {
+                ASSERT_EQ(std::next(standard.begin(), first_rank)->first, (*tested.select(first_rank)).first);
+            }
+            ASSERT_TRUE(tested.end() == tested.select(standard.size()));
+        }
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, order_statistics)
+    {
+        OrderStatisticsTest(512, 100000);
+    }
+
+    //--------------------------------------------------------------//
+
+    void IntervalTest(uint32_t nkeys, uint32_t max_length, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<IntervalValue> storage(nkeys);
+        for (key_t key = 0; key < nkeys; ++key)
+        {
+            storage[key].m_key = key;
+            storage[key].m_high = key + rand.get() % max_length;
+        }
+
+        RBTree::NoNodeRBTree<key_t, IntervalValue*, RBTree::IntervalAugment> tested;
+        std::map<key_t, IntervalValue*> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            MutateAugmented(rand, tested, storage, standard);
+            if (::testing::Test::HasFatalFailure())
+                return;
+
+            const key_t low = rand.get() % (nkeys + max_length);
+            const key_t high = low + rand.get() % max_length;
+
+            std::vector<key_t> expected;
+            for (const auto& pair : standard)
+            {
+                if (pair.first <= high && low <= pair.second->m_high)
+                    expected.push_back(pair.first);
+            }
+
+            std::vector<key_t> found;
+            RBTree::find_overlapping(tested, low, high, [&](IntervalValue* value) { found.push_back(value->m_key); });
+            ASSERT_EQ(expected, found);
+        }
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, interval_overlapping)
+    {
+        IntervalTest(512, 8, 50000);
+        IntervalTest(512, 200, 50000);
+    }
+
+    //--------------------------------------------------------------//
+
+    void RangeSumTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<WeightedValue> storage(nkeys);
+        for (key_t key = 0; key < nkeys; ++key)
+        {
+            storage[key].m_key = key;
+            storage[key].m_weight = rand.get() % 1000;
+        }
+
+        RBTree::NoNodeRBTree<key_t, WeightedValue*, RBTree::SumAugment> tested;
+        std::map<key_t, WeightedValue*> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            MutateAugmented(rand, tested, storage, standard);
+            if (::testing::Test::HasFatalFailure())
+                return;
+
+            const key_t first = rand.get() % (nkeys + 1);
+            const key_t last = rand.get() % (nkeys + 1);
+
+            uint64_t expected = 0;
+            for (auto it = standard.lower_bound(first); standard.end() != it && it->first < last; ++it)
+                expected += it->second->m_weight;
+
+            ASSERT_EQ(expected, RBTree::sum_range(tested, first, last));
+        }
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, range_sum)
+    {
+        RangeSumTest(512, 100000);
+    }
+
+    //--------------------------------------------------------------//
+
+    // reduce() result: keys seen by combine must come in increasing order
+    struct KeySpan
+    {
+        uint64_t m_count;
+
+        key_t m_first;
+
+        key_t m_last;
+
+        bool m_is_ordered;
+    };
+
+    KeySpan CombineSpans(const KeySpan& one, const KeySpan& other)
+    {
+        if (0 == one.m_count)
+            return other;
+
+        if (0 == other.m_count)
+            return one;
+
+        return KeySpan{one.m_count + other.m_count, one.m_first, other.m_last,
+                       one.m_is_ordered && other.m_is_ordered && one.m_last < other.m_first};
+    }
+
+    //--------------------------------------------------------------//
+
+    // forks nested deeper than a queue holds, calls counts both tasks of every fork
+    void NestForks(RBTree::ThreadPool& pool, uint32_t depth, std::atomic<uint32_t>& calls)
+    {
+        ++calls;
+        if (0 != depth)
+            pool.invoke([&]() { NestForks(pool, depth - 1, calls); }, [&]() { ++calls; });
+    }
+
+    //--------------------------------------------------------------//
+
+    // parallel build/for_each/reduce/clear for pools of a few sizes, the plain versions as the reference
+    void ParallelTest(uint32_t max_size)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        for (const uint32_t nthreads : {1u, 2u, 3u, 8u})
+        {
+            RBTree::ThreadPool pool(nthreads);
+            for (uint32_t size = 0; size <= max_size; size = (size < 20) ? size + 1 : size * 4)
+            {
+                std::vector<std::pair<key_t, value_t>> pairs;
+                for (key_t key = rand.get() % 4; pairs.size() < size; key += 1 + rand.get() % 4)
+                    pairs.emplace_back(key, values[key % NVALUES]);
+
+                testedmap_t<key_t, value_t> tested;
+                tested.emplace(pairs.empty() ? 0 : pairs.back().first + 1, values[0]);
+                tested.build_from_sorted(pool, pairs.begin(), pairs.end());
+                ASSERT_TRUE(tested.checkRB());
+                const std::vector<std::pair<key_t, value_t>> tested_v(tested.begin(), tested.end());
+                ASSERT_EQ(pairs, tested_v);
+
+                // every key once
+                const key_t max_key = pairs.empty() ? 0 : pairs.back().first;
+                std::vector<std::atomic<uint32_t>> seen(max_key + 1);
+                tested.for_each(pool, [&seen](const auto& key, const auto&) { ++seen[key]; });
+                for (const auto& pair : pairs)
+                    ASSERT_EQ(1u, seen[pair.first].exchange(0));
+                for (const auto& count : seen)
+                    ASSERT_EQ(0u, count.load());
+
+                const KeySpan span = tested.reduce(pool, KeySpan{0, 0, 0, true},
+                    [](const auto& key, const auto&) { return KeySpan{1, key, key, true}; }, CombineSpans);
+                ASSERT_EQ(size, span.m_count);
+                ASSERT_TRUE(span.m_is_ordered);
+                if (0 != size)
+                {
+                    ASSERT_EQ(pairs.front().first, span.m_first);
+                    ASSERT_EQ(pairs.back().first, span.m_last);
+                }
+
+                tested.clear(pool);
+                ASSERT_EQ(0u, tested.size());
+                ASSERT_TRUE(tested.checkRB());
+
+                // the built tree is replaced in turn, slabs hold both old and new nodes
+                pool_testedmap_t pooled;
+                pooled.build_from_sorted(pool, pairs.begin(), pairs.end());
+                pooled.build_from_sorted(pool, pairs.begin(), pairs.end());
+                ASSERT_EQ(size, pooled.size());
+                ASSERT_TRUE(pooled.checkRB());
+                const std::vector<std::pair<key_t, value_t>> pooled_v(pooled.begin(), pooled.end());
+                ASSERT_EQ(pairs, pooled_v);
+            }
+
+            // augmented values, disposer from the pool threads
+            std::vector<CountedValue> storage(max_size);
+            std::vector<CountedValue*> sorted(max_size);
+            for (key_t key = 0; key < max_size; ++key)
+            {
+                storage[key].m_key = key;
+                sorted[key] = &storage[key];
+            }
+
+            RBTree::NoNodeRBTree<key_t, CountedValue*> counted;
+            counted.build_from_sorted(pool, sorted.begin(), sorted.end());
+            ASSERT_TRUE(counted.checkRB());
+            ASSERT_EQ(max_size / 2, counted.rank(max_size / 2));
+
+            std::atomic<size_t> disposed(0);
+            counted.clearWithDispose(pool, [&disposed](CountedValue*) { ++disposed; });
+            ASSERT_EQ(max_size, disposed.load());
+
+            std::atomic<uint32_t> calls(0);
+            pool.run([&]() { NestForks(pool, 1000, calls); });
+            ASSERT_EQ(2001u, calls.load());
+
+            // exceptions come out of any fork, the lock is released
+            ASSERT_THROW(pool.run([&]()
+            {
+                pool.for_range(0, max_size, 1, [max_size](size_t i)
+                {
+                    if (max_size / 3 == i)
+                        throw std::runtime_error("for_range");
+                });
+            }), std::runtime_error);
+
+            std::vector<std::pair<key_t, value_t>> pairs;
+            for (key_t key = 0; key < max_size; ++key)
+                pairs.emplace_back(key, values[key % NVALUES]);
+
+            testedmap_t<key_t, value_t, std::mutex> locked;
+            locked.build_from_sorted(pool, pairs.begin(), pairs.end());
+            ASSERT_THROW(locked.for_each(pool, [max_size](const auto& key, const auto&)
+            {
+                if (max_size / 2 == key)
+                    throw std::runtime_error("for_each");
+            }), std::runtime_error);
+            ASSERT_THROW(locked.reduce(pool, 0u, [](const auto& key, const auto&)
+            {
+                if (0 == key)
+                    throw std::runtime_error("reduce");
+                return 1u;
+            }, std::plus<uint32_t>()), std::runtime_error);
+            ASSERT_EQ(1u, locked.erase(0));
+            locked.clear(pool);
+        }
+
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, parallel_bulk)
+    {
+        ParallelTest(100000);
+    }
+
+    // forward/backward walks of both iterator kinds against keys of the standard
+    template<class Tested, class Key>
+    void CheckBidirectional(const Tested& tested, const std::vector<Key>& expected)
+    {
+        std::vector<Key> keys;
+        for (auto it = tested.begin(); tested.end() != it; ++it)
+            keys.push_back(it.key());
+        ASSERT_EQ(expected, keys);
+
+        keys.clear();
+        for (auto it = tested.end(); tested.begin() != it;)
+            keys.push_back((--it).key());
+        std::reverse(keys.begin(), keys.end());
+        ASSERT_EQ(expected, keys);
+
+        keys.clear();
+        for (auto it = tested.rbegin(); tested.rend() != it; it++)
+            keys.push_back(it.key());
+        std::reverse(keys.begin(), keys.end());
+        ASSERT_EQ(expected, keys);
+
+        keys.clear();
+        for (auto it = tested.rend(); tested.rbegin() != it;)
+            keys.push_back((--it).key());
+        ASSERT_EQ(expected, keys);
+
+        if (!expected.empty())
+        {
+            ASSERT_TRUE(tested.back() == std::prev(tested.end()));
+            ASSERT_TRUE(tested.front() == std::prev(std::next(tested.begin())));
+        }
+    }
+
+    //--------------------------------------------------------------//
+
+    void IterationTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        testedmap_t<key_t, uint32_t> tested;
+        testedmap_t<std::string, uint32_t> tested_strings;
+        std::map<key_t, uint32_t> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            const key_t key = rand.get() % nkeys;
+            if (rand.get() % 2)
+            {
+                tested.insert(key, iteration);
+                tested_strings.insert(std::pair<std::string, uint32_t>(std::to_string(key + nkeys), iteration));
+                standard.emplace(key, iteration);
+            }
+            else
+            {
+                tested.erase(key);
+                tested_strings.erase(std::to_string(key + nkeys));
+                standard.erase(key);
+            }
+
+            std::vector<key_t> keys;
+            std::vector<std::string> strings;
+            for (const auto& pair : standard)
+            {
+                keys.push_back(pair.first);
+                strings.push_back(std::to_string(pair.first + nkeys));
+            }
+
+            CheckBidirectional(tested, keys);
+            if (::testing::Test::HasFatalFailure())
+                return;
+
+            CheckBidirectional(tested_strings, strings);
+            if (::testing::Test::HasFatalFailure())
+                return;
+
+            const key_t first = rand.get() % (nkeys + 1);
+            const key_t last = rand.get() % (nkeys + 1);
+            std::vector<std::pair<key_t, uint32_t>> expected;
+            for (auto it = standard.lower_bound(first); standard.end() != it && it->first < last; ++it)
+                expected.emplace_back(it->first, it->second);
+
+            std::vector<std::pair<key_t, uint32_t>> visited;
+            tested.for_each_range(first, last, [&visited](const key_t& key, const uint32_t& value)
+            {
+                visited.emplace_back(key, value);
+            });
+            ASSERT_EQ(expected, visited);
+        }
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, bidirectional_iteration)
+    {
+        IterationTest(256, 5000);
+    }
+
+    //--------------------------------------------------------------//
+
+    void FindBatchTest(uint32_t nkeys, uint32_t niterations)
+    {
+        using node_t = std::remove_pointer_t<value_t>;
+
+        Rand rand;
+        std::vector<node_t> storage(nkeys);
+        for (key_t key = 0; key < nkeys; ++key)
+            storage[key].m_key = key;
+
+        RBTree::NoNodeRBTree<key_t, node_t*> tested;
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            for (uint32_t i = 0; i < 8; ++i)
+            {
+                const key_t key = rand.get() % nkeys;
+                if (rand.get() % 2)
+                    tested.insert(&storage[key]);
+                else
+                    tested.erase(key);
+            }
+
+            // duplicates and missing keys included, size goes over the lane count
+            std::vector<key_t> keys(rand.get() % 100);
+            for (key_t& key : keys)
+                key = rand.get() % (nkeys + 16);
+
+            std::vector<node_t*> found(keys.size(), &storage[0]);
+            tested.find_batch(keys.begin(), keys.end(), found.begin());
+
+            for (size_t i = 0; i < keys.size(); ++i)
+                ASSERT_EQ(tested.find(keys[i]).operator->(), found[i]);
+        }
+
+        tested.clear();
+        std::vector<key_t> keys(20, 1);
+        std::vector<node_t*> found(keys.size(), &storage[0]);
+        tested.find_batch(keys.begin(), keys.end(), found.data());
+        ASSERT_EQ(std::vector<node_t*>(keys.size(), nullptr), found);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, find_batch)
+    {
+        FindBatchTest(300, 20000);
+    }
+
+    //--------------------------------------------------------------//
+
+    struct IndexValue
+    {
+        RBTree::IndexPtr<IndexValue> m_left;
+
+        RBTree::IndexPtr<IndexValue> m_right;
+
+        RBTree::IndexPtr<IndexValue> m_parent;
+
+        key_t m_key;
+
+        uint32_t m_value;
+
+        size_t m_count;
+    };
+
+    //--------------------------------------------------------------//
+
+    void IndexPtrTest(uint32_t nkeys, uint32_t niterations)
+    {
+        using pointer_t = RBTree::IndexPtr<IndexValue>;
+
+        Rand rand;
+        RBTree::IndexPool<IndexValue> pool(nkeys);
+        RBTree::NoNodeRBTree<key_t, pointer_t> tested;
+        std::map<key_t, uint32_t> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            const key_t key = rand.get() % nkeys;
+            const uint32_t op = rand.get() % 8;
+            if (0 == op)
+            {
+                const pointer_t value = (rand.get() % 2) ? tested.pop_front() : tested.pop_back();
+                ASSERT_EQ(standard.empty(), nullptr == value);
+                if (nullptr != value)
+                {
+                    ASSERT_EQ(1, standard.erase(value->m_key));
+                    pool.deallocate(value);
+                }
+            }
+            else if (op < 5)
+            {
+                if (!standard.count(key))
+                {
+                    const pointer_t value = pool.allocate();
+                    ASSERT_TRUE(nullptr != value);
+                    value->m_key = key;
+                    value->m_value = iteration;
+                    if (op % 2)
+                        tested.insert(tested.lower_bound(key), value);
+                    else
+                        ASSERT_TRUE(tested.insert(value).second);
+                    standard.emplace(key, iteration);
+                }
+            }
+            else
+            {
+                auto it = tested.find(key);
+                ASSERT_EQ(standard.count(key), (size_t)(tested.end() != it));
+                if (tested.end() != it)
+                {
+                    const pointer_t value = it.operator->();
+                    tested.erase(it);
+                    standard.erase(key);
+                    pool.deallocate(value);
+                }
+            }
+
+            ASSERT_TRUE(tested.checkRB());
+            ASSERT_EQ(std::distance(standard.begin(), standard.lower_bound(key)), tested.rank(key));
+        }
+
+        // links don't depend on where the pool is
+        std::vector<IndexValue> moved(pointer_t::base(), pointer_t::base() + nkeys + 1);
+        IndexValue* const base = pointer_t::base();
+        pointer_t::attach(moved.data());
+        std::memset((void*)(base + 1), 0xff, sizeof(IndexValue) * nkeys);
+
+        ASSERT_TRUE(tested.checkRB());
+        std::vector<std::pair<key_t, uint32_t>> tested_v;
+        tested.for_each([&tested_v](pointer_t value) { tested_v.emplace_back(value->m_key, value->m_value); });
+        const std::vector<std::pair<key_t, uint32_t>> standard_v(standard.begin(), standard.end());
+        ASSERT_EQ(standard_v, tested_v);
+
+        pointer_t::attach(base);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, index_ptr_links)
+    {
+        IndexPtrTest(300, 100000);
+    }
+
+    //--------------------------------------------------------------//
+
+    void TreeImageTest(uint32_t nkeys, uint32_t niterations)
+    {
+        using pointer_t = RBTree::IndexPtr<IndexValue>;
+        using image_t = RBTree::TreeImage<IndexValue>;
+
+        Rand rand;
+        std::map<key_t, uint32_t> standard;
+        const std::string path = ::testing::TempDir() + "rbtree_image_test.bin";
+        {
+            RBTree::IndexPool<IndexValue> pool(nkeys);
+            RBTree::NoNodeRBTree<key_t, pointer_t> tree;
+
+            // erases leave holes in the pool
+            for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+            {
+                const key_t key = rand.get() % nkeys;
+                auto it = tree.find(key);
+                if (tree.end() == it)
+                {
+                    const pointer_t value = pool.allocate();
+                    value->m_key = key;
+                    value->m_value = iteration;
+                    tree.insert(value);
+                    standard[key] = iteration;
+                }
+                else if (rand.get() % 2)
+                {
+                    const pointer_t value = it.operator->();
+                    tree.erase(it);
+                    pool.deallocate(value);
+                    standard.erase(key);
+                }
+            }
+
+            image_t::save(path.c_str(), tree);
+        }
+
+        {
+            image_t image(path.c_str());
+            RBTree::NoNodeRBTree<key_t, pointer_t> tree;
+            image.adopt(tree);
+
+            ASSERT_EQ(standard.size(), image.size());
+            ASSERT_EQ(standard.size(), tree.size());
+            ASSERT_TRUE(tree.checkRB());
+
+            std::vector<std::pair<key_t, uint32_t>> tested_v;
+            tree.for_each([&tested_v](pointer_t value) { tested_v.emplace_back(value->m_key, value->m_value); });
+            const std::vector<std::pair<key_t, uint32_t>> standard_v(standard.begin(), standard.end());
+            ASSERT_EQ(standard_v, tested_v);
+
+            for (key_t key = 0; key < nkeys; ++key)
+            {
+                ASSERT_EQ(standard.count(key), tree.count(key));
+                ASSERT_EQ(std::distance(standard.begin(), standard.lower_bound(key)), tree.rank(key));
+            }
+
+            // private mapping, the file stays as it is
+            for (key_t key = 0; key < nkeys; key += 2)
+                tree.erase(key);
+            ASSERT_TRUE(tree.checkRB());
+        }
+
+        {
+            image_t image(path.c_str());
+            ASSERT_EQ(standard.size(), image.size());
+        }
+
+        std::remove(path.c_str());
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, tree_image_round_trip)
+    {
+        TreeImageTest(1, 0);
+        TreeImageTest(1, 10);
+        TreeImageTest(300, 1000);
+        TreeImageTest(5000, 20000);
+
+        ASSERT_THROW(RBTree::TreeImage<IndexValue>("/nonexistent/rbtree_image"), std::runtime_error);
+    }
+    //--------------------------------------------------------------//
+
+    template<class Partition>
+    void ShardedTest(const Partition& partition, uint32_t sample_size, uint32_t niterations)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        std::vector<TestCommand> sample(sample_size, {0, 0});
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            AddRemoveTestGenerator(sample, sample_size);
+
+            RBTree::ShardedRBTree<key_t, value_t, RBTree::FakeLock, 4, Partition> tested(partition);
+            std::map<key_t, value_t> standard;
+
+            for (const TestCommand& cmd : sample)
+            {
+                if (cmd.m_is_add)
+                    ASSERT_EQ(standard.emplace(cmd.m_key, values[cmd.m_key]).second, tested.emplace(cmd.m_key, values[cmd.m_key]));
+                else
+                    ASSERT_EQ(standard.erase(cmd.m_key), tested.erase(cmd.m_key));
+            }
+
+            ASSERT_EQ(standard.size(), tested.size());
+            ASSERT_TRUE(tested.checkRB());
+
+            std::vector<std::pair<key_t, value_t>> origin_v(standard.begin(), standard.end());
+            std::vector<std::pair<key_t, value_t>> tested_v(tested.begin(), tested.end());
+            ASSERT_EQ(origin_v, tested_v);
+
+            for (key_t key = 0; key <= MAX_KEY; ++key)
+            {
+                ASSERT_EQ(standard.count(key), tested.count(key));
+                ASSERT_EQ(standard.end() == standard.find(key), tested.end() == tested.find(key));
+
+                // other shards are sought on the first step from find()
+                const auto origin_found = standard.find(key);
+                if (standard.end() != origin_found)
+                {
+                    auto tested_found = tested.find(key);
+                    ASSERT_EQ(key, (*tested_found).first);
+                    ASSERT_EQ(std::distance(origin_found, standard.end()), std::distance(tested_found, tested.end()));
+                }
+
+                const auto origin_it = standard.lower_bound(key);
+                auto tested_it = tested.lower_bound(key);
+                ASSERT_EQ(standard.end() == origin_it, tested.end() == tested_it);
+                if (standard.end() != origin_it)
+                {
+                    ASSERT_EQ(origin_it->first, (*tested_it).first);
+                    ASSERT_EQ(std::distance(origin_it, standard.end()), std::distance(tested_it, tested.end()));
+                }
+            }
+        }
+
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, sharded_hash)
+    {
+        ShardedTest(RBTree::HashPartition<key_t>(), 40, 2000);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, sharded_range)
+    {
+        ShardedTest(RBTree::RangePartition<key_t>::uniform(0, MAX_KEY, 4), 40, 2000);
+    }
+
+    //--------------------------------------------------------------//
+
+    template<class K>
+    void UniformBoundsTest(K min, K max, size_t nshards)
+    {
+        const RBTree::RangePartition<K> partition = RBTree::RangePartition<K>::uniform(min, max, nshards);
+        ASSERT_EQ(nshards - 1, partition.m_bounds.size());
+        ASSERT_TRUE(std::is_sorted(partition.m_bounds.begin(), partition.m_bounds.end()));
+        ASSERT_EQ(0u, partition(min, nshards));
+        ASSERT_EQ(nshards - 1, partition(max, nshards));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, sharded_range_uniform_wide)
+    {
+        UniformBoundsTest<uint64_t>(0, std::numeric_limits<uint64_t>::max(), 16);
+        UniformBoundsTest<int64_t>(std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max(), 7);
+        UniformBoundsTest<int32_t>(-100, 100, 3);
+        UniformBoundsTest<double>(-1.0, 1.0, 4);
+    }
+
+    //--------------------------------------------------------------//
+
+    // random inserts/erases/finds in one thread, std::map as the reference
+    void ConcurrentTreeTest(uint32_t nkeys, uint32_t niterations)
+    {
+        Rand rand;
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        RBTree::ConcurrentRBTree<key_t, value_t> tested;
+        std::map<key_t, value_t> standard;
+
+        for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+        {
+            const uint64_t random = rand.get();
+            const key_t key = High(random) % nkeys;
+            value_t const value = values[key % NVALUES];
+            switch (Low(random) % 3)
+            {
+            case 0:
+                ASSERT_EQ(standard.emplace(key, value).second, tested.emplace(key, value));
+                break;
+            case 1:
+                ASSERT_EQ(standard.erase(key), tested.erase(key));
+                break;
+            default:
+                ASSERT_EQ(standard.count(key), tested.count(key));
+                ASSERT_EQ(standard.count(key) ? std::optional<value_t>(value) : std::nullopt, tested.find(key));
+                break;
+            }
+
+            ASSERT_EQ(standard.size(), tested.size());
+            if (0 == iteration % 64)
+            {
+                ASSERT_TRUE(tested.checkRB());
+
+                const std::vector<std::pair<key_t, value_t>> standard_v(standard.begin(), standard.end());
+                std::vector<std::pair<key_t, value_t>> tested_v;
+                tested.for_each([&tested_v](key_t key, value_t value) { tested_v.emplace_back(key, value); });
+                ASSERT_EQ(standard_v, tested_v);
+            }
+        }
+
+        tested.clear();
+        ASSERT_EQ(0u, tested.size());
+        ASSERT_EQ(0u, tested.retired());
+        ASSERT_TRUE(tested.checkRB());
+
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, concurrent_tree)
+    {
+        ConcurrentTreeTest(16, 100000);
+        ConcurrentTreeTest(4096, 200000);
+    }
+
+    //--------------------------------------------------------------//
+
+    // writers own keys by (key / 4) % nwriters and check every result by their own std::set,
+    // keys % 4 == 0 are always there for readers
+    void ConcurrentStressTest(uint32_t nreaders, uint32_t nwriters, uint32_t nkeys, uint32_t niterations)
+    {
+        std::vector<value_t> values = GenValues<std::remove_pointer_t<value_t>>(NVALUES);
+        RBTree::ConcurrentRBTree<key_t, value_t> tested;
+        for (key_t key = 0; key < nkeys; key += 4)
+            tested.emplace(key, values[key % NVALUES]);
+
+        std::vector<std::set<key_t>> owned(nwriters);
+        std::atomic<uint32_t> nactive(nwriters);
+        std::atomic<bool> failed(false);
+
+        std::list<std::thread> treads;
+        for (uint32_t i = 0; i < nwriters; ++i)
+        {
+            treads.emplace_back([&tested, &values, &owned, &nactive, &failed, nwriters, nkeys, niterations](uint32_t id)
+            {
+                std::vector<key_t> keys;
+                for (key_t key = 0; key < nkeys; ++key)
+                {
+                    if ((0 != key % 4) && (id == (key / 4) % nwriters))
+                        keys.push_back(key);
+                }
+
+                Rand rand;
+                std::set<key_t>& standard = owned[id];
+                for (uint32_t iteration = 0; iteration < niterations; ++iteration)
+                {
+                    const uint64_t random = rand.get();
+                    const key_t key = keys[High(random) % keys.size()];
+                    if (0 == Low(random) % 2)
+                    {
+                        if (standard.insert(key).second != tested.emplace(key, values[key % NVALUES]))
+                            failed = true;
+                    }
+                    else
+                    {
+                        if (standard.erase(key) != tested.erase(key))
+                            failed = true;
+                    }
+                }
+
+                --nactive;
+            }, i);
+        }
+
+        for (uint32_t i = 0; i < nreaders; ++i)
+        {
+            treads.emplace_back([&tested, &values, &nactive, &failed, nkeys]()
+            {
+                Rand rand;
+                while (0 != nactive)
+                {
+                    const key_t key = (rand.get() % (nkeys / 4)) * 4;
+                    if (std::optional<value_t>(values[key % NVALUES]) != tested.find(key))
+                        failed = true;
+
+                    if (tested.contains(key + nkeys))
+                        failed = true;
+                }
+            });
+        }
+
+        for (auto& tread : treads)
+            tread.join();
+
+        ASSERT_FALSE(failed);
+        ASSERT_TRUE(tested.checkRB());
+
+        std::set<key_t> standard;
+        for (key_t key = 0; key < nkeys; key += 4)
+            standard.insert(key);
+        for (const std::set<key_t>& keys : owned)
+            standard.insert(keys.begin(), keys.end());
+
+        std::vector<key_t> tested_v;
+        tested.for_each([&tested_v](key_t key, value_t) { tested_v.push_back(key); });
+        ASSERT_EQ(std::vector<key_t>(standard.begin(), standard.end()), tested_v);
+        ASSERT_EQ(standard.size(), tested.size());
+
+        tested.clear();
+        KillValues(values);
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_concurrent_tree)
+    {
+        ConcurrentStressTest(4, 4, 1024, 50000);
+        ConcurrentStressTest(2, 8, 64, 20000);
+    }
+
+    //--------------------------------------------------------------//
+
+    using concurrent_testedmap_t = RBTree::ConcurrentRBTree<key_t, value_t>;
+    using seqlock_testedmap_t = testedmap_t<key_t, value_t, RBTree::SeqLock>;
+    using combining_testedmap_t = testedmap_t<key_t, value_t, RBTree::FlatCombiningLock<>>;
+
+    TEST(TreeTest, linearizability_checker)
+    {
+        using box_t = TestBox<concurrent_testedmap_t>;
+
+        // find called after add returned
+        ASSERT_FALSE(box_t::isLinearizable({{1, HistoryOp::Add, true, 0, 1}, {1, HistoryOp::Find, false, 2, 3}}));
+        // or during it
+        ASSERT_TRUE(box_t::isLinearizable({{1, HistoryOp::Add, true, 0, 3}, {1, HistoryOp::Find, false, 1, 2}}));
+        // two adds, no remove
+        ASSERT_FALSE(box_t::isLinearizable({{1, HistoryOp::Add, true, 0, 5}, {1, HistoryOp::Add, true, 1, 6},
+                                            {1, HistoryOp::Find, true, 2, 3}}));
+        // add, remove, add of overlapping calls
+        ASSERT_TRUE(box_t::isLinearizable({{1, HistoryOp::Add, true, 0, 5}, {1, HistoryOp::Remove, true, 1, 6},
+                                           {1, HistoryOp::Add, true, 2, 7}, {1, HistoryOp::Find, true, 8, 9}}));
+        // the first order tried is wrong: remove has to go between the adds
+        ASSERT_TRUE(box_t::isLinearizable({{1, HistoryOp::Add, true, 0, 9}, {1, HistoryOp::Add, true, 1, 8},
+                                           {1, HistoryOp::Remove, true, 2, 7}, {1, HistoryOp::Find, true, 10, 11}}));
+        // keys are independent
+        ASSERT_FALSE(box_t::isLinearizable({{1, HistoryOp::Add, true, 0, 1}, {2, HistoryOp::Remove, true, 2, 3}}));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_linearizable_concurrent)
+    {
+        TestBox<concurrent_testedmap_t> tb;
+        ASSERT_TRUE(tb.run_concurrent(8, 4, 4000));
+        ASSERT_TRUE(tb.run_concurrent(8, NVALUES, 4000));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_linearizable_seqlock)
+    {
+        TestBox<seqlock_testedmap_t> tb;
+        ASSERT_TRUE(tb.run_concurrent(8, 4, 4000));
+        ASSERT_TRUE(tb.run_concurrent(8, NVALUES, 4000));
+    }
+
+    //--------------------------------------------------------------//
+
+    TEST(TreeTest, mt_linearizable_flat_combining)
+    {
+        TestBox<combining_testedmap_t> tb;
+        ASSERT_TRUE(tb.run_concurrent(8, 4, 4000));
+        ASSERT_TRUE(tb.run_concurrent(8, NVALUES, 4000));
+    }
+
     //////////////////////////////////////////////////////////////////
     //                           custom tests                       //
     //////////////////////////////////////////////////////////////////